@@ -42,17 +42,226 @@
 
 #define MAX_SEQUENCER_LENGTH 384
 #define MAX_POLYPHONY 14
-#define MAX_BPM 255
+#define MIN_BPM 45
+#define MAX_BPM 300
+#define TEMPO_SCALE 10 // global_seq.tempo is kept in tenths of a BPM
 #define MAX_PC_BANK 31
 #define MAX_MIDI_CHANNEL 16
 #define MAX_NOTES_PER_BEAT 8
 #define MAX_MIDI_NOTE 127
 #define MAX_PROBABILITY 100
+#define MAX_GATE 100
+#define MAX_TRACK_LENGTH 255 // steps a key can loop over on its own, 0 == the pattern length
 
 #define DEFAULT_MIDI_CHANNEL 8
 
 #define SX1509_PIN_CT 16
 
+// pattern bank definitions
+#define PATTERN_CT 8 // patterns kept in SRAM, selected with shift + keys 0-7
+#define PATTERN_PAGE_STEPS 16 // steps per storage page, the same as one page on the LED backpack
+#define PATTERN_PAGES (MAX_SEQUENCER_LENGTH / PATTERN_PAGE_STEPS)
+#define PATTERN_POOL_PAGES 18 // storage pages shared by all patterns, as many as the EEPROM can save next to the settings, see store.ino
+#define PATTERN_PAGE_EMPTY 0 // page table entry of a page without any notes, stored pages are numbered from 1
+#define PATTERN_NONE 0xFF // no pattern cued
+
+// parameter lock definitions
+#define LOCK_MAX 16 // parameter locks shared by all patterns, see locks.ino
+#define LOCK_NONE 0xFF // no lock, as a lock table index
+#define LOCK_WHERE_NONE 0xFFFF // where of an unused lock, sorts after every step of every pattern
+#define LOCK_VELOCITY 0
+#define LOCK_NOTE 1
+#define LOCK_PROBABILITY 2
+#define LOCK_CC 3 // sent on LOCK_CC_NUMBER right before the note
+#define LOCK_PARAMS 4
+#define LOCK_CC_NUMBER 74 // the controller CC locks are sent on, on the key's channel
+#define LOCK_CC_DEFAULT 64 // value a new CC lock starts at
+
+// per-key track definitions
+#define TRACK_RATE_DEFAULT CLOCK_PPQN // clock engine ticks per step of a key, CLOCK_PPQN == in step with the sequencer
+#define TRACK_BAR_BEATS 4 // tracks are resynced on bar boundaries, a bar being this many beats
+
+// swing and micro-timing definitions
+#define SWING_STRAIGHT 50 // percent of a pair of steps the second step of the pair starts at, 50 == no swing
+#define SWING_MAX 75
+#define TIMING_OFFSET_MAX 50 // per-key timing offset either way, in percent of one of the key's steps
+
+// background ADC scan of the potentiometers, see adc.ino
+#define ADC_POT_CT 4
+#define ADC_OVERSAMPLE_SHIFT 3 // 8 samples of every pot go into each value that is published
+#define ADC_POT_HYSTERESIS 5 // ADC counts a pot has to move from where it was last taken to count as turned, less than a 7-bit step of 8 so every value can be reached
+
+// quadrature decoding of the encoders in the pin change interrupts, see encoders.ino
+#define ENCODER_CT 3
+#define ENCODER_EDGES 4 // Gray code transitions per detent
+#define ENCODER_ACCEL_MS 64 // a detent this long or longer after the one before it counts once, quicker ones count ENCODER_ACCEL_MS / gap times
+#define ENCODER_ACCEL_MAX 16 // reached at 4ms per detent, a flick of two dozen detents then crosses the sequencer length range
+
+// ports of the Nano's pins as seen by fast_pin
+#define FAST_PIN_PORT_D 0 // digital pins 0-7
+#define FAST_PIN_PORT_B 1 // digital pins 8-13
+#define FAST_PIN_PORT_C 2 // A0-A5
+
+// conditional trigs, a key's sequenced notes only play on the passes through the pattern (or its own track) its condition allows
+#define TRIG_ALWAYS 0
+#define TRIG_FILL 1 // only while fill is on
+#define TRIG_NOT_FILL 2 // only while fill is off
+#define TRIG_FIRST 3 // only on the first pass after the sequencer starts
+#define TRIG_EVERY_2 4 // the first pass and every 2nd one after it
+#define TRIG_EVERY_4 5 // the first pass and every 4th one after it
+#define TRIG_EVERY_8 6 // the first pass and every 8th one after it
+#define TRIG_CONDITIONS 7
+#define TRIG_PASS_WRAP 8 // pass counters go from 255 back to this rather than 0, which keeps every Nth in step and the first pass the only pass 0
+
+// uncomment to seed the probability generator with a fixed value instead of noise from a floating analog pin, the sequencer then
+// reseeds on every start so the same notes are left out each time a show is played
+//#define PROBABILITY_SEED 0xACE1
+#define PROBABILITY_SEED_PIN A7 // not connected on the ARDSEQUINO board
+#define PROBABILITY_ALWAYS 0xFF // threshold of 100%, every other threshold n plays when an 8-bit random number is below n
+#define SCHEDULE_QUEUE_LEN (2 * MAX_POLYPHONY) // note-ons waiting for their time, the late notes of one step and all of the next
+#define SCHEDULE_RETRY_COUNTS 80 // Timer1 counts, about one MIDI byte, before a note-on that found the MIDI queue full is tried again
+
+// EEPROM persistence definitions
+#define STORE_VERSION 8 // bump whenever the layout of the settings records changes, saves of an older layout are then ignored
+#define STORE_PAYLOAD 32
+#define STORE_SLOT_SIZE (STORE_PAYLOAD + 5) // tag, 16-bit generation, payload, CRC-16
+#define STORE_SLOTS ((E2END + 1) / STORE_SLOT_SIZE) // 27 on the ATmega328P, has to stay at or below 32
+#define STORE_TAG_SETTINGS 0x18 // 0x18-0x1D, page tags never go past page 23 so these can't clash
+#define STORE_SETTINGS_RECORDS 6 // key parameters, pattern lengths and global settings take 128 bytes, the parameter locks the rest
+#define STORE_LOCKS_AT 128 // settings byte the parameter locks start at
+#define STORE_KEY_BYTES 7 // settings bytes per key, the same packing as sound_properties_t
+#define STORE_TAG_COMMIT 0x1F
+#define STORE_DELAY_MS 4000 // changes are saved this long after they were first noticed
+#define STORE_CHECK_MS 500 // how often the settings are checked for changes
+#define STORE_GEN_REFRESH 0x4000 // saves after which a record that hasn't changed is written again, see store.ino
+#define STORE_IDLE 0
+#define STORE_NEXT 1 // about to pick the next record of the save
+#define STORE_WRITING 2
+#define SX1509_RECORD_PIN 14
+#define SX1509_PLAY_PIN 15
+
+// I2C definitions
+#define TWI_FREQ 400000L // both the SX1509 and the HT16K33 are fast-mode parts, drop this to 100000L if the bus is long or weakly pulled up
+#define TWI_QUEUE_LEN 4 // transactions per priority level, must be a power of two
+#define TWI_PRIO_INPUT 0 // input transactions are always started before display transactions
+#define TWI_PRIO_DISPLAY 1
+#define TWI_PRIO_CT 2
+#define TWI_OK 0
+#define TWI_ERR_NACK 1
+#define TWI_ERR_BUS 2
+#define TWI_PENDING 0xFF
+
+// SX1509 registers, the B bank (pins 8-15) comes first so word accesses read/write B then A
+#define SX1509_REG_PULL_UP_B 0x06
+#define SX1509_REG_DIR_B 0x0E
+#define SX1509_REG_DATA_B 0x10
+#define SX1509_REG_INT_MASK_B 0x12
+#define SX1509_REG_INT_MASK_A 0x13
+#define SX1509_REG_SENSE_HIGH_B 0x14
+#define SX1509_REG_SENSE_HIGH_A 0x16
+#define SX1509_REG_INT_SRC_B 0x18
+#define SX1509_REG_RESET 0x7D
+
+// HT16K33 commands
+#define HT16K33_OSC_ON 0x21
+#define HT16K33_DISPLAY_ON 0x81 // display on, blinking off
+#define HT16K33_BRIGHTNESS_MAX 0xEF
+
+#define DISPLAY_FRAME_MS 20 // minimum time between two LED backpack flushes, caps the display at 50 frames per second
+
+// Timer1 clock engine definitions
+#define CLOCK_PPQN 24 // MIDI clock pulses per quarter note
+#define CLOCK_TIMER_HZ (F_CPU / 64) // Timer1 runs off the /64 prescaler, 4us per count on a 16MHz Nano
+#define CLOCK_PERIOD_FRAC_BITS 8 // engine tick periods are kept in 24.8 fixed point timer counts
+#define CLOCK_SYNC_INTERNAL 0 // the engine runs off the BPM setting and sends MIDI clock
+#define CLOCK_SYNC_ARMED_START 1 // MIDI Start received, the engine starts from the top on the next clock pulse
+#define CLOCK_SYNC_ARMED_CONTINUE 2 // MIDI Continue received, the engine carries on from where it stopped on the next clock pulse
+#define CLOCK_SYNC_EXTERNAL 3 // the engine follows incoming MIDI clock
+#define CLOCK_SYNC_PULSE_MS 200 // longer gaps between clock pulses aren't a tempo, keeps intervals within a Timer1 wrap (262 ms)
+#define CLOCK_SYNC_HOLDOVER 24 // pulses the engine keeps going at the last tempo when the clock drops out
+#define CLOCK_SYNC_LOST_MS 2000 // the sequencer stops once the clock has been gone this long
+#define CLOCK_SYNC_ACQUIRE 48 // pulses after a start that run at the faster acquisition loop gains
+#define CLOCK_PLL_PHASE_ACQUIRE 2 // phase error correction per pulse, as a right shift, while acquiring
+#define CLOCK_PLL_PHASE_LOCKED 3 // and once locked
+#define CLOCK_PLL_FREQ_ACQUIRE 4 // tempo correction per pulse, as a right shift of the phase error, while acquiring
+#define CLOCK_PLL_FREQ_LOCKED 6 // and once locked, low enough to average out USB-MIDI jitter
+
+// MIDI output definitions
+#define MIDI_BAUD 31250
+#define MIDI_RT_QUEUE_LEN 8 // real-time bytes waiting for the UART, must be a power of two
+#define MIDI_OUT_QUEUE_LEN 64 // channel message bytes waiting for the UART, must be a power of two, a full step of note-offs and note-ons fits
+#define MIDI_NOTE_OFF 0x80
+#define MIDI_NOTE_ON 0x90
+#define MIDI_CONTROL_CHANGE 0xB0
+#define MIDI_PROGRAM_CHANGE 0xC0
+#define MIDI_CLOCK 0xF8
+#define MIDI_START 0xFA
+#define MIDI_CONTINUE 0xFB
+#define MIDI_STOP 0xFC
+
+// MIDI input definitions
+#define MIDI_IN_QUEUE_LEN 64 // received bytes waiting for loop(), must be a power of two, 20ms of a full input stream
+#define MIDI_SYSEX_START 0xF0
+#define MIDI_SYSEX_END 0xF7
+
+// SysEx dump/restore definitions, see sysex.ino for the message layout
+#define SYSEX_MANUFACTURER 0x7D // manufacturer ID set aside for non-commercial use
+#define SYSEX_DEVICE 0x41
+#define SYSEX_CMD_DUMP_REQUEST 0x01
+#define SYSEX_CMD_CHUNK 0x02
+#define SYSEX_CMD_ACK 0x03
+#define SYSEX_CMD_END 0x04
+#define SYSEX_ACK_OK 0x00
+#define SYSEX_ACK_CHECKSUM 0x01
+#define SYSEX_ACK_SEQUENCE 0x02
+#define SYSEX_ACK_FULL 0x03 // the pattern pool ran out of pages
+#define SYSEX_ACK_SECTION 0x04
+#define SYSEX_SECTION_SETTINGS 0 // sections 1 to PATTERN_CT are the patterns
+#define SYSEX_SECTION_PROFILE 0x10 // loop profiler statistics, dump only and only with LOOP_PROFILE defined
+#define SYSEX_SETTINGS_BYTES 192 // the settings records rounded up to whole chunks, the bytes past them read as 0
+#define SYSEX_PATTERN_BYTES (MAX_SEQUENCER_LENGTH * 2)
+#define SYSEX_PROFILE_BYTES 168 // the profiler statistics rounded up to whole chunks
+#define SYSEX_CHUNK_BYTES 24 // data bytes per chunk, both section sizes are a multiple of this
+#define SYSEX_CHUNK_ENCODED 28 // the 24 bytes packed into 7-bit groups, a byte of high bits followed by up to 7 data bytes
+#define SYSEX_CHUNK_LEN (6 + SYSEX_CHUNK_ENCODED + 1) // manufacturer, device, command, section, index, data, checksum
+#define SYSEX_ACK_TIMEOUT_MS 250
+#define SYSEX_RETRIES 4
+#define SYSEX_RX_TIMEOUT_MS 3000 // a restore without a chunk for this long is given up on, the host tool gives up after 2.5 s
+
+// uncomment to send note-offs as zero velocity note-ons, lets a whole step go out under a single running status byte
+#define MIDI_NOTE_OFF_AS_NOTE_ON
+
+// comment out to stop channel messages received over MIDI being merged into the MIDI output, see midi_in.ino
+#define MIDI_SOFT_THRU
+
+// cooperative task scheduler definitions, see tasks.ino
+#define TASK_PRIO_STEP 0 // MIDI and the sequencer step, run before anything else and again between every other task
+#define TASK_PRIO_INPUT 1 // keys, encoders and pots, earliest deadline first
+#define TASK_PRIO_IDLE 2 // display, animation and background work, earliest deadline first within TASK_IDLE_BUDGET_US
+#define TASK_IDLE_BUDGET_US 1000 // time into a pass after which only idle tasks that are past their deadline still run
+
+// uncomment to time the loop() handlers against Timer1 and make the statistics available as a SysEx dump, see profile.ino
+//#define LOOP_PROFILE
+
+// loop profiler slots, one set of statistics each
+#define PROFILE_LOOP 0 // a whole loop() pass, from one pass to the next
+#define PROFILE_SEQUENCER 1 // sequencer_step()
+#define PROFILE_POTS 2 // analog_potentiometer_handler()
+#define PROFILE_KEYS 3 // sx1509_input_handler()
+#define PROFILE_ENCODERS 4 // the encoder knob and switch handlers
+#define PROFILE_DISPLAY 5 // display_flush()
+#define PROFILE_STEP_LATE 6 // how long after becoming due a sequencer step was picked up by loop()
+#define PROFILE_SLOTS 7
+#define PROFILE_BUCKETS 8 // histogram buckets, bucket 0 is under 4 Timer1 counts (16us) and every further bucket twice as wide, the last one is 1ms and up
+#define PROFILE_BUCKET_SHIFT 2
+#define PROFILE_NONE 0xFF // tasks that aren't timed
+
+#ifdef LOOP_PROFILE
+#define PROFILE(slot, call) do { uint16_t profile_start = profile_now(); call; profile_record(slot, profile_now() - profile_start); } while (0)
+#else
+#define PROFILE(slot, call) call
+#endif // LOOP_PROFILE
+
 template <typename T> void PROGMEM_readAnything (const T * sce, T& dest)
 {
   memcpy_P (&dest, sce, sizeof (T));
@@ -69,6 +278,9 @@ extern const uint8_t NANO_pot_1 = A1;
 extern const uint8_t NANO_pot_2 = A2;
 extern const uint8_t NANO_pot_3 = A3;
 
+// ADC channels of the potentiometers, in the order of anlg_pot[]
+extern const PROGMEM uint8_t adc_pot_channels[] = {NANO_pot_0 - A0, NANO_pot_1 - A0, NANO_pot_2 - A0, NANO_pot_3 - A0};
+
 // of the 17 key switches, one is connected directly to the Nano while the rest are routed through the SX1509 GPIO expander
 extern const uint8_t NANO_sw0_pin = 12;
 
@@ -90,18 +302,52 @@ extern const uint8_t SX1509_int_pin = 2;
 extern const uint8_t SX1509_ADDR = 0x3E;
 extern const uint8_t HT16K33_ADDR = 0x70;
 
-// Begin volatile declarations for vars accessed by interrupts
+// Compile-time GPIO. All of the pins above are constants, so the port and bit of a pin are worked out by the compiler and
+// an access is a single sbis/sbic/sbi/cbi instruction, rather than the pin to port table lookups digitalRead() and
+// digitalWrite() go through on every call. The host simulation models pins at the Arduino call level, so off the AVR
+// the same calls fall back to digitalRead(), digitalWrite() and pinMode().
+template <uint8_t pin> struct fast_pin {
+    static_assert(pin < 20, "fast_pin covers digital pins 0-13 and A0-A5");
+    static constexpr uint8_t port = (pin < 8) ? FAST_PIN_PORT_D : ((pin < 14) ? FAST_PIN_PORT_B : FAST_PIN_PORT_C);
+    static constexpr uint8_t bit = (pin < 8) ? pin : ((pin < 14) ? (pin - 8) : (pin - 14));
+    static constexpr uint8_t mask = 1 << bit;
+
+    // level of the pin in a snapshot of its port's PINx register, for ISRs that read a whole port at once
+    static bool read(uint8_t snapshot) { return snapshot & mask; }
+#ifdef __AVR__
+    static volatile uint8_t &in() { return (port == FAST_PIN_PORT_D) ? PIND : ((port == FAST_PIN_PORT_B) ? PINB : PINC); }
+    static volatile uint8_t &out() { return (port == FAST_PIN_PORT_D) ? PORTD : ((port == FAST_PIN_PORT_B) ? PORTB : PORTC); }
+    static volatile uint8_t &dir() { return (port == FAST_PIN_PORT_D) ? DDRD : ((port == FAST_PIN_PORT_B) ? DDRB : DDRC); }
+    static bool read() { return in() & mask; }
+    static void write(bool level)
+    {
+        if (level) {
+            out() |= mask;
+        } else {
+            out() &= ~mask;
+        }
+    }
+    static void mode(uint8_t mode)
+    {
+        if (mode == OUTPUT) {
+            dir() |= mask;
+        } else {
+            dir() &= ~mask;
+            write(mode == INPUT_PULLUP);
+        }
+    }
+#else
+    static bool read() { return digitalRead(pin); }
+    static void write(bool level) { digitalWrite(pin, level); }
+    static void mode(uint8_t mode) { pinMode(pin, mode); }
+#endif
+};
 
-// encoder state vars
-extern volatile bool prev_enc0_ch0_state;
-extern volatile bool prev_enc0_ch1_state;
-extern volatile bool prev_enc1_ch0_state;
-extern volatile bool prev_enc1_ch1_state;
-extern volatile bool prev_enc2_ch0_state;
-extern volatile bool prev_enc2_ch1_state;
+// Begin volatile declarations for vars accessed by interrupts
 
 // interrupt flags
 extern volatile bool sx1509_int_flag;
+extern volatile uint32_t sx1509_int_tick;
 extern volatile bool sw0_flag;
 extern volatile bool enc0_knob_flag;
 extern volatile bool enc0_sw_flag;
@@ -110,29 +356,282 @@ extern volatile bool enc1_sw_flag;
 extern volatile bool enc2_knob_flag;
 extern volatile bool enc2_sw_flag;
 
-// Each of the 14 keys/buttons will own unique sets of these properties
+// Timer1 clock engine state, shared between the compare match interrupt and the main loop
+typedef struct clock_engine {
+    uint32_t period = 0; // timer counts per engine tick, 24.8 fixed point
+    uint32_t tempo_period = 0; // period for the BPM setting, used whenever the engine isn't following MIDI clock
+    uint32_t ramp_period = 0; // period while a tempo ramp is in progress, Q16.16 timer counts
+    int32_t ramp_step = 0; // change of ramp_period per engine tick
+    uint16_t ramp_ticks = 0; // engine ticks left until the ramp reaches tempo_period, 0 == no ramp
+    uint8_t phase = 0; // fractional timer count carried over between engine ticks
+    uint8_t ticks_per_clock = 1; // engine ticks per MIDI clock pulse, the engine runs at CLOCK_PPQN * notes per beat
+    uint8_t clock_div = 0; // engine ticks since the last MIDI clock pulse
+    uint8_t step_div = 0; // engine ticks since the last sequencer step
+    uint8_t pending_steps = 0; // steps that are due but have not been handled by loop() yet
+    uint32_t ticks = 0; // engine ticks since the sequencer was started
+    uint32_t step_tick = 0; // value of ticks when the last sequencer step became due
+    uint16_t tick_time = 0; // Timer1 count the last engine tick was scheduled for, notes in between ticks are timed from here
+#ifdef LOOP_PROFILE
+    uint16_t step_time = 0; // Timer1 count the last sequencer step became due at
+#endif // LOOP_PROFILE
+    bool running = false;
+    uint8_t sync = CLOCK_SYNC_INTERNAL; // where the tempo comes from, one of CLOCK_SYNC_*
+    uint8_t transport = 0; // MIDI Start/Continue/Stop received and not yet handled by loop(), 0 == none
+    uint16_t pulse_time = 0; // Timer1 count when the last MIDI clock pulse was received
+    uint32_t pulse_ms = 0; // millis() when the last MIDI clock pulse was received
+    uint32_t pulse_period = 0; // smoothed interval between MIDI clock pulses while stopped, 24.8 fixed point timer counts, 0 == unknown
+    uint32_t pulses = 0; // MIDI clock pulses since the engine was started by an external clock
+    uint8_t acquire = 0; // pulses left at the acquisition loop gains
+} clock_engine_t;
+
+extern volatile clock_engine_t seq_clock;
+
+// A single I2C transaction, an optional write phase followed by an optional read phase after a repeated start
+typedef struct twi_transaction {
+    uint8_t addr = 0; // 7-bit device address
+    const uint8_t* tx = NULL; // bytes to write, usually a register address followed by data
+    uint8_t tx_len = 0;
+    uint8_t* rx = NULL; // buffer for the bytes read back
+    uint8_t rx_len = 0;
+    void (*done)(uint8_t status) = NULL; // called from the TWI interrupt once the transaction has finished
+} twi_transaction_t;
+
+// ring of transactions waiting for the bus, one per priority level
+typedef struct twi_queue {
+    twi_transaction_t slot[TWI_QUEUE_LEN];
+    uint8_t head = 0;
+    uint8_t count = 0;
+} twi_queue_t;
+
+// A pattern only stores the 16 step pages that have notes in them, the page table maps each page to a page of the
+// shared pool. Empty pages cost a single byte, so short and sparse patterns leave room for the others
+typedef struct pattern {
+    uint16_t length = 8; // 1-384
+    uint8_t page[PATTERN_PAGES] = {0}; // pool page + 1 for each page of steps, PATTERN_PAGE_EMPTY == no notes
+} pattern_t;
+
+typedef struct pattern_bank {
+    pattern_t pattern[PATTERN_CT];
+    uint16_t pool[PATTERN_POOL_PAGES][PATTERN_PAGE_STEPS] = {{0}}; // one bit per key for every step
+    uint32_t pool_used = 0; // bit n set == pool page n is in use
+    uint32_t page_dirty[PATTERN_CT] = {0}; // bit n set == page n of the pattern changed since it was last saved
+    uint8_t active = 0; // pattern being played and edited
+    uint8_t cued = PATTERN_NONE; // pattern that takes over from the active one at the next wrap of the sequence
+    uint8_t wrap = PATTERN_NONE; // cued pattern whose first step has been scheduled, it becomes the active one on that step
+    uint32_t wrap_tick = 0; // clock engine tick of that step
+} pattern_bank_t;
+
+extern pattern_bank_t pattern_bank;
+
+// A parameter lock replaces one of a key's settings on one step of a pattern. Only the locks that have been set take up
+// an entry, the table is kept sorted on where and then param, and the unused entries after them hold LOCK_WHERE_NONE
+typedef struct param_lock {
+    uint16_t where = LOCK_WHERE_NONE; // (pattern * MAX_SEQUENCER_LENGTH + step) * 16 + key, see locks_where()
+    uint8_t param = 0; // one of LOCK_*
+    uint8_t value = 0; // 0-127, 1-100 for a probability
+} param_lock_t;
+
+typedef struct lock_table {
+    param_lock_t lock[LOCK_MAX];
+    uint8_t count = 0; // locks in use
+    uint16_t held = LOCK_WHERE_NONE; // the key and step the encoders edit the locks of, while the key is held in DETAILED_PARAM_MODE
+} lock_table_t;
+
+extern lock_table_t locks;
+
+// EEPROM save state. Every slot holds one record, a save writes new records into free slots and finishes with a
+// commit record, so the previous save stays intact until the new one is complete
+typedef struct store {
+    uint32_t valid = 0; // bit n set == slot n holds a record with a good CRC
+    uint32_t live = 0; // slots that belong to the last committed save or to the save in progress
+    uint32_t occupied[PATTERN_CT] = {0}; // pages that have notes as of the last commit plus the ones written since
+    uint16_t settings_crc[STORE_SETTINGS_RECORDS] = {0}; // CRC of each settings record as it was last saved
+    uint16_t gen = 0; // generation of the save in progress
+    uint16_t next_gen = 1;
+    uint8_t state = STORE_IDLE;
+    uint8_t cursor = 0; // next settings record or page the save in progress looks at
+    uint8_t slot = 0; // slot being written
+    uint8_t pos = 0; // next byte of rec to write
+    uint8_t last_slot = STORE_SLOTS - 1; // free slots are taken round robin from here, spreading the wear over the whole EEPROM
+    uint8_t rec[STORE_SLOT_SIZE]; // record being written
+    bool written = false; // a record has been written since the last commit
+    bool dirty = false;
+    uint16_t dirty_since = 0; // low 16 bits of millis(), see ms_since()
+    uint16_t last_check = 0;
+} store_t;
+
+// Notes that are currently sounding, so note-offs are only ever sent for notes that are actually on.
+// The note and channel are kept per key, a note-off still reaches the right note after the key has been re-assigned
+typedef struct active_note {
+    uint8_t note = 0;
+    uint8_t chan = 0;
+    uint16_t gate_off = 0; // low 16 bits of the clock engine tick a gated note ends at, gates are far shorter than 65536 ticks
+} active_note_t;
+
+typedef struct note_tracker {
+    active_note_t key[MAX_POLYPHONY];
+    uint16_t sounding = 0; // bit n set == key n has a note on
+    uint16_t gated = 0; // sounding keys that are released at their gate_off
+} note_tracker_t;
+
+// A sequenced note-on waiting for its time. Times are kept to 1/256th of a clock engine tick in 16 bits, notes are
+// never scheduled more than a couple of steps ahead so the times can't be mistaken for each other
+typedef struct schedule_event {
+    uint16_t due = 0; // low 16 bits of clock engine tick * 256 + 1/256ths of a tick
+    uint8_t key = 0;
+    uint8_t lock = LOCK_NONE; // the first parameter lock of the key on its step, kept pointing at it as the lock table changes
+} schedule_event_t;
+
+typedef struct schedule_queue {
+    schedule_event_t event[SCHEDULE_QUEUE_LEN]; // latest first, so the next note to go out is always the last one
+    uint8_t count = 0;
+    uint8_t swing_phase = 0; // engine ticks the swing pairs are shifted by, so even sequencer steps start a pair
+    bool ahead = false; // the notes of the step after the current sequencer step have been scheduled
+    uint8_t pass = 0; // passes through the pattern since the sequencer started, as of the last step scheduled
+    uint8_t lock = 0; // lock table cursor of the sequencer's steps, see locks_seek()
+} schedule_queue_t;
+
+extern schedule_queue_t sched;
+
+// Keys with their own length or rate step through their own track, the next step of each is kept in a deadline queue
+typedef struct track {
+    uint16_t pos = 0; // step of the pattern the key played last
+    uint32_t due = 0; // clock engine tick of the key's next step
+    uint8_t pass = 0; // passes through the track since the sequencer started
+    uint8_t lock = 0; // lock table cursor of the track, see locks_seek()
+} track_t;
+
+typedef struct track_queue {
+    track_t track[MAX_POLYPHONY];
+    uint8_t heap[MAX_POLYPHONY]; // keys with a track of their own, a binary min-heap on due
+    uint8_t count = 0;
+    uint16_t queued = 0; // bit n set == key n is in the heap, the other keys play along with the sequencer's own step
+    uint16_t resync = 0; // bit n set == key n goes back to its first step at resync_tick
+    uint32_t resync_tick = 0; // the bar boundary pending resyncs happen on
+    uint16_t fresh = 0; // bit n set == key n hasn't taken a step since the sequencer started, its first step doesn't start a new pass
+} track_queue_t;
+
+extern track_queue_t tracks;
+
+// MIDI output queues, real-time bytes always go out ahead of channel message bytes
+typedef struct midi_out_queue {
+    uint8_t rt[MIDI_RT_QUEUE_LEN];
+    uint8_t rt_head = 0;
+    uint8_t rt_count = 0;
+    uint8_t buf[MIDI_OUT_QUEUE_LEN]; // channel messages with running status already applied
+    uint8_t head = 0;
+    uint8_t count = 0;
+    uint8_t running_status = 0; // last status byte queued, 0 == none yet
+} midi_out_queue_t;
+
+// received MIDI bytes waiting for loop()
+typedef struct midi_in_queue {
+    uint8_t buf[MIDI_IN_QUEUE_LEN];
+    uint8_t head = 0;
+    uint8_t count = 0;
+    bool in_sysex = false; // between a SysEx start and end byte
+    uint8_t status = 0; // running status of the channel messages being received, 0 == none
+    uint8_t data[2]; // data bytes of the channel message being received
+    uint8_t len = 0; // data bytes received so far
+} midi_in_queue_t;
+
+// SysEx transfer state, chunks are encoded from and decoded into the live data, only a single chunk is ever buffered.
+// A restore of the active pattern while the sequencer plays is staged in pool pages until the end message
+typedef struct sysex {
+    uint8_t rx_pos = 0xFF; // bytes of the incoming message so far, 0xFF == not one of ours
+    uint8_t rx_cmd = 0;
+    uint8_t rx_section = 0;
+    uint16_t rx_index = 0;
+    uint8_t rx_status = 0;
+    uint8_t rx_msbs = 0; // high bits of the current 7-bit group
+    uint8_t rx_checksum = 0;
+    uint8_t rx_chunk[SYSEX_CHUNK_BYTES];
+    uint16_t rx_next = 0; // chunk a restore expects next
+    uint8_t rx_restore = 0; // section of the restore in progress, while rx_next > 0
+    uint16_t rx_last = 0; // low 16 bits of millis() when its last chunk came in
+    uint8_t rx_active = 0; // active pattern of a settings restore, switched to at the end message
+    bool rx_staging = false; // the restore in progress goes into rx_page rather than the live data
+    uint8_t rx_page[PATTERN_PAGES] = {0}; // pool page + 1 for each page of the staged section, PATTERN_PAGE_EMPTY == all zero
+    uint8_t rx_swap = PATTERN_NONE; // pattern whose staged restore takes over at the next wrap
+    uint8_t tx_section = 0;
+    uint16_t tx_index = 0; // chunk of the dump in progress
+    bool tx_active = false;
+    bool tx_waiting = false; // a chunk has been sent and not acknowledged yet
+    uint8_t tx_retries = 0;
+    uint16_t tx_sent = 0; // low 16 bits of millis()
+} sysex_t;
+
+// A task of the loop() scheduler, the table lives in flash and only the time each task's work turned up is kept in SRAM
+typedef struct task {
+    bool (*pending)(); // true == the task has work to do
+    void (*run)();
+    uint8_t prio; // TASK_PRIO_*
+    uint8_t deadline; // ms the work may wait once it has turned up, or once the task last ran if it is always pending
+    uint8_t slot; // PROFILE_* slot the task is timed in, PROFILE_NONE == not timed
+} task_t;
+
+// Loop profiler statistics of one slot, times in Timer1 counts (4us). The counters stop at 0xFFFF rather than wrap
+typedef struct profile_stat {
+    uint16_t count = 0;
+    uint16_t min = 0xFFFF;
+    uint16_t max = 0;
+    uint16_t hist[PROFILE_BUCKETS] = {0};
+} profile_stat_t;
+
+// ADC scan state, the conversion complete interrupt takes one sample of each pot in turn and publishes the averages
+typedef struct adc_scan {
+    uint16_t sum[ADC_POT_CT] = {0}; // samples of the round in progress
+    uint8_t channel = 0; // pot being converted
+    uint8_t round = 0; // samples of every pot in the sums so far
+    uint16_t value[ADC_POT_CT] = {0}; // averages of the last complete round, 0-1023
+    bool ready = false; // the first round has been published
+    bool fresh = false; // a round has been published since the pots were last looked at
+} adc_scan_t;
+
+// Quadrature decoder state of an encoder, kept up to date by the pin change interrupts
+typedef struct encoder {
+    uint8_t ab = 3; // channel levels of the last two samples, ch0 << 1 | ch1 each, the older one in the upper bits
+    int8_t edges = 0; // Gray code transitions into the detent in progress, + clockwise
+    int8_t dir = 0; // direction of the last detent, acceleration starts over when it changes
+    uint16_t last_detent = 0; // millis() of the last detent
+    int8_t detents = 0; // whole detents since loop() last took them, + clockwise
+    int16_t steps = 0; // the same detents scaled up by how quickly they came
+} encoder_t;
+
+// transition table of the Gray code state machine, indexed by encoder_t.ab
+extern const PROGMEM int8_t enc_states[] = {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0};
+
+// SX1509 pin levels as of the last completed scan
+extern uint16_t sx1509_pin_state;
+
+// Each of the 14 keys/buttons will own unique sets of these properties, packed into 7 bytes with the flags sharing
+// bytes with the 7-bit values. Bit-fields can't have default member initializers before C++20, so the packed fields
+// get their defaults from the constructor
 typedef struct sound_properties {
-    uint8_t midi_note = 0; // 0-127
-    uint8_t volume = 127; // 0-127
-    uint8_t midi_chan = DEFAULT_MIDI_CHANNEL; // 1-16
-    uint8_t probability = 100; // 0-100
-    bool note_off = false; // true == note-off is enabled
-    bool state = false; // true == button is actively pressed
-    uint8_t led_pos[2] = {0, 0}; // {x, y} mapping of button to LED backpack
+    uint8_t midi_note : 7; // 0-127
+    uint8_t note_off : 1; // 1 == note-off is enabled
+    uint8_t volume : 7; // 0-127
+    uint8_t state : 1; // 1 == button is actively pressed
+    uint8_t probability : 7; // 0-100
+    uint8_t midi_chan : 5; // 1-16
+    uint8_t trig : 3; // condition for the key's sequenced notes, one of TRIG_*
+    uint8_t length = 0; // steps this key loops over on its own, 0 == the pattern length
+    uint8_t rate = TRACK_RATE_DEFAULT; // clock engine ticks per step of this key
+    int8_t offset = 0; // timing offset, -50 to 50 percent of a step of this key, negative == early
+
+    sound_properties() : midi_note(0), note_off(0), volume(127), state(0), probability(100), midi_chan(DEFAULT_MIDI_CHANNEL), trig(TRIG_ALWAYS) {}
 } sound_properties_t;
 
 typedef struct sx1509_pins {
-    unsigned long debounce = 0;
+    uint16_t debounce = 0; // low 16 bits of millis() when the pin last changed, only ever compared over the debounce time
 } sx1509_pins_t;
 
 typedef struct analog_potentiometers {
-    int pinNum;
-    int state;
-    uint8_t* bitmap;
+    int16_t state; // 0-1023, the level the pot was last handled at
 } analog_potentiometers_t;
 
 typedef struct global_sequencer_menu {
-    uint8_t bpm = 45; // 0-255
+    uint16_t tempo = 900; // 450-3000, in tenths of a BPM
     uint16_t step = 0; // 0-479
     uint8_t row = 0; // 0-29
     bool direction = true;
@@ -145,13 +644,49 @@ typedef struct global_sequencer_menu {
     uint8_t attack = 0; // 0-127
     uint8_t release = 0; // 0-127
     uint8_t PCNum = 0; // 0-31
+    uint8_t gate = MAX_GATE; // 1-100, percentage of a step that sequenced notes are held for by keys with note-off enabled
+    uint8_t swing = SWING_STRAIGHT; // 50-75, percentage of a pair of steps the second step starts at
+    uint8_t ramp = 0; // bars a tempo change glides over while the sequencer plays, 0 == straight away
+    uint8_t rec_grid = 1; // steps recorded notes snap to, 1 == the nearest step
+    uint32_t step_due = 0; // clock engine tick the current step became due on
+    bool fill = false; // true == keys with a fill condition play, keys with a not fill condition don't
     bool record = false;
     bool paused = true;
-    unsigned long record_last_blink = 0;
+    uint16_t record_last_blink = 0; // low 16 bits of millis()
     bool record_blink_flag = false;
     uint8_t last_key = 0;
 } global_sequencer_menu_t;
 
+// per-key track rates on offer, in clock engine ticks per step, from 4 times the sequencer speed down to a quarter of it
+extern const PROGMEM uint8_t track_rates[] = {6, 8, 12, 16, 18, 24, 32, 36, 48, 72, 96};
+
+// 8-bit probability thresholds for 0-100%, round(p * 256 / 100), and PROBABILITY_ALWAYS for 100%
+extern const PROGMEM uint8_t probability_thresholds[] = {
+    0, 3, 5, 8, 10, 13, 15, 18, 20, 23, 26, 28, 31, 33, 36, 38,
+    41, 44, 46, 49, 51, 54, 56, 59, 61, 64, 67, 69, 72, 74, 77, 79,
+    82, 84, 87, 90, 92, 95, 97, 100, 102, 105, 108, 110, 113, 115, 118, 120,
+    123, 125, 128, 131, 133, 136, 138, 141, 143, 146, 148, 151, 154, 156, 159, 161,
+    164, 166, 169, 172, 174, 177, 179, 182, 184, 187, 189, 192, 195, 197, 200, 202,
+    205, 207, 210, 212, 215, 218, 220, 223, 225, 228, 230, 233, 236, 238, 241, 243,
+    246, 248, 251, 253, 255
+};
+
+// LED backpack position {x, y} of every key, may vary from user to user depending on how the keys are wired
+extern const PROGMEM uint8_t key_led_pos[MAX_POLYPHONY][2] = {
+    {0, 6}, {1, 6}, {2, 6}, {3, 6}, // keys 0-3 start the top row
+    {0, 7}, {1, 7}, {2, 7}, {3, 7}, {4, 7}, {5, 7}, {6, 7}, // keys 4-10 are the bottom row
+    {4, 6}, {5, 6}, {6, 6} // keys 11-13 finish the top row
+};
+
+// swing amounts the encoder 1 switch steps through, in percent of a pair of steps
+extern const PROGMEM uint8_t swing_amounts[] = {50, 54, 58, 62, 66, 71, 75};
+
+// tempo ramp lengths shift + the encoder 2 switch steps through, in bars
+extern const PROGMEM uint8_t tempo_ramp_bars[] = {0, 1, 2, 4, 8};
+
+// record grids shift + the encoder 1 switch steps through, in steps
+extern const PROGMEM uint8_t record_grids[] = {1, 2, 4, 8};
+
 // standalone bitmaps
 extern const PROGMEM uint8_t enc0_bmp[] =
     { // placeholder, not in use
@@ -295,8 +830,22 @@ extern const PROGMEM uint8_t enc0_bmp[] =
         B00000000, B00000000,
         B00000000, B00000000,
         B00000000, B00000000,
+    },
+    pool_full_bmp[] =
+    { // a recorded hit found every pattern pool page taken, leaves the bottom row alone
+        B11101010, B10001000,
+        B10001010, B10001000,
+        B11001010, B10001000,
+        B10001010, B10001000,
+        B10001110, B11101110,
+        B00000000, B00000000,
+        B00000000, B00000000,
+        B00000000, B00000000,
     };
 
+// the bitmap shown while each potentiometer is turned
+extern const uint8_t *const PROGMEM pot_rotate_bmps[ADC_POT_CT] = {pot0_rotate_bmp, pot1_rotate_bmp, pot2_rotate_bmp, pot3_rotate_bmp};
+
 // The following bitmaps are stored in an array so that they can be index-mapped
 // bitmaps for numbers in the ones place
 extern const PROGMEM uint8_t digit0[10][16] {
@@ -8,24 +8,13 @@
  * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>. 
  */
 
-#include <Wire.h> // I2C library, required for communicating with SX1509 and LED backpack
-#include <SparkFunSX1509.h> // SX1509_io expander library
-#include <Adafruit_GFX.h> // Graphics library
-#include <Adafruit_LEDBackpack.h>  // LED backpack library
-#include <MIDI.h> // MIDI library
+#include <util/twi.h> // TWI status codes, the I2C driver itself lives in twi.ino
+#include <avr/sleep.h> // idle sleep while waiting on interrupt driven I/O
+#include <util/crc16.h> // CRC of the records saved to the EEPROM
 #include "ARDSEQUINO.h" // project header file
+#include "led_matrix.h" // LED backpack framebuffer
 
-Adafruit_8x16matrix matrix = Adafruit_8x16matrix(); // initialize the LED panel
-SX1509 SX1509_io; // initialize the SX1509 io expander
-MIDI_CREATE_DEFAULT_INSTANCE(); // initialize MIDI commss
-
-// encoder state vars
-volatile bool prev_enc0_ch0_state;
-volatile bool prev_enc0_ch1_state;
-volatile bool prev_enc1_ch0_state;
-volatile bool prev_enc1_ch1_state;
-volatile bool prev_enc2_ch0_state;
-volatile bool prev_enc2_ch1_state;
+led_matrix_t matrix; // initialize the LED panel framebuffer, display.ino sends it to the backpack
 
 // interrupt flags
 volatile bool sx1509_int_flag = false;
@@ -37,19 +26,19 @@ volatile bool enc1_sw_flag = false;
 volatile bool enc2_knob_flag = false;
 volatile bool enc2_sw_flag = false;
 
+// clock engine tick of the last SX1509 interrupt, and of the one the scan in flight was requested for, key hits are recorded against these
+volatile uint32_t sx1509_int_tick = 0;
+uint32_t sx1509_scan_tick = 0;
+
 // analog potentiometer position vars
 analog_potentiometers_t anlg_pot[4];
 
-// Debounce tracking vars
-unsigned long sx1509_int_pin_last_trig = millis();
-unsigned long NANO_sw0_last_trig = millis();
-unsigned long enc0_sw_last_trig = millis();
-unsigned long enc0_knob_last_trig = millis();
-unsigned long enc1_sw_last_trig = millis();
-unsigned long enc1_knob_last_trig = millis();
-unsigned long enc2_sw_last_trig = millis();
-unsigned long enc2_knob_last_trig = millis();
-unsigned long prev_pot_time = millis();
+// Debounce tracking vars, low 16 bits of millis(), see ms_since()
+uint16_t sx1509_int_pin_last_trig = millis();
+uint16_t NANO_sw0_last_trig = millis();
+uint16_t enc0_sw_last_trig = millis();
+uint16_t enc1_sw_last_trig = millis();
+uint16_t enc2_sw_last_trig = millis();
 
 // button hold duration tracking var
 unsigned long sw0_last_pressed = millis();
@@ -63,146 +52,73 @@ sound_properties_t key_array[MAX_POLYPHONY];
 // struct for storing Sequencer parameters
 global_sequencer_menu_t global_seq;
 
-// array stores sequence itself
-uint16_t sequencer_array[MAX_SEQUENCER_LENGTH] = {0};
-
 uint16_t prev_sequencer_step_val = 0;
 
 // There are two menus, one for general sequencer control, one for key-specific parameter changes
 uint8_t menu_mode = GLOBAL_SEQUENCER_MODE;
 
-// BPM related vars
-unsigned long prev_seq_time = millis(); // tracks last sequencer step timing
-unsigned long prev_clock_tick = micros(); // tracks midi clock signal
-unsigned long ms_between_notes = 60000 / ((global_seq.bpm + 45) * global_seq.npb); // converts BPM to ms per sequencer step
-unsigned long us_between_midi_clock_sig = 60000000 / ((global_seq.bpm + 45) * 24); // calculate microseconds per quarternote for midi clock sync based on bpm
-
-// buffers for loading data stored in program memory
-uint8_t digit0_buf[16];
-uint8_t digit1_buf[16];
-uint8_t digit2_buf[16];
-uint8_t bitmap_buf[16];
-
 void setup()
 {
-    MIDI.begin(MIDI_CHANNEL_OMNI); // Determines which MIDI channel to broadcast on
-    Wire.begin(); // Enable I2C comms
-    pinMode(LED_BUILTIN, OUTPUT); // onboard LED enabled for debug
-    digitalWrite(LED_BUILTIN, LOW);
+    midi_out_init(); // MIDI output runs off the UART interrupt, see midi_out.ino
+    midi_in_init(); // MIDI input plays the keys and carries SysEx dump/restore, see sysex.ino
+    twi_init(); // Enable I2C comms
+    fast_pin<LED_BUILTIN>::mode(OUTPUT); // onboard LED enabled for debug
+    fast_pin<LED_BUILTIN>::write(LOW);
     
     // successful LED backpack init returns 1
-    if (matrix.begin(HT16K33_ADDR) == false) {
-        digitalWrite(LED_BUILTIN, HIGH); // Failing to communicate with the LED backpack will turn on the onboard LED
+    if (display_begin() == false) {
+        fast_pin<LED_BUILTIN>::write(HIGH); // Failing to communicate with the LED backpack will turn on the onboard LED
         while (1); // loop forever if we can't communicate with LED  backpack
     }
 
-    // successful SX1509 init returns 1
-    if (SX1509_io.begin(SX1509_ADDR) == false) {
-        digitalWrite(LED_BUILTIN, HIGH); // Failing to communicate with the SX1509 will turn on the onboard LED
+    // successful SX1509 init returns 1, this also sets up all 16 pins as inputs with interrupts enabled
+    if (sx1509_begin() == false) {
+        fast_pin<LED_BUILTIN>::write(HIGH); // Failing to communicate with the SX1509 will turn on the onboard LED
         while (1);
     } 
 
     // encoder init step
-    pinMode(NANO_enc0_ch0, INPUT_PULLUP);
-    pinMode(NANO_enc0_ch1, INPUT_PULLUP);
-    pinMode(NANO_enc0_sw, INPUT_PULLUP);
-    prev_enc0_ch0_state = digitalRead(NANO_enc0_ch0);
-    prev_enc0_ch1_state = digitalRead(NANO_enc0_ch1);
-
-    pinMode(NANO_enc1_ch0, INPUT_PULLUP);
-    pinMode(NANO_enc1_ch1, INPUT_PULLUP);
-    pinMode(NANO_enc1_sw, INPUT_PULLUP);
-    prev_enc1_ch0_state = digitalRead(NANO_enc1_ch0);
-    prev_enc1_ch1_state = digitalRead(NANO_enc1_ch1);
-
-    pinMode(NANO_enc2_ch0, INPUT_PULLUP);
-    pinMode(NANO_enc2_ch1, INPUT_PULLUP);
-    pinMode(NANO_enc2_sw, INPUT_PULLUP);
-    prev_enc2_ch0_state = digitalRead(NANO_enc2_ch0);
-    prev_enc2_ch1_state = digitalRead(NANO_enc2_ch1);
-
-    // one of the pins onboard the nano is used as a switch
-    pinMode(NANO_sw0_pin, INPUT_PULLUP);
-
-    // init the interrupt pin that the SX1509 relies on to report button presses
-    pinMode(SX1509_int_pin, INPUT_PULLUP);
-
-    // map the keys to their associated LED positions, may vary from user to user depending on how the keys are wired
-    key_array[0].led_pos[0] = 0; // 0xxxxxx
-    key_array[0].led_pos[1] = 6; // xxxxxxx
-
-    key_array[1].led_pos[0] = 1; // x0xxxxx
-    key_array[1].led_pos[1] = 6; // xxxxxxx
-
-    key_array[2].led_pos[0] = 2; // xx0xxxx
-    key_array[2].led_pos[1] = 6; // xxxxxxx
-
-    key_array[3].led_pos[0] = 3; // xxx0xxx
-    key_array[3].led_pos[1] = 6; // xxxxxxx
-
-    key_array[11].led_pos[0] = 4; // xxxx0xx
-    key_array[11].led_pos[1] = 6; // xxxxxxx
-
-    key_array[12].led_pos[0] = 5; // xxxxx0x
-    key_array[12].led_pos[1] = 6; // xxxxxxx
+    fast_pin<NANO_enc0_ch0>::mode(INPUT_PULLUP);
+    fast_pin<NANO_enc0_ch1>::mode(INPUT_PULLUP);
+    fast_pin<NANO_enc0_sw>::mode(INPUT_PULLUP);
 
-    key_array[13].led_pos[0] = 6; // xxxxxx0
-    key_array[13].led_pos[1] = 6; // xxxxxxx
+    fast_pin<NANO_enc1_ch0>::mode(INPUT_PULLUP);
+    fast_pin<NANO_enc1_ch1>::mode(INPUT_PULLUP);
+    fast_pin<NANO_enc1_sw>::mode(INPUT_PULLUP);
 
-    key_array[4].led_pos[0] = 0; // xxxxxxx
-    key_array[4].led_pos[1] = 7; // 0xxxxxx
+    fast_pin<NANO_enc2_ch0>::mode(INPUT_PULLUP);
+    fast_pin<NANO_enc2_ch1>::mode(INPUT_PULLUP);
+    fast_pin<NANO_enc2_sw>::mode(INPUT_PULLUP);
+    encoder_begin(); // the encoders are decoded in the pin change interrupts, see encoders.ino
 
-    key_array[5].led_pos[0] = 1; // xxxxxxx
-    key_array[5].led_pos[1] = 7; // x0xxxxx
-
-    key_array[6].led_pos[0] = 2; // xxxxxxx
-    key_array[6].led_pos[1] = 7; // xx0xxxx
+    // one of the pins onboard the nano is used as a switch
+    fast_pin<NANO_sw0_pin>::mode(INPUT_PULLUP);
 
-    key_array[7].led_pos[0] = 3; // xxxxxxx
-    key_array[7].led_pos[1] = 7; // xxx0xxx
+    // init the interrupt pin that the SX1509 relies on to report button presses
+    fast_pin<SX1509_int_pin>::mode(INPUT_PULLUP);
 
-    key_array[8].led_pos[0] = 4; // xxxxxxx
-    key_array[8].led_pos[1] = 7; // xxxx0xx
+    // bring back the patterns and settings of the last save, see store.ino
+    store_load();
 
-    key_array[9].led_pos[0] = 5; // xxxxxxx
-    key_array[9].led_pos[1] = 7; // xxxxx0x
+    // the sequencer steps and MIDI clock are driven by Timer1, see clock_engine.ino
+    clock_engine_init();
+    clock_engine_set_tempo(global_seq.tempo, global_seq.npb, 0);
 
-    key_array[10].led_pos[0] = 6; // xxxxxxx
-    key_array[10].led_pos[1] = 7; // xxxxxx0
+    // seed the probability generator, see probability.ino
+    probability_seed();
 
-    // init each button on the SX1509 and enable interrupts for them
-    for (uint8_t i = 0; i < SX1509_PIN_CT; i++) {
-        SX1509_io.pinMode(i, INPUT_PULLUP);
-        SX1509_io.enableInterrupt(i, CHANGE);
+    // from here on the ADC scans the potentiometers in the background, see adc.ino, the positions they start at don't count as turns
+    adc_begin();
+    for (uint8_t i = 0; i < ADC_POT_CT; i++) {
+        anlg_pot[i].state = adc_pot_value(i);
     }
 
-    // init the analog potentiometers
-    anlg_pot[0].pinNum = NANO_pot_0;
-    anlg_pot[0].state = analogRead(anlg_pot[0].pinNum);
-    anlg_pot[0].bitmap = pot0_rotate_bmp;
-    anlg_pot[1].pinNum = NANO_pot_1;
-    anlg_pot[1].state = analogRead(anlg_pot[1].pinNum);
-    anlg_pot[1].bitmap = pot1_rotate_bmp;
-    anlg_pot[2].pinNum = NANO_pot_2;
-    anlg_pot[2].state = analogRead(anlg_pot[2].pinNum);
-    anlg_pot[2].bitmap = pot2_rotate_bmp;
-    anlg_pot[3].pinNum = NANO_pot_3;
-    anlg_pot[3].state = analogRead(anlg_pot[3].pinNum);
-    anlg_pot[3].bitmap = pot3_rotate_bmp;
-
-    // set the seed for random() to the value of a floating analog pin
-    randomSeed(A7);
-
     // Run a bootup graphic on the LED backpack
-    matrix.setTextSize(1);
-    matrix.setTextWrap(false);  // text will scroll so disable wrapping
-    matrix.setTextColor(LED_ON);
     matrix.setRotation(LED_ORIENTATION);
     for (int8_t x=7; x>=-60; x--) { // max x value found thru trial & error
         matrix.clear();
-        matrix.setCursor(x,0);
-        matrix.print("ARDSEQUINO");
-        matrix.writeDisplay();
+        draw_banner(x);
+        display_flush(true);
         delay(100);
     }
 
@@ -218,65 +134,74 @@ void setup()
     matrix.drawPixel(14, 6, LED_ON);
     matrix.drawLine(10, 6, 10, 7, LED_ON);
     matrix.drawLine(8, 6, 8, 7, LED_ON);
-    matrix.writeDisplay();
+    display_flush(true);
 }
 
-// Interrupt handling for digital inputs 8-12
+// Interrupt handling for digital inputs 8-12, all read from a single snapshot of port B
 ISR (PCINT0_vect)
 {
-    if ((digitalRead(NANO_enc2_ch0) != prev_enc2_ch0_state) || (digitalRead(NANO_enc2_ch1) != prev_enc2_ch1_state)) {
+    static_assert((fast_pin<NANO_enc2_ch0>::port == FAST_PIN_PORT_B) && (fast_pin<NANO_enc2_ch1>::port == FAST_PIN_PORT_B) && (fast_pin<NANO_enc2_sw>::port == FAST_PIN_PORT_B)
+                  && (fast_pin<NANO_enc1_sw>::port == FAST_PIN_PORT_B) && (fast_pin<NANO_sw0_pin>::port == FAST_PIN_PORT_B), "PCINT0 covers port B only");
+    uint8_t pins = PINB;
+
+    if (encoder_decode(2, (fast_pin<NANO_enc2_ch0>::read(pins) << 1) | fast_pin<NANO_enc2_ch1>::read(pins))) {
         enc2_knob_flag = true;
-        prev_enc2_ch0_state = digitalRead(NANO_enc2_ch0);
-        prev_enc2_ch1_state = digitalRead(NANO_enc2_ch1);
-        enc2_knob_last_trig = millis();
     }
 
-    if (digitalRead(NANO_enc2_sw) == LOW) {
+    if (!fast_pin<NANO_enc2_sw>::read(pins)) {
         enc2_sw_flag = true;
     }
 
-    if (digitalRead(NANO_enc1_sw) == LOW) {
+    if (!fast_pin<NANO_enc1_sw>::read(pins)) {
         enc1_sw_flag = true;
     }
 
-    if (digitalRead(NANO_sw0_pin) == LOW && sw0_flag == false) {
-
+    if (!fast_pin<NANO_sw0_pin>::read(pins)) {
         sw0_flag = true;
     }
 }
 
-// Interrupt handling for digital inputs 3-7
+// Interrupt handling for digital inputs 3-7, all read from a single snapshot of port D
 ISR (PCINT2_vect)
 {
-    if ((digitalRead(NANO_enc0_ch0) != prev_enc0_ch0_state) || (digitalRead(NANO_enc0_ch1) != prev_enc0_ch1_state)) {
+    static_assert((fast_pin<NANO_enc0_ch0>::port == FAST_PIN_PORT_D) && (fast_pin<NANO_enc0_ch1>::port == FAST_PIN_PORT_D) && (fast_pin<NANO_enc0_sw>::port == FAST_PIN_PORT_D)
+                  && (fast_pin<NANO_enc1_ch0>::port == FAST_PIN_PORT_D) && (fast_pin<NANO_enc1_ch1>::port == FAST_PIN_PORT_D), "PCINT2 covers port D only");
+    uint8_t pins = PIND;
+
+    if (encoder_decode(0, (fast_pin<NANO_enc0_ch0>::read(pins) << 1) | fast_pin<NANO_enc0_ch1>::read(pins))) {
         enc0_knob_flag = true;
-        prev_enc0_ch0_state = digitalRead(NANO_enc0_ch0);
-        prev_enc0_ch1_state = digitalRead(NANO_enc0_ch1);
-        enc0_knob_last_trig = millis();
     }
 
-    if ((digitalRead(NANO_enc1_ch0) != prev_enc1_ch0_state) || (digitalRead(NANO_enc1_ch1) != prev_enc1_ch1_state)) {
+    if (encoder_decode(1, (fast_pin<NANO_enc1_ch0>::read(pins) << 1) | fast_pin<NANO_enc1_ch1>::read(pins))) {
         enc1_knob_flag = true;
-        prev_enc1_ch0_state = digitalRead(NANO_enc1_ch0);
-        prev_enc1_ch1_state = digitalRead(NANO_enc1_ch1);
-        enc1_knob_last_trig = millis();
     }
 
-    if (digitalRead(NANO_enc0_sw) == LOW) {
+    if (!fast_pin<NANO_enc0_sw>::read(pins)) {
         enc0_sw_flag = true;
     }
 }
 
 /*
  * Function: sx1509_interrupt
- * Description: called by interrupt to set a flag that is checked in the main loop
+ * Description: called by interrupt to set a flag that is checked in the main loop, and notes the engine tick the keys changed on
  */
 
 void sx1509_interrupt()
 {
+    sx1509_int_tick = seq_clock.ticks;
     sx1509_int_flag = true;
 }
 
+/*
+ * Function: ms_since
+ * Description: milliseconds gone by since a time stamp that only kept the low 16 bits of millis(), good for intervals of up to a minute
+ */
+
+uint16_t ms_since(uint16_t stamp)
+{
+    return (uint16_t) millis() - stamp;
+}
+
 /*
  * Function: draw_image
  * Description: draws any given bitmap on the LED backpack
@@ -289,7 +214,6 @@ void draw_image(const uint8_t *bitmap)
     matrix.setRotation(LED_ORIENTATION);
     matrix.clear();
     matrix.drawBitmap(0, 0, bitmap, 16, 8, LED_ON);
-    matrix.writeDisplay();  // write the changes we just made to the display
 }
 
 /*
@@ -301,15 +225,21 @@ void draw_image(const uint8_t *bitmap)
 
 void load_bitmap(uint16_t numVal)
 {
-    PROGMEM_readAnything (&digit0[numVal % 10], digit0_buf);
-    PROGMEM_readAnything (&digit1[(numVal / 10) % 10], digit1_buf);
-    PROGMEM_readAnything (&digit2[(numVal / 100) % 10], digit2_buf);
-    for (uint8_t i = 0; i < 16; i++) {
-        bitmap_buf[i] = digit2_buf[i] | digit1_buf[i] | digit0_buf[i];
-    }
+    // the digits are drawn straight from flash one over the other, drawBitmap() only ever turns LEDs on
     matrix.fillRect(4, 0, 11, 5, LED_OFF);
-    matrix.drawBitmap(0, 0, bitmap_buf, 16, 8, LED_ON);
-    matrix.writeDisplay();
+    matrix.drawBitmap(0, 0, digit2[(numVal / 100) % 10], 16, 8, LED_ON);
+    matrix.drawBitmap(0, 0, digit1[(numVal / 10) % 10], 16, 8, LED_ON);
+    matrix.drawBitmap(0, 0, digit0[numVal % 10], 16, 8, LED_ON);
+}
+
+/*
+ * Function: draw_key_pixel
+ * Description: turns the LED of a key on or off, the positions are kept in flash in key_led_pos
+ */
+
+void draw_key_pixel(uint8_t key_num, uint16_t color)
+{
+    matrix.drawPixel(pgm_read_byte(&key_led_pos[key_num][0]), pgm_read_byte(&key_led_pos[key_num][1]), color);
 }
 
 /*
@@ -324,151 +254,167 @@ void bpm_direction()
   } else {
       matrix.drawLine(0, 2, 2, 2, LED_OFF);
   }
-  matrix.writeDisplay();
 }
 
 /*
  * Function: enc_16bit_val_calc
- * Description: Handler for dec/incrementing 16-bit values based on encoder inputs
+ * Description: Handler for dec/incrementing 16-bit values based on encoder inputs. A move past either end stops at that end,
+ *    only a single step from the end wraps around to the other end, so a fast turn doesn't carry on through the whole range again
  * Input:
- *    direction - true == clockwise, false == counter-clockwise
+ *    steps - steps to move by, + clockwise, - counter-clockwise
  *    ＊val - pointer to a param that is controlled by the encoder
  *    max_val - maximum value before wrapping around to minimum value
  *  　min_val - minimum value before wrapping around to maximum value
  */
 
-void enc_16bit_val_calc(bool direction, uint16_t* val, uint16_t max_val, uint16_t min_val)
+void enc_16bit_val_calc(int16_t steps, uint16_t* val, uint16_t max_val, uint16_t min_val)
 {
-    if (direction) {
-        if (*val < max_val) {
-            *val += 1;
-        } else {
-            *val = min_val;
-        }
-    } else {
-        if (*val > min_val) {
-            *val -= 1;
-        } else {
-           *val = max_val;
-        }
+    int32_t next = (int32_t) *val + steps;
+
+    if (next > max_val) {
+        next = ((*val == max_val) && (steps == 1)) ? min_val : max_val;
+    } else if (next < min_val) {
+        next = ((*val == min_val) && (steps == -1)) ? max_val : min_val;
     }
+    *val = next;
 }
 
 /*
  * Function: enc_8bit_val_calc
- * Description: Handler for dec/incrementing 8-bit values based on encoder inputs
+ * Description: Handler for dec/incrementing 8-bit values based on encoder inputs, see enc_16bit_val_calc()
  * Input:
- *    direction - true == clockwise, false == counter-clockwise
+ *    steps - steps to move by, + clockwise, - counter-clockwise
  *    ＊val - pointer to a param that is controlled by the encoder
  *    max_val - maximum value before wrapping around to minimum value
  *  　min_val - minimum value before wrapping around to maximum value
  */
 
-void enc_8bit_val_calc(bool direction, uint8_t* val, uint8_t max_val, uint8_t min_val)
+void enc_8bit_val_calc(int16_t steps, uint8_t* val, uint8_t max_val, uint8_t min_val)
 {
-    if (direction) {
-        if (*val < max_val) {
-            *val += 1;
-        } else {
-            *val = min_val;
-        }
-    } else {
-        if (*val > min_val) {
-            *val -= 1;
-        } else {
-           *val = max_val;
-        }
-    }
+    uint16_t wide = *val;
+
+    enc_16bit_val_calc(steps, &wide, max_val, min_val);
+    *val = wide;
 }
 
 /*
  * Function: encoder_led_mapping
- * Description: maps encoder inputs to system parameters
+ * Description: maps encoder inputs to system parameters, settings with long ranges move by the accelerated steps and the rest by detents
  * Input:
  *    enc_num - There are 4 rotary encoders, valid values 0-3
- *    direction - true == clockwise, false == counter-clockwise
+ *    detents - detents turned, + clockwise, - counter-clockwise
+ *    steps - the detents scaled up by how quickly the knob was turned
  */
 
-void encoder_led_mapping(uint8_t enc_num, bool direction) // true for clockwise, false for counter clockwise
+void encoder_led_mapping(uint8_t enc_num, int8_t detents, int16_t steps)
 {
     if (menu_mode == GLOBAL_SEQUENCER_MODE) {
         switch(enc_num) {
             case KIT_ENCODER:
-                if (digitalRead(NANO_sw0_pin) == LOW) {  // Change MIDI channel when shift is being held
+                if (fast_pin<NANO_sw0_pin>::read() == LOW) {  // Change MIDI channel when shift is being held
                     matrix.fillRect(0, 0, 16, 6, LED_OFF); // Clear the top 6 LED rows, not run at the beginning of the func due to not all knobs being fully implemented at the moment
-                    enc_8bit_val_calc(direction, &global_seq.midi_chan, MAX_MIDI_CHANNEL, 1);
+                    enc_8bit_val_calc(detents, &global_seq.midi_chan, MAX_MIDI_CHANNEL, 1);
                     for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
                         key_array[i].midi_chan = global_seq.midi_chan;
                     }
                     load_bitmap(global_seq.midi_chan);
                 } else { // Change program change bank
                     matrix.fillRect(0, 0, 16, 6, LED_OFF);
-                    enc_8bit_val_calc(direction, &global_seq.PCNum, MAX_PC_BANK, 0);
+                    enc_8bit_val_calc(detents, &global_seq.PCNum, MAX_PC_BANK, 0);
                     load_bitmap(global_seq.PCNum);
-                    MIDI.sendProgramChange(global_seq.PCNum, global_seq.midi_chan);
+                    midi_send_program_change(global_seq.PCNum, global_seq.midi_chan);
                 }
                 break;
             case SEQUENCE_LENGTH_ENCODER:
-                if (digitalRead(NANO_sw0_pin) == LOW) { // Functionality TBD
-                    // WIP - Have ideas for this knob? Feel free to make a suggestion or fork this repo to give it a shot yourself!
+                if (fast_pin<NANO_sw0_pin>::read() == LOW) { // Adjusts the gate length, as a percentage of a step, when shift is held
+                    matrix.fillRect(0, 0, 16, 6, LED_OFF);
+                    enc_8bit_val_calc(steps, &global_seq.gate, MAX_GATE, 1);
+                    load_bitmap(global_seq.gate);
                 } else { // Adjust sequencer length
                     matrix.fillRect(0, 0, 16, 6, LED_OFF);
-                    enc_16bit_val_calc(direction, &global_seq.length, MAX_SEQUENCER_LENGTH, 1);
+                    enc_16bit_val_calc(steps, &global_seq.length, MAX_SEQUENCER_LENGTH, 1);
                     load_bitmap(global_seq.length);
                 }
                 break;
             case BPM_ENCODER:
-                if (digitalRead(NANO_sw0_pin) == LOW) { // Adjusts the number of notes per beat when shift is held
+                if (fast_pin<NANO_sw0_pin>::read() == LOW) { // Adjusts the number of notes per beat when shift is held
                     matrix.fillRect(0, 0, 16, 6, LED_OFF);
-                    enc_8bit_val_calc(direction, &global_seq.npb, MAX_NOTES_PER_BEAT, 1);
+                    enc_8bit_val_calc(detents, &global_seq.npb, MAX_NOTES_PER_BEAT, 1);
                     load_bitmap(global_seq.npb);
-                    ms_between_notes = 60000 / ((global_seq.bpm + 45) * global_seq.npb);
-                } else { // Adjust the BPM
+                    clock_engine_set_tempo(global_seq.tempo, global_seq.npb, 0);
+                } else { // Adjust the BPM in whole BPM, keeping any tenths, the clock engine glides to it when a tempo ramp is set
+                    uint16_t bpm = global_seq.tempo / TEMPO_SCALE;
                     matrix.fillRect(0, 0, 16, 6, LED_OFF);
-                    enc_8bit_val_calc(direction, &global_seq.bpm, MAX_BPM, 0);
-                    load_bitmap(global_seq.bpm + 45);
+                    enc_16bit_val_calc(steps, &bpm, MAX_BPM, MIN_BPM);
+                    global_seq.tempo = min((bpm * TEMPO_SCALE) + (global_seq.tempo % TEMPO_SCALE), MAX_BPM * TEMPO_SCALE);
+                    load_bitmap(bpm);
                     bpm_direction();
-                    ms_between_notes = 60000 / ((global_seq.bpm + 45) * global_seq.npb);
-                    us_between_midi_clock_sig = 60000000 / ((global_seq.bpm + 45) * 24);
+                    clock_engine_set_tempo(global_seq.tempo, global_seq.npb, global_seq.ramp);
                 }
                 break;
             default:
                 break;
         }
+    } else if ((menu_mode == DETAILED_PARAM_MODE) && locks_holding()) { // While a key is held its parameters are locked on the step it was hit on
+        locks_encoder(enc_num, steps);
     } else if (menu_mode == DETAILED_PARAM_MODE) {
         switch(enc_num) {
             case KIT_ENCODER:
-                if (digitalRead(NANO_sw0_pin) == LOW) { // Set MIDI channel per button when shift is held
+                if (fast_pin<NANO_sw0_pin>::read() == LOW) { // Set MIDI channel per button when shift is held
                     matrix.fillRect(0, 0, 16, 6, LED_OFF);
                     draw_image(enc0_alt_rotate_bmp);
-                    enc_8bit_val_calc(direction, &key_array[global_seq.last_key].midi_chan, MAX_MIDI_CHANNEL, 1);
-                    load_bitmap(key_array[global_seq.last_key].midi_chan);
+                    uint8_t chan = key_array[global_seq.last_key].midi_chan; // bit-fields have no address, see sound_properties_t
+                    enc_8bit_val_calc(detents, &chan, MAX_MIDI_CHANNEL, 1);
+                    key_array[global_seq.last_key].midi_chan = chan;
+                    load_bitmap(chan);
                 } else { // Select the MIDI note associated with a button
                     matrix.fillRect(0, 0, 16, 6, LED_OFF);
                     draw_image(enc0_rotate_bmp);
-                    MIDI.sendNoteOff(key_array[global_seq.last_key].midi_note, 0, key_array[global_seq.last_key].midi_chan); // silence a key before switching to another
-                    enc_8bit_val_calc(direction, &key_array[global_seq.last_key].midi_note, MAX_MIDI_NOTE, 0);
-                    load_bitmap(key_array[global_seq.last_key].midi_note);
+                    note_stop(global_seq.last_key); // silence a key before switching to another
+                    uint8_t note = key_array[global_seq.last_key].midi_note;
+                    enc_8bit_val_calc(steps, &note, MAX_MIDI_NOTE, 0);
+                    key_array[global_seq.last_key].midi_note = note;
+                    load_bitmap(note);
                 }
                 break;
             case SEQUENCE_LENGTH_ENCODER:
-                if (digitalRead(NANO_sw0_pin) == LOW) { // Functionality TBD
-                    // WIP - Have ideas for this knob? Feel free to make a suggestion or fork this repo to give it a shot yourself!
+                if (fast_pin<NANO_sw0_pin>::read() == LOW) { // Set how many steps this key loops over on its own when shift is held, 0 == the pattern length
+                    matrix.fillRect(0, 0, 16, 6, LED_OFF);
+                    draw_image(enc1_rotate_bmp);
+                    enc_8bit_val_calc(steps, &key_array[global_seq.last_key].length, MAX_TRACK_LENGTH, 0);
+                    load_bitmap(key_array[global_seq.last_key].length);
+                    tracks_update(global_seq.last_key);
                 } else { // Adjust the probability of this midi note in-sequence
                     matrix.fillRect(0, 0, 16, 6, LED_OFF);
                     draw_image(enc1_rotate_bmp);
-                    enc_8bit_val_calc(direction, &key_array[global_seq.last_key].probability, MAX_PROBABILITY, 1);
-                    load_bitmap(key_array[global_seq.last_key].probability);
+                    uint8_t probability = key_array[global_seq.last_key].probability;
+                    enc_8bit_val_calc(steps, &probability, MAX_PROBABILITY, 1);
+                    key_array[global_seq.last_key].probability = probability;
+                    load_bitmap(probability);
                 }
                 break;
             case BPM_ENCODER:
-                if (digitalRead(NANO_sw0_pin) == LOW) { // Functionality TBD
-                    // WIP - Have ideas for this knob? Feel free to make a suggestion or fork this repo to give it a shot yourself!
-                } else { // Set button specific BPM for polyrythms, WIP
-                    // key specific bpm - Reach Goal
-                    // draw_image(enc2_rotate_bmp);
-                    // enc_8bit_val_calc(direction, &key_array[global_seq.last_key].local_bpm, MAX_BPM, 0);
-                    // load_bitmap(key_array[global_seq.last_key].local_bpm);
+                if (fast_pin<NANO_sw0_pin>::read() == LOW) { // Nudge this key's notes early or late when shift is held, in percent of one of its steps
+                    int8_t *offset = &key_array[global_seq.last_key].offset;
+                    *offset = constrain(*offset + detents, -TIMING_OFFSET_MAX, TIMING_OFFSET_MAX);
+                    matrix.fillRect(0, 0, 16, 6, LED_OFF);
+                    draw_image(enc2_rotate_bmp);
+                    load_bitmap(abs(*offset));
+                    if (*offset < 0) {
+                        matrix.drawLine(0, 2, 2, 2, LED_ON); // early, shown as a minus sign
+                    }
+                    tracks_update(global_seq.last_key);
+                } else { // Set the rate this key steps at for polyrhythms, shown as a percentage of the sequencer's speed
+                    uint8_t rate_num = 0;
+                    while ((rate_num < (ArraySize(track_rates) - 1)) && (pgm_read_byte(&track_rates[rate_num]) != key_array[global_seq.last_key].rate)) {
+                        rate_num++;
+                    }
+                    matrix.fillRect(0, 0, 16, 6, LED_OFF);
+                    draw_image(enc2_rotate_bmp);
+                    enc_8bit_val_calc(-detents, &rate_num, ArraySize(track_rates) - 1, 0); // the table runs from fast to slow
+                    key_array[global_seq.last_key].rate = pgm_read_byte(&track_rates[rate_num]);
+                    load_bitmap((CLOCK_PPQN * 100) / key_array[global_seq.last_key].rate);
+                    tracks_update(global_seq.last_key);
                 }
                 break;
             default:
@@ -479,33 +425,18 @@ void encoder_led_mapping(uint8_t enc_num, bool direction) // true for clockwise,
 
 /*
  * Function: read_encoder
- * Description: read encoder inputs
+ * Description: applies the detents an encoder has turned since it was last read
  * Input:
- *    enc_ch0 - a digital pin associated with an encoder
- *    enc_ch1 - another digital pin associated with an encoder
  *    enc_num - There are 4 rotary encoders, valid values 0-3
  */
 
-void read_encoder(uint8_t enc_ch0, uint8_t enc_ch1, uint8_t enc_num)
+void read_encoder(uint8_t enc_num)
 {
-    static uint8_t old_AB[] = {3, 3, 3};
-    static int8_t encval[] = {0, 0, 0};
-    static const int8_t enc_states[] = {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0};
-
-    old_AB[enc_num] <<=2;
+    int8_t detents;
+    int16_t steps = encoder_take(enc_num, &detents);
 
-    if (digitalRead(enc_ch0)) old_AB[enc_num] |= 0x02;
-    if (digitalRead(enc_ch1)) old_AB[enc_num] |= 0x01;
-
-    encval[enc_num] += enc_states[(old_AB[enc_num] & 0x0f)];
-    if (encval[enc_num] > 3 or encval[enc_num] < -3) {
-        int8_t changevalue = (encval[enc_num] > 0) - (encval[enc_num] < 0);
-        if (changevalue == 1) {
-            encoder_led_mapping(enc_num, true);
-        } else {
-            encoder_led_mapping(enc_num, false);
-        }
-        encval[enc_num] = 0;
+    if (detents != 0) {
+        encoder_led_mapping(enc_num, detents, steps);
     }
 }
 
@@ -536,101 +467,200 @@ void manual_seq_control(bool manual_direction)
     }
 }
 
+/*
+ * Function: key_play
+ * Description: plays a key and records it while recording, all a note from the MIDI input does to a key
+ * Input:
+ *    pin_num - an SX1509 pin associated with playing midi notes
+ *    pressed - true == the key went down, false == the key was released
+ *    stamp - clock engine tick the key changed on, see record.ino
+ *    shift - true == the key stays silent and a recorded hit takes it off the step
+ * Output:
+ *    false if a recorded hit needed a new page of steps and every pool page is taken
+ */
+
+bool key_play(uint8_t pin_num, bool pressed, uint32_t stamp, bool shift)
+{
+    bool stored = true;
+
+    if (pressed) {
+        if (global_seq.record) {
+            stored = record_hit(pin_num, stamp, shift);
+        }
+        if (!shift && !key_array[pin_num].state) {
+            note_start(pin_num, false, LOCK_NONE); // held until the key is released
+            key_array[pin_num].state = true;
+        }
+    } else {
+        if (key_array[pin_num].state) {
+            note_stop(pin_num);
+        }
+        key_array[pin_num].state = false;
+    }
+    return stored;
+}
+
 /*
  * Function: sx1509_midi_func
  * Description: handles button events related to playing midi notes
  * Input:
  *    pin_num - an SX1509 pin associated with playing midi notes
+ *    pressed - true == the key went down, false == the key was released
+ *    stamp - clock engine tick the key changed on, see record.ino
  */
 
-void sx1509_midi_func(uint8_t pin_num)
+void sx1509_midi_func(uint8_t pin_num, bool pressed, uint32_t stamp)
 {
-    if ((millis() - sx1509_pin[pin_num].debounce) > sw_debounce_time) {
-        if (SX1509_io.digitalRead(pin_num) == LOW) {
-            if (global_seq.record) {
-                sequencer_array[global_seq.step] ^= (1 << pin_num);
-            }
-            if (menu_mode == GLOBAL_SEQUENCER_MODE) {
-                matrix.fillRect(0, 0, 16, 6, LED_OFF);     // clear sequencer portion of display
+    if (pressed) {
+        if (!global_seq.record && (pin_num < PATTERN_CT) && (menu_mode == GLOBAL_SEQUENCER_MODE) && (fast_pin<NANO_sw0_pin>::read() == LOW)) { // shift + key selects a pattern
+            pattern_cue(pin_num); // while playing the pattern takes over at the end of the loop
+            matrix.fillRect(0, 0, 16, 6, LED_OFF);
+            load_bitmap(pin_num + 1);
+            return;
+        }
+        bool full = !key_play(pin_num, true, stamp, fast_pin<NANO_sw0_pin>::read() == LOW); // shift + key erases and stays silent
+        if (menu_mode == GLOBAL_SEQUENCER_MODE) {
+            matrix.fillRect(0, 0, 16, 6, LED_OFF);     // clear sequencer portion of display
+            if (full) {
+                matrix.drawBitmap(0, 0, pool_full_bmp, 16, 8, LED_ON); // until the next step is drawn
+            } else {
                 matrix.drawPixel(global_seq.step % 16, global_seq.row % 6, LED_ON);
-                matrix.drawPixel(key_array[pin_num].led_pos[0], key_array[pin_num].led_pos[1], LED_ON);
-                matrix.writeDisplay();
-            } else if (menu_mode == DETAILED_PARAM_MODE) {
-                draw_image(key_bitmap[pin_num]);
-            }
-            if ((digitalRead(NANO_sw0_pin) == HIGH) && !key_array[pin_num].state) {
-                MIDI.sendNoteOn(key_array[pin_num].midi_note, key_array[pin_num].volume, key_array[pin_num].midi_chan);
-                key_array[pin_num].state = true;
+                draw_key_pixel(pin_num, LED_ON);
             }
-            global_seq.last_key = pin_num;
-        } else if ((SX1509_io.digitalRead(pin_num)) == HIGH) {
-            if (!(0x0001 & (sequencer_array[global_seq.step] >> pin_num)) && (menu_mode == GLOBAL_SEQUENCER_MODE)) {
-                matrix.drawPixel(key_array[pin_num].led_pos[0], key_array[pin_num].led_pos[1], LED_OFF);
-                matrix.writeDisplay();
+        } else if (menu_mode == DETAILED_PARAM_MODE) {
+            uint8_t pat_num;
+            uint16_t step = record_step(stamp, &pat_num); // the step a recorded hit would go on
+            draw_image(full ? pool_full_bmp : key_bitmap[pin_num]);
+            locks_hold(pin_num, pat_num, step);
+        }
+        global_seq.last_key = pin_num;
+    } else {
+        if (!(0x0001 & (pattern_step(pattern_bank.active, global_seq.step) >> pin_num)) && (menu_mode == GLOBAL_SEQUENCER_MODE)) {
+            draw_key_pixel(pin_num, LED_OFF);
+        }
+        key_play(pin_num, false, stamp, false);
+        locks_release(pin_num);
+    }
+}
+
+/*
+ * Function: sx1509_record_func
+ * Description: handles presses of the record button, toggles recording or steps the sequencer back while sw0 is held
+ */
+
+void sx1509_record_func()
+{
+    if (menu_mode == GLOBAL_SEQUENCER_MODE) {
+        if (fast_pin<NANO_sw0_pin>::read() == LOW) {
+            manual_seq_control(false);
+        } else {
+            if (global_seq.record) {
+                global_seq.record = false;
+                matrix.drawPixel(12, 7, LED_OFF);
+                global_seq.record_blink_flag = false;
+            } else {
+                global_seq.record = true;
+                matrix.drawPixel(12, 7, LED_ON);
+                global_seq.record_blink_flag = true;
+                global_seq.record_last_blink = millis();
             }
-            if (key_array[pin_num].note_off && key_array[pin_num].state) {
-                MIDI.sendNoteOff(key_array[pin_num].midi_note, 0, key_array[pin_num].midi_chan);
+        }
+    }
+}
+
+/*
+ * Function: sx1509_play_func
+ * Description: handles presses of the play button, starts/stops the sequencer or steps it forward while sw0 is held
+ */
+
+void sx1509_play_func()
+{
+    if (menu_mode == GLOBAL_SEQUENCER_MODE) {
+        if (fast_pin<NANO_sw0_pin>::read() == LOW) {
+            manual_seq_control(true);
+        } else {
+            if (global_seq.paused) {
+                notes_stop_all();
+                global_seq.paused = false;
+                midi_send_realtime(MIDI_START);
+                schedule_start(false);
+                clock_engine_start();
+                tracks_start(false, false);
+            } else {
+                global_seq.paused = true;
+                clock_engine_stop(); // also drops the notes that haven't gone out yet
+                notes_stop_all();
+                midi_send_realtime(MIDI_STOP);
             }
-            key_array[pin_num].state = false;
         }
-        sx1509_pin[pin_num].debounce = millis();
+    }
+}
+
+/*
+ * Function: midi_transport_handler
+ * Description: follows MIDI Start/Continue/Stop from an external clock, the clock engine itself has already been started or stopped by the
+ *    UART receive interrupt. Pressing play afterwards hands the tempo back to the internal clock.
+ */
+
+void midi_transport_handler()
+{
+    switch (clock_engine_take_transport()) {
+        case MIDI_START:
+            // back to the top, the first step is played on the first clock pulse
+            global_seq.step = global_seq.direction ? (global_seq.length - 1) : 0;
+            notes_stop_all();
+            global_seq.paused = false;
+            schedule_start(true);
+            tracks_start(true, true);
+            break;
+        case MIDI_CONTINUE:
+            notes_stop_all();
+            global_seq.paused = false;
+            schedule_start(false);
+            tracks_start(false, false);
+            break;
+        case MIDI_STOP:
+            notes_stop_all();
+            global_seq.paused = true;
+            break;
+        default:
+            break;
     }
 }
 
 /*
  * Function: sx1509_input_handler
- * Description: Handles all inputs to the SX1509css
+ * Description: Handles all inputs to the SX1509. The pin levels of the last scan are XORed against the levels that have already been handled,
+ *    and a press/release is dispatched for every pin that changed, so any combination of keys and transport buttons is handled in one pass
  */
 
 void sx1509_input_handler()
 {
-    uint16_t intSrc = SX1509_io.interruptSource();
-
-    if (intSrc == 0x4000) {
-        if (SX1509_io.digitalRead(14) == LOW && ((millis() - sx1509_pin[14].debounce) > sw_debounce_time)) {
-            if (menu_mode == GLOBAL_SEQUENCER_MODE) {
-                if (digitalRead(NANO_sw0_pin) == LOW) {
-                    manual_seq_control(false);
-                } else {
-                    if (global_seq.record) {
-                        global_seq.record = false;
-                        matrix.drawPixel(12, 7, LED_OFF);
-                        global_seq.record_blink_flag = false;
-                    } else {
-                        global_seq.record = true;
-                        matrix.drawPixel(12, 7, LED_ON);
-                        global_seq.record_blink_flag = true;
-                        global_seq.record_last_blink = millis();
-                    }
-                    matrix.writeDisplay();
-                }
-            }
-            sx1509_pin[14].debounce = millis();
+    static uint16_t handled_state = 0xFFFF; // pin levels that have been dispatched, all keys start released
+    uint16_t changed = sx1509_pin_state ^ handled_state;
+
+    for (uint8_t i = 0; changed != 0; i++, changed >>= 1) {
+        if (!(changed & 0x0001)) {
+            continue;
         }
-    } else if (intSrc == 0x8000) {
-        if (SX1509_io.digitalRead(15) == LOW && ((millis() - sx1509_pin[15].debounce) > sw_debounce_time)) {
-            if (menu_mode == GLOBAL_SEQUENCER_MODE) {
-                if (digitalRead(NANO_sw0_pin) == LOW) {
-                    manual_seq_control(true);
-                } else {
-                    for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
-                        MIDI.sendNoteOff(key_array[i].midi_note, 0, key_array[i].midi_chan);
-                    }
-                    if (global_seq.paused) {
-                        global_seq.paused = false;
-                        MIDI.sendStart();
-                        prev_clock_tick = micros();
-                    } else {
-                        global_seq.paused = true;
-                        MIDI.sendStop();
-                    }
-                }
-            }
-            sx1509_pin[15].debounce = millis();
+        if (ms_since(sx1509_pin[i].debounce) <= sw_debounce_time) {
+            sx1509_int_flag = true; // still bouncing, the pin is looked at again by a later scan
+            continue;
         }
-    } else {
-        for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
-            sx1509_midi_func(i);
+        handled_state ^= (1 << i);
+        sx1509_pin[i].debounce = millis();
+
+        bool pressed = !(handled_state & (1 << i));
+        if (i == SX1509_RECORD_PIN) {
+            if (pressed) {
+                sx1509_record_func();
+            }
+        } else if (i == SX1509_PLAY_PIN) {
+            if (pressed) {
+                sx1509_play_func();
+            }
+        } else {
+            sx1509_midi_func(i, pressed, sx1509_scan_tick);
         }
     }
 }
@@ -644,45 +674,70 @@ void sx1509_input_handler()
 
 void analog_potentiometer_disp(int anlg_pin_num)
 {
-    draw_image(anlg_pot[anlg_pin_num].bitmap);
-    int pot_level = (POT_MOD(analogRead(anlg_pot[anlg_pin_num].pinNum))/ 64);
+    draw_image((const uint8_t *) pgm_read_ptr(&pot_rotate_bmps[anlg_pin_num]));
+    int pot_level = (POT_MOD(anlg_pot[anlg_pin_num].state)/ 64);
     if (pot_level < 1) {
         matrix.drawLine(0, 0, 15, 0, LED_OFF);
     } else {
         matrix.drawLine(0, 0, pot_level, 0, LED_ON);
     }
-    matrix.writeDisplay();
-    anlg_pot[anlg_pin_num].state = analogRead(anlg_pot[anlg_pin_num].pinNum);
 }
 
 /*
  * Function: analog_potentiometer_handler
- * Description: Handles changes to the analog potentiometers
+ * Description: Handles changes to the analog potentiometers, every pot is looked at on every pass and only acted on once its 7-bit value has changed
  */
 
 void analog_potentiometer_handler(void)
 {
-    if ((millis() - prev_pot_time) > 50) {
-        if (abs(analogRead(anlg_pot[0].pinNum) - anlg_pot[0].state) > 32) {
-            analog_potentiometer_disp(0);
-            key_array[global_seq.last_key].volume = POT_MOD(anlg_pot[0].state) / 8; // per key volume
-        } else if (abs(analogRead(anlg_pot[1].pinNum) - anlg_pot[1].state) > 32) {
-            analog_potentiometer_disp(1);
-            global_seq.volume = POT_MOD(anlg_pot[1].state) / 8;
-            MIDI.sendControlChange(7, global_seq.volume, global_seq.midi_chan); // global volume
-        } else if (abs(analogRead(anlg_pot[2].pinNum) - anlg_pot[2].state) > 32) {
-            analog_potentiometer_disp(2);
-            global_seq.attack = POT_MOD(anlg_pot[2].state) / 8;
-            MIDI.sendControlChange(73, global_seq.attack, global_seq.midi_chan); // global attack
-        } else if (abs(analogRead(anlg_pot[3].pinNum) - anlg_pot[3].state) > 32) {
-            analog_potentiometer_disp(3);
-            global_seq.release = POT_MOD(anlg_pot[3].state) / 8;
-            MIDI.sendControlChange(72, global_seq.release, global_seq.midi_chan); // global release
+    for (uint8_t i = 0; i < ADC_POT_CT; i++) {
+        int filtered = adc_pot_value(i);
+        if (abs(filtered - anlg_pot[i].state) <= ADC_POT_HYSTERESIS) {
+            continue;
+        }
+        uint8_t prev_level = POT_MOD(anlg_pot[i].state) / 8;
+        anlg_pot[i].state = filtered;
+        uint8_t level = POT_MOD(anlg_pot[i].state) / 8;
+        if (level == prev_level) {
+            continue;
+        }
+        analog_potentiometer_disp(i);
+        switch (i) {
+            case 0:
+                key_array[global_seq.last_key].volume = level; // per key volume
+                break;
+            case 1:
+                global_seq.volume = level;
+                midi_send_control_change(7, global_seq.volume, global_seq.midi_chan); // global volume
+                break;
+            case 2:
+                global_seq.attack = level;
+                midi_send_control_change(73, global_seq.attack, global_seq.midi_chan); // global attack
+                break;
+            default:
+                global_seq.release = level;
+                midi_send_control_change(72, global_seq.release, global_seq.midi_chan); // global release
+                break;
         }
-        prev_pot_time = millis();
     }
 }
 
+/*
+ * Function: global_sequencer_next
+ * Description: works out the step that follows a step of the sequencer
+ * Input:
+ *    step - current step
+ *    direction - true == clockwise, false == counter-clockwise
+ */
+
+uint16_t global_sequencer_next(uint16_t step, bool direction)
+{
+    if (direction) {
+        return (step >= (global_seq.length - 1)) ? 0 : (step + 1);
+    }
+    return (step == 0) ? (global_seq.length - 1) : (step - 1);
+}
+
 /*
  * Function: global_sequencer_tracker
  * Description: tracks sequencer steps when sequencer is active
@@ -692,18 +747,8 @@ void analog_potentiometer_handler(void)
 
 void global_sequencer_tracker(bool direction)
 {
-    if (direction) {
-        if (global_seq.step >= (global_seq.length - 1)) {
-            global_seq.step = 0;
-        } else {
-            global_seq.step++;
-        }
-    } else {
-        if (global_seq.step == 0) {
-            global_seq.step = global_seq.length - 1;
-        } else {
-            global_seq.step--;
-        }
+    if (!pattern_take_wrap()) { // the sequence has wrapped into a cued pattern, its first step has been scheduled already
+        global_seq.step = global_sequencer_next(global_seq.step, direction);
     }
 }
 
@@ -714,14 +759,15 @@ void global_sequencer_tracker(bool direction)
 
 void draw_sequencer_pixel()
 {
+    uint16_t keys = pattern_step(pattern_bank.active, global_seq.step);
+
     for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
-        if (0x0001 & (sequencer_array[global_seq.step] >> i)) {
-            matrix.drawPixel(key_array[i].led_pos[0], key_array[i].led_pos[1], LED_ON);
+        if (0x0001 & (keys >> i)) {
+            draw_key_pixel(i, LED_ON);
         } else {
-            matrix.drawPixel(key_array[i].led_pos[0], key_array[i].led_pos[1], LED_OFF);
+            draw_key_pixel(i, LED_OFF);
         }
     }
-    matrix.writeDisplay();
 }
 
 void display_sequence_page()
@@ -764,7 +810,6 @@ void display_global_sequencer()
         global_seq.prev_page = global_seq.page;
     }
     draw_sequencer_pixel();
-    matrix.writeDisplay();
 }
 
 /*
@@ -775,7 +820,6 @@ void display_global_sequencer()
 void switch_menu_mode()
 {
     matrix.clear();
-    matrix.writeDisplay();
     if (menu_mode == GLOBAL_SEQUENCER_MODE) {
         menu_mode = DETAILED_PARAM_MODE;
         // display the detailed param mode interface
@@ -786,36 +830,40 @@ void switch_menu_mode()
             matrix.drawLine(10, 6, 10, 7, LED_ON);
             matrix.drawLine(8, 6, 8, 7, LED_ON);
         }
+        trig_draw_fill();
         global_seq.prev_page = 5; // set it to an impossible value so that it triggers the if statement in display_global_sequencer(), a bit hacky
         display_global_sequencer();
     }
 }
 
 /*
- * Function: sequencer_handler
- * Description: handles changes to sequencer status
+ * Function: record_blink
+ * Description: blinks the record dot while sequencer recording is on, a task of its own that only runs when the dot is due to change
  */
 
-void sequencer_handler()
+void record_blink()
 {
-    if (global_seq.record && (menu_mode == GLOBAL_SEQUENCER_MODE)) { // display a blinking dot if sequencer recording is on
-        if ((millis() - global_seq.record_last_blink) >= 500) {
-            if (global_seq.record_blink_flag) {
-                matrix.drawPixel(12, 7, LED_OFF);
-                global_seq.record_blink_flag = false;
-            } else {
-                matrix.drawPixel(12, 7, LED_ON);
-                global_seq.record_blink_flag = true;
-            }
-            global_seq.record_last_blink = millis();
-            matrix.writeDisplay();
-        }
+    if (global_seq.record_blink_flag) {
+        matrix.drawPixel(12, 7, LED_OFF);
+        global_seq.record_blink_flag = false;
+    } else {
+        matrix.drawPixel(12, 7, LED_ON);
+        global_seq.record_blink_flag = true;
     }
+    global_seq.record_last_blink = millis();
+}
 
-    if ((menu_mode == GLOBAL_SEQUENCER_MODE) && (prev_sequencer_step_val != sequencer_array[global_seq.step])) { // if the sequencer step has changed, reflect that on the LED backpack
+/*
+ * Function: sequencer_display
+ * Description: keeps the step LEDs and the pause glyph on the LED backpack in line with the sequencer
+ */
+
+void sequencer_display()
+{
+    uint16_t step_keys = pattern_step(pattern_bank.active, global_seq.step);
+    if ((menu_mode == GLOBAL_SEQUENCER_MODE) && (prev_sequencer_step_val != step_keys)) { // if the sequencer step has changed, reflect that on the LED backpack
         draw_sequencer_pixel();
-        matrix.writeDisplay();
-        prev_sequencer_step_val = sequencer_array[global_seq.step];
+        prev_sequencer_step_val = step_keys;
     }
 
     if (global_seq.paused) { // if the sequencer is paused, draw two vertical parallel lines on the LED backpack to indicate it
@@ -823,34 +871,34 @@ void sequencer_handler()
             matrix.drawLine(10, 6, 10, 7, LED_ON);
             matrix.drawLine(8, 6, 8, 7, LED_ON);
             display_sequence_page();
-            matrix.writeDisplay();
         }
-        return;
     } else {
         matrix.fillRect(8, 6, 3, 2, LED_OFF);
     }
-    //do math for bpm and transition LEDs to next step
-    if (((micros() - prev_clock_tick) >= us_between_midi_clock_sig) || (micros() < prev_clock_tick)) {
-        MIDI.sendClock();
-        prev_clock_tick = micros();
+}
+
+/*
+ * Function: sequencer_step
+ * Description: plays a sequencer step the clock engine has made due. MIDI clock and step timing come from the Timer1 clock engine,
+ *    we only play the steps it hands over
+ */
+
+void sequencer_step()
+{
+    uint32_t step_tick;
+
+    if (!clock_engine_take_step(&step_tick)) {
+        return;
     }
-    if ((millis() - prev_seq_time) >= ms_between_notes) {
-        // increment sequencer steps
-        global_sequencer_tracker(global_seq.direction);
-        if (menu_mode == GLOBAL_SEQUENCER_MODE) {
-            display_global_sequencer();
-        } else if (menu_mode == DETAILED_PARAM_MODE) {
-            // WIP related to button-specific BPM
-        }
-        for (uint8_t i = 0; i < MAX_POLYPHONY; i++) { // checks current sequencer step for any programmed midi notes
-            if (key_array[i].note_off) { // turn off previous notes if "note-off" mode is on
-                MIDI.sendNoteOff(key_array[i].midi_note, 0, key_array[i].midi_chan);
-            }
-            if ((0x0001 & (sequencer_array[global_seq.step] >> i)) && ((uint8_t) random(1, 100) < key_array[i].probability)) {
-                MIDI.sendNoteOn(key_array[i].midi_note, key_array[i].volume, key_array[i].midi_chan);
-            }
-        }
-    prev_seq_time = millis();
+#ifdef LOOP_PROFILE
+    profile_step_taken();
+#endif // LOOP_PROFILE
+    // increment sequencer steps
+    global_sequencer_tracker(global_seq.direction);
+    global_seq.step_due = step_tick;
+    schedule_sequencer_step(global_seq.step, step_tick); // the notes go out from the note scheduler, see schedule.ino
+    if (menu_mode == GLOBAL_SEQUENCER_MODE) { // drawn once the notes are on their way
+        display_global_sequencer();
     }
 }
 
@@ -863,26 +911,40 @@ void sw0_func()
 {
     sw0_flag = false;
     switch_menu_mode();
-    uint16_t unstuck_sx1509_int = SX1509_io.interruptSource(); // sx1509 inputs seem to get overwhelmed when spammed rapidly
+    sx1509_clear_interrupts(); // sx1509 inputs seem to get overwhelmed when spammed rapidly
     NANO_sw0_last_trig = millis();
 }
 
 /*
  * Function: enc0_sw_func
- * Description: handles switch presses on encoder 0, in this case if the system is in menu DETAILED_PARAM_MODE, it resets parameters for the last pressed button
+ * Description: handles switch presses on encoder 0, in this case if the system is in menu DETAILED_PARAM_MODE, it resets parameters for the last pressed button,
+ *    or steps through its trig conditions while shift is held, or removes its parameter locks on the step while it is held, and in menu GLOBAL_SEQUENCER_MODE it toggles fill
  */
 
 void enc0_sw_func()
 {
-    if (menu_mode == DETAILED_PARAM_MODE) {
+    if ((menu_mode == DETAILED_PARAM_MODE) && locks_holding()) { // Remove the parameter locks of the held key on its step
+        draw_image(enc0_param_rst_bmp);
+        locks_clear(locks.held);
+    } else if ((menu_mode == DETAILED_PARAM_MODE) && (fast_pin<NANO_sw0_pin>::read() == LOW)) {
+        uint8_t trig = (key_array[global_seq.last_key].trig + 1) % TRIG_CONDITIONS;
+        key_array[global_seq.last_key].trig = trig;
+        matrix.fillRect(0, 0, 16, 6, LED_OFF);
+        load_bitmap(trig);
+    } else if (menu_mode == DETAILED_PARAM_MODE) {
         draw_image(enc0_param_rst_bmp);
         key_array[global_seq.last_key].volume = 127;
         key_array[global_seq.last_key].midi_chan = global_seq.midi_chan;
         key_array[global_seq.last_key].probability = 100;
         key_array[global_seq.last_key].note_off = false;
         key_array[global_seq.last_key].state = false;
-    } else { // TBD
-        // WIP - Have ideas for this knob? Feel free to make a suggestion or fork this repo to give it a shot yourself!
+        key_array[global_seq.last_key].length = 0;
+        key_array[global_seq.last_key].rate = TRACK_RATE_DEFAULT;
+        key_array[global_seq.last_key].offset = 0;
+        key_array[global_seq.last_key].trig = TRIG_ALWAYS;
+        tracks_update(global_seq.last_key);
+    } else if (menu_mode == GLOBAL_SEQUENCER_MODE) {
+        trig_toggle_fill();
     }
     enc0_sw_flag = false;
 }
@@ -894,18 +956,28 @@ void enc0_sw_func()
 
 void enc0_knob_func()
 {
-    read_encoder(NANO_enc0_ch0, NANO_enc0_ch1, 0);
-    enc0_knob_flag = false;
+    enc0_knob_flag = false; // cleared first, a detent that comes in while this runs sets it again
+    read_encoder(0);
 }
 
 /*
  * Function: enc1_sw_func
- * Description: handles switch pressed on encoder 1, in this case if the system is in menu DETAILED_PARAM_MODE, it toggles note-off for the last pressed button on/off
+ * Description: handles switch pressed on encoder 1, in this case if the system is in menu DETAILED_PARAM_MODE, it toggles note-off for the last pressed button on/off,
+ *    and in menu GLOBAL_SEQUENCER_MODE it steps through the swing amounts, or through the record grids when shift is held
  */
 
 void enc1_sw_func()
 {
-    if (menu_mode == DETAILED_PARAM_MODE) {
+    if ((menu_mode == GLOBAL_SEQUENCER_MODE) && (fast_pin<NANO_sw0_pin>::read() == LOW)) {
+        // move on to the next coarser record grid, back to single steps after the coarsest
+        uint8_t grid_num = 0;
+        while ((grid_num < ArraySize(record_grids)) && (pgm_read_byte(&record_grids[grid_num]) <= global_seq.rec_grid)) {
+            grid_num++;
+        }
+        global_seq.rec_grid = pgm_read_byte(&record_grids[grid_num % ArraySize(record_grids)]);
+        matrix.fillRect(0, 0, 16, 6, LED_OFF);
+        load_bitmap(global_seq.rec_grid);
+    } else if (menu_mode == DETAILED_PARAM_MODE) {
         // toggle note-off on/off
         if (key_array[global_seq.last_key].note_off) {
             draw_image(enc1_note_off_dis_bmp);
@@ -914,8 +986,15 @@ void enc1_sw_func()
             draw_image(enc1_note_off_en_bmp);
             key_array[global_seq.last_key].note_off = true;
         }
-    } else { //TBD
-        // WIP - Have ideas for this knob? Feel free to make a suggestion or fork this repo to give it a shot yourself!
+    } else if (menu_mode == GLOBAL_SEQUENCER_MODE) {
+        // move on to the next larger swing amount, back to straight after the largest
+        uint8_t swing_num = 0;
+        while ((swing_num < ArraySize(swing_amounts)) && (pgm_read_byte(&swing_amounts[swing_num]) <= global_seq.swing)) {
+            swing_num++;
+        }
+        global_seq.swing = pgm_read_byte(&swing_amounts[swing_num % ArraySize(swing_amounts)]);
+        matrix.fillRect(0, 0, 16, 6, LED_OFF);
+        load_bitmap(global_seq.swing);
     }
     enc1_sw_flag = false;
 }
@@ -927,31 +1006,42 @@ void enc1_sw_func()
 
 void enc1_knob_func()
 {
-    read_encoder(NANO_enc1_ch0, NANO_enc1_ch1, 1);
     enc1_knob_flag = false;
+    read_encoder(1);
 }
 
 /*
  * Function: enc2_sw_func
- * Description: handles switch pressed on encoder 2, in this case if the system is in menu GLOBAL_SEQUENCER_MODE, it changes the direction of the sequencer, denoted by a negative/positive BPM
+ * Description: handles switch pressed on encoder 2, in this case if the system is in menu GLOBAL_SEQUENCER_MODE, it changes the direction of the sequencer, denoted by a negative/positive BPM,
+ *    or steps through the tempo ramp lengths when shift is held, and in menu DETAILED_PARAM_MODE it resyncs the track of the last pressed key on the next bar
  */
 
 void enc2_sw_func()
 {
-    if (menu_mode == GLOBAL_SEQUENCER_MODE) {
+    if ((menu_mode == GLOBAL_SEQUENCER_MODE) && (fast_pin<NANO_sw0_pin>::read() == LOW)) {
+        // move on to the next longer tempo ramp, back to none after the longest
+        uint8_t ramp_num = 0;
+        while ((ramp_num < ArraySize(tempo_ramp_bars)) && (pgm_read_byte(&tempo_ramp_bars[ramp_num]) <= global_seq.ramp)) {
+            ramp_num++;
+        }
+        global_seq.ramp = pgm_read_byte(&tempo_ramp_bars[ramp_num % ArraySize(tempo_ramp_bars)]);
+        matrix.fillRect(0, 0, 16, 6, LED_OFF);
+        load_bitmap(global_seq.ramp);
+    } else if (menu_mode == GLOBAL_SEQUENCER_MODE) {
         // reverse sequencer
         matrix.fillRect(0, 0, 16, 6, LED_OFF);
         if (global_seq.direction) {
             global_seq.direction = false;
-            load_bitmap(global_seq.bpm + 45);
+            load_bitmap(global_seq.tempo / TEMPO_SCALE);
             bpm_direction();
         } else {
             global_seq.direction = true;
-            load_bitmap(global_seq.bpm + 45);
+            load_bitmap(global_seq.tempo / TEMPO_SCALE);
             bpm_direction();
         }
     } else if (menu_mode == DETAILED_PARAM_MODE) {
-        // resync local BPM WIP
+        // send the key's track back to its first step on the next bar, or every key's when shift is held
+        tracks_resync((fast_pin<NANO_sw0_pin>::read() == LOW) ? 0xFFFF : (1 << global_seq.last_key));
     }
     enc2_sw_flag = false;
 }
@@ -963,76 +1053,67 @@ void enc2_sw_func()
 
 void enc2_knob_func()
 {
-    read_encoder(NANO_enc2_ch0, NANO_enc2_ch1, 2);
     enc2_knob_flag = false;
+    read_encoder(2);
 }
 
-void loop()
+/*
+ * Function: sw0_handler
+ * Description: tells a tap of SW0, which switches menu modes, from SW0 being held as shift
+ */
+
+void sw0_handler()
 {
-    // automatically assume that SW0 is being used as a shift key if any of the other buttons/encoders have been triggered as well
-    static bool shift_op = enc0_sw_flag || enc0_knob_flag || enc1_sw_flag || enc1_knob_flag || enc2_sw_flag || enc2_knob_flag || sx1509_int_flag;
-    sequencer_handler();
-    analog_potentiometer_handler();
-
-    // check for flags that would be set due to an interrupt being triggered
-    if (sw0_flag && !shift_op) {
-        if ((millis() - NANO_sw0_last_trig) > sw_debounce_time) {
-            if (sw0_last_pressed == 0) {
-                sw0_last_pressed = millis();
-            }
-            if (digitalRead(NANO_sw0_pin) == HIGH) {
-                if ((millis() - sw0_last_pressed) < 200) { // somewhat arbitrary period of time to determine whether to interpret SW0 as shift or menu-change
-                    sw0_func();
-                    sw0_last_pressed = 0;
-                } else {
-                    sw0_flag = false;
-                    sw0_last_pressed = 0;
-                }
-            }
-            NANO_sw0_last_trig = millis();
-        }
-    }
-    
-    if (enc0_sw_flag) {
-        if ((millis() - enc0_sw_last_trig) > sw_debounce_time) {
-            enc0_sw_func();
-            enc0_sw_last_trig = millis();
-        }
+    if (ms_since(NANO_sw0_last_trig) <= sw_debounce_time) {
+        return;
     }
-
-    if (enc0_knob_flag) {
-        enc0_knob_func();
+    if (sw0_last_pressed == 0) {
+        sw0_last_pressed = millis();
     }
-
-    if (enc1_sw_flag) {
-        if ((millis() - enc1_sw_last_trig) > sw_debounce_time) {
-            enc1_sw_func();
-            enc1_sw_last_trig = millis();
+    if (fast_pin<NANO_sw0_pin>::read() == HIGH) {
+        if ((millis() - sw0_last_pressed) < 200) { // somewhat arbitrary period of time to determine whether to interpret SW0 as shift or menu-change
+            sw0_func();
+            sw0_last_pressed = 0;
+        } else {
+            sw0_flag = false;
+            sw0_last_pressed = 0;
         }
     }
+    NANO_sw0_last_trig = millis();
+}
 
-    if (enc1_knob_flag) {
-        enc1_knob_func();
-    }
+/*
+ * Function: sx1509_scan_handler
+ * Description: requests a scan of the SX1509 after an interrupt, the registers are read in the background and the keys are handled once the scan has completed
+ */
 
-    if (enc2_sw_flag) {
-        if ((millis() - enc2_sw_last_trig) > sw_debounce_time) {
-            enc2_sw_func();
-            enc2_sw_last_trig = millis();
-        }
+void sx1509_scan_handler()
+{
+    noInterrupts();
+    uint32_t int_tick = sx1509_int_tick; // taken before the scan clears the SX1509 interrupt, an edge after that stamps the next scan
+    interrupts();
+    if (sx1509_request_scan()) {
+        sx1509_scan_tick = int_tick;
+        sx1509_int_flag = false;
+        sx1509_int_pin_last_trig = millis();
     }
+}
 
-    if (enc2_knob_flag) {
-        enc2_knob_func();
-    }
+/*
+ * Function: shift_op
+ * Description: automatically assume that SW0 is being used as a shift key if any of the other buttons/encoders have been triggered as well.
+ *    Looked at whenever the SW0 task is, as the tasks that run before it in a pass clear their flags
+ */
 
-    if (sx1509_int_flag) {
-        if ((millis() - sx1509_int_pin_last_trig) > sw_debounce_time) {
-            sx1509_int_flag = false;
-            sx1509_input_handler();
-            sx1509_int_pin_last_trig = millis();
-        }
-    }
+bool shift_op()
+{
+    return enc0_sw_flag || enc0_knob_flag || enc1_sw_flag || enc1_knob_flag || enc2_sw_flag || enc2_knob_flag || sx1509_int_flag;
+}
 
-    shift_op = false;
+void loop()
+{
+#ifdef LOOP_PROFILE
+    profile_pass();
+#endif // LOOP_PROFILE
+    tasks_run(); // every handler is a task, see tasks.ino
 }
\ No newline at end of file
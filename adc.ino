@@ -0,0 +1,105 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// The potentiometers are read in the background rather than with analogRead(), which waits the ~110us a conversion
+// takes. Every ADC conversion complete interrupt picks up the sample of one pot, points the multiplexer at the next pot
+// and starts the next conversion, so the ADC is never idle and loop() never waits for it. Each pot's samples are
+// summed and once every pot has been sampled 1 << ADC_OVERSAMPLE_SHIFT times the averages are published, a fresh set
+// every ~3.3ms. The averages take out most of the noise, analog_potentiometer_handler() adds hysteresis on top.
+
+volatile adc_scan_t adc_scan;
+
+/*
+ * Function: adc_select
+ * Description: points the multiplexer at a pot and starts converting it, AVcc is the reference as with analogRead()
+ */
+
+void adc_select(uint8_t pot)
+{
+    ADMUX = (1 << REFS0) | pgm_read_byte(&adc_pot_channels[pot]);
+    ADCSRA |= (1 << ADSC);
+}
+
+/*
+ * Function: adc_begin
+ * Description: starts the background scan and waits for its first averages, blocks for a few milliseconds so only call it from setup(),
+ *    after which analogRead() can no longer be used
+ */
+
+void adc_begin()
+{
+    DIDR0 = 0;
+    for (uint8_t i = 0; i < ADC_POT_CT; i++) {
+        DIDR0 |= (1 << pgm_read_byte(&adc_pot_channels[i])); // the digital input buffers only draw current on analog levels
+    }
+    ADCSRB = 0;
+    ADCSRA = (1 << ADEN) | (1 << ADIF) | (1 << ADIE) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0); // clk/128, 125kHz, 104us per conversion
+    adc_scan.channel = 0;
+    adc_select(0);
+    while (!adc_scan.ready) {
+        sleep_mode(); // idle until the next interrupt, the ADC interrupt publishes the averages
+    }
+}
+
+/*
+ * Function: adc_pot_value
+ * Description: latest average of a pot
+ * Input:
+ *    pot - 0 to ADC_POT_CT - 1
+ * Output:
+ *    0-1023, as analogRead() would return it
+ */
+
+uint16_t adc_pot_value(uint8_t pot)
+{
+    noInterrupts();
+    uint16_t value = adc_scan.value[pot];
+    interrupts();
+    return value;
+}
+
+/*
+ * Function: adc_take_round
+ * Description: checks for new averages since the last call
+ * Output:
+ *    true if a round has been published since
+ */
+
+bool adc_take_round()
+{
+    noInterrupts();
+    bool fresh = adc_scan.fresh;
+    adc_scan.fresh = false;
+    interrupts();
+    return fresh;
+}
+
+// ADC conversion complete, one sample of one pot
+ISR (ADC_vect)
+{
+    uint8_t pot = adc_scan.channel;
+
+    adc_scan.sum[pot] += ADC;
+    if (++pot >= ADC_POT_CT) {
+        pot = 0;
+        if (++adc_scan.round >= (1 << ADC_OVERSAMPLE_SHIFT)) {
+            for (uint8_t i = 0; i < ADC_POT_CT; i++) {
+                adc_scan.value[i] = adc_scan.sum[i] >> ADC_OVERSAMPLE_SHIFT;
+                adc_scan.sum[i] = 0;
+            }
+            adc_scan.round = 0;
+            adc_scan.ready = true;
+            adc_scan.fresh = true;
+        }
+    }
+    adc_scan.channel = pot;
+    adc_select(pot);
+}
@@ -0,0 +1,369 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// The clock engine runs Timer1 free-running and reschedules the OCR1A compare match on every engine tick.
+// Engine ticks happen CLOCK_PPQN * notes-per-beat times per beat, so a MIDI clock pulse lands every
+// notes-per-beat ticks and a sequencer step every CLOCK_PPQN ticks, both exactly on the same grid.
+// The fractional part of the tick period is carried over in a phase accumulator so the average rate has no drift.
+//
+// The tempo is set in tenths of a BPM and turned into a tick period with a single integer division per change, nothing
+// is divided per tick. A change can also glide in over a number of bars: the period then moves by a fixed Q16.16 step
+// on every engine tick and lands exactly on the new period when the ramp is over. The steps are even in the period
+// rather than in BPM, which bends the curve slightly, 120 to 140 BPM passes 129.2 rather than 130 halfway through.
+//
+// The engine can also follow an external MIDI clock. MIDI Start or Continue arms it and the next clock pulse starts it,
+// from then on every pulse is time stamped in the UART receive interrupt and compared against the time the engine has
+// scheduled for the matching tick. A phase-locked loop nudges the next compare match by a fraction of that error and
+// the tick period by a smaller fraction, so the steps follow the average tempo of the clock rather than the jitter of
+// individual pulses. If pulses stop arriving the engine runs on at the last tempo for CLOCK_SYNC_HOLDOVER pulses and
+// then waits for the clock to come back, after CLOCK_SYNC_LOST_MS without a pulse the sequencer stops.
+//
+// The OCR1B compare match belongs to the note scheduler, see schedule.ino, every engine tick arms it for the notes due within the tick.
+
+volatile clock_engine_t seq_clock;
+
+/*
+ * Function: clock_engine_init
+ * Description: sets up Timer1 as a free-running counter, the engine itself is started by clock_engine_start()
+ */
+
+void clock_engine_init()
+{
+    noInterrupts();
+    TCCR1A = 0; // normal mode, OC1A/OC1B pins disconnected
+    TCNT1 = 0;
+    TIMSK1 = 0; // engine ticks are enabled by clock_engine_start()
+    TCCR1B = (1 << CS11) | (1 << CS10); // clk/64, always counting so incoming MIDI clock can be time stamped
+    interrupts();
+}
+
+/*
+ * Function: clock_engine_set_tempo
+ * Description: converts a tempo into an engine tick period, takes effect on the next engine tick or glides in from there
+ * Input:
+ *    tempo - tenths of a BPM (450-3000)
+ *    npb - notes per beat, i.e. sequencer steps per quarter note
+ *    ramp_bars - bars to glide to the new tempo over while the engine runs on its own tempo, 0 == straight away.
+ *       A change of notes per beat always takes effect straight away
+ */
+
+void clock_engine_set_tempo(uint16_t tempo, uint8_t npb, uint8_t ramp_bars)
+{
+    // CLOCK_TIMER_HZ * 60 * TEMPO_SCALE / CLOCK_PPQN is a whole number, dividing it out first keeps the numerator within 32 bits
+    uint32_t period = (((uint32_t) CLOCK_TIMER_HZ * 60UL * TEMPO_SCALE / CLOCK_PPQN) << CLOCK_PERIOD_FRAC_BITS) / ((uint32_t) tempo * npb);
+
+    noInterrupts();
+    seq_clock.tempo_period = period;
+    seq_clock.ramp_ticks = 0;
+    if (seq_clock.sync == CLOCK_SYNC_INTERNAL) {
+        if (seq_clock.running && (ramp_bars > 0) && (seq_clock.ticks_per_clock == npb)) {
+            seq_clock.ramp_ticks = (uint16_t) ramp_bars * TRACK_BAR_BEATS * CLOCK_PPQN * npb;
+            seq_clock.ramp_period = seq_clock.period << 8;
+            seq_clock.ramp_step = ((int32_t) (period << 8) - (int32_t) seq_clock.ramp_period) / seq_clock.ramp_ticks;
+        } else {
+            seq_clock.period = period;
+        }
+    } else {
+        seq_clock.period = seq_clock.period * seq_clock.ticks_per_clock / npb; // the tempo is the external clock's, only the division changes
+    }
+    if (seq_clock.ticks_per_clock != npb) {
+        seq_clock.ticks_per_clock = npb;
+        seq_clock.clock_div %= npb; // keep the pulse counter in range for the new division
+    }
+    interrupts();
+}
+
+/*
+ * Function: clock_engine_run
+ * Description: resets the tick counters and schedules the first engine tick one tick period after now, interrupts must be disabled when calling this
+ * Input:
+ *    now - Timer1 count the engine starts at
+ */
+
+void clock_engine_run(uint16_t now)
+{
+    seq_clock.phase = 0;
+    seq_clock.clock_div = 0;
+    seq_clock.step_div = 0;
+    seq_clock.pending_steps = 0;
+    seq_clock.ticks = 0;
+    seq_clock.step_tick = 0;
+    seq_clock.tick_time = now;
+    seq_clock.running = true;
+    schedule_clear();
+    OCR1A = now + (uint16_t) (seq_clock.period >> CLOCK_PERIOD_FRAC_BITS);
+    TIFR1 = (1 << OCF1A);
+    TIMSK1 |= (1 << OCIE1A);
+}
+
+/*
+ * Function: clock_engine_start
+ * Description: starts the engine on the internal tempo, the first MIDI clock pulse goes out one pulse period later
+ */
+
+void clock_engine_start()
+{
+    noInterrupts();
+    seq_clock.sync = CLOCK_SYNC_INTERNAL;
+    seq_clock.period = seq_clock.tempo_period;
+    seq_clock.ramp_ticks = 0; // a ramp left over from the last run is skipped, the engine starts on the new tempo
+    clock_engine_run(TCNT1);
+    interrupts();
+}
+
+/*
+ * Function: clock_engine_stop
+ * Description: stops the engine ticks and drops any steps that have not been played yet, also stops following an external clock
+ */
+
+void clock_engine_stop()
+{
+    noInterrupts();
+    TIMSK1 &= ~(1 << OCIE1A);
+    seq_clock.running = false;
+    seq_clock.pending_steps = 0;
+    seq_clock.sync = CLOCK_SYNC_INTERNAL;
+    schedule_clear();
+    interrupts();
+}
+
+/*
+ * Function: clock_engine_midi_transport
+ * Description: handles a MIDI Start, Continue or Stop, called from the UART receive interrupt. Start and Continue arm the engine to
+ *    follow the external clock from the next pulse on, the rest of the sequencer catches up in loop() through clock_engine_take_transport()
+ * Input:
+ *    cmd - MIDI_START, MIDI_CONTINUE or MIDI_STOP
+ */
+
+void clock_engine_midi_transport(uint8_t cmd)
+{
+    TIMSK1 &= ~(1 << OCIE1A);
+    seq_clock.running = false;
+    seq_clock.pending_steps = 0;
+    seq_clock.ramp_ticks = 0;
+    schedule_clear();
+    if (cmd == MIDI_STOP) {
+        seq_clock.sync = CLOCK_SYNC_INTERNAL;
+    } else {
+        seq_clock.sync = (cmd == MIDI_START) ? CLOCK_SYNC_ARMED_START : CLOCK_SYNC_ARMED_CONTINUE;
+    }
+    seq_clock.transport = cmd;
+}
+
+/*
+ * Function: clock_engine_midi_clock
+ * Description: handles a MIDI clock pulse, called from the UART receive interrupt
+ * Input:
+ *    now - Timer1 count when the pulse was received
+ */
+
+void clock_engine_midi_clock(uint16_t now)
+{
+    uint32_t ms = millis();
+    bool in_time = (ms - seq_clock.pulse_ms) < CLOCK_SYNC_PULSE_MS;
+    uint16_t interval = now - seq_clock.pulse_time;
+    uint8_t npb = seq_clock.ticks_per_clock;
+
+    seq_clock.pulse_time = now;
+    seq_clock.pulse_ms = ms;
+
+    if ((seq_clock.sync == CLOCK_SYNC_ARMED_START) || (seq_clock.sync == CLOCK_SYNC_ARMED_CONTINUE)) {
+        // start on the tempo measured while stopped if there is one, otherwise the loop pulls in from the internal tempo
+        seq_clock.period = (seq_clock.pulse_period > 0) ? (seq_clock.pulse_period / npb) : seq_clock.tempo_period;
+        clock_engine_run(now);
+        if (seq_clock.sync == CLOCK_SYNC_ARMED_START) {
+            seq_clock.pending_steps = 1; // the first pulse after a Start is the downbeat, play the first step on it
+        }
+        seq_clock.sync = CLOCK_SYNC_EXTERNAL;
+        seq_clock.pulses = 0;
+        seq_clock.acquire = CLOCK_SYNC_ACQUIRE;
+        return;
+    }
+
+    if (seq_clock.sync != CLOCK_SYNC_EXTERNAL) {
+        // not following yet, keep a smoothed estimate of the tempo for when we are started
+        if (!in_time) {
+            seq_clock.pulse_period = 0;
+        } else if (seq_clock.pulse_period == 0) {
+            seq_clock.pulse_period = (uint32_t) interval << CLOCK_PERIOD_FRAC_BITS;
+        } else {
+            seq_clock.pulse_period += (int32_t) (((uint32_t) interval << CLOCK_PERIOD_FRAC_BITS) - seq_clock.pulse_period) / 8;
+        }
+        return;
+    }
+
+    seq_clock.pulses++;
+    int32_t behind = (int32_t) (seq_clock.pulses * npb - seq_clock.ticks);
+    if ((behind > 2 * npb) || (behind < -2 * npb)) {
+        // pulses were lost or the engine stalled in holdover, the engine's own position is the best guess of where we are
+        seq_clock.pulses = (seq_clock.ticks + npb / 2) / npb;
+        behind = (int32_t) (seq_clock.pulses * npb - seq_clock.ticks);
+    }
+    if ((seq_clock.acquire == CLOCK_SYNC_ACQUIRE) && in_time) {
+        seq_clock.period = ((uint32_t) interval << CLOCK_PERIOD_FRAC_BITS) / npb; // first interval after the start, jump straight to it
+    }
+
+    // time the engine has scheduled for this pulse's tick, relative to the next compare match which is tick ticks + 1
+    int32_t err = (int16_t) (now - OCR1A) - (((behind - 1) * (int32_t) seq_clock.period) >> CLOCK_PERIOD_FRAC_BITS);
+    int32_t limit = (seq_clock.period * npb) >> (CLOCK_PERIOD_FRAC_BITS + 1);
+    err = constrain(err, -limit, limit); // a pulse more than half a pulse off is a glitch, don't let it throw the loop
+
+    // positive error, the pulse came later than the engine expected it, so the engine is running fast
+    bool locked = (seq_clock.acquire == 0);
+    uint16_t next = OCR1A + (err >> (locked ? CLOCK_PLL_PHASE_LOCKED : CLOCK_PLL_PHASE_ACQUIRE));
+    if ((int16_t) (next - TCNT1) < 2) {
+        next = TCNT1 + 2; // the tick is overdue now, take it straight away
+    }
+    OCR1A = next;
+    seq_clock.period += err * (1 << (CLOCK_PERIOD_FRAC_BITS - (locked ? CLOCK_PLL_FREQ_LOCKED : CLOCK_PLL_FREQ_ACQUIRE))) / npb;
+    if (!locked) {
+        seq_clock.acquire--;
+    }
+}
+
+/*
+ * Function: clock_engine_take_transport
+ * Description: hands the last MIDI Start, Continue or Stop over to loop(), or a Stop if a followed clock has gone missing
+ * Output:
+ *    MIDI_START, MIDI_CONTINUE, MIDI_STOP or 0 if nothing happened
+ */
+
+uint8_t clock_engine_take_transport()
+{
+    noInterrupts();
+    uint8_t cmd = seq_clock.transport;
+    seq_clock.transport = 0;
+    if ((cmd == 0) && (seq_clock.sync == CLOCK_SYNC_EXTERNAL) && ((millis() - seq_clock.pulse_ms) > CLOCK_SYNC_LOST_MS)) {
+        TIMSK1 &= ~(1 << OCIE1A);
+        seq_clock.running = false;
+        seq_clock.pending_steps = 0;
+        seq_clock.sync = CLOCK_SYNC_INTERNAL;
+        schedule_clear();
+        cmd = MIDI_STOP;
+    }
+    interrupts();
+    return cmd;
+}
+
+/*
+ * Function: clock_engine_running
+ * Description: true while the engine is ticking, ticks are only meaningful then
+ */
+
+bool clock_engine_running()
+{
+    return seq_clock.running;
+}
+
+/*
+ * Function: clock_engine_ticks
+ * Description: engine ticks since the sequencer was started
+ */
+
+uint32_t clock_engine_ticks()
+{
+    noInterrupts();
+    uint32_t ticks = seq_clock.ticks;
+    interrupts();
+    return ticks;
+}
+
+/*
+ * Function: clock_engine_step_tick
+ * Description: engine tick at which the most recent sequencer step became due, gates are timed from here rather than from when loop() got to the step
+ */
+
+uint32_t clock_engine_step_tick()
+{
+    noInterrupts();
+    uint32_t ticks = seq_clock.step_tick;
+    interrupts();
+    return ticks;
+}
+
+#ifdef LOOP_PROFILE
+/*
+ * Function: clock_engine_step_time
+ * Description: Timer1 count the most recent sequencer step became due at
+ */
+
+uint16_t clock_engine_step_time()
+{
+    noInterrupts();
+    uint16_t time = seq_clock.step_time;
+    interrupts();
+    return time;
+}
+#endif // LOOP_PROFILE
+
+/*
+ * Function: clock_engine_take_step
+ * Description: consumes one pending sequencer step, if there is one
+ * Input:
+ *    tick - set to the engine tick the step became due on, which is further back than the last step when loop() has fallen behind
+ * Output:
+ *    true if a step was due and should be played now
+ */
+
+bool clock_engine_take_step(uint32_t *tick)
+{
+    bool step_due = false;
+
+    noInterrupts();
+    if (seq_clock.pending_steps > 0) {
+        *tick = seq_clock.step_tick - (uint32_t) (seq_clock.pending_steps - 1) * CLOCK_PPQN;
+        seq_clock.pending_steps--;
+        step_due = true;
+    }
+    interrupts();
+    return step_due;
+}
+
+// Timer1 compare match A, one engine tick
+ISR (TIMER1_COMPA_vect)
+{
+    // schedule the next tick relative to this compare match rather than to now, so interrupt latency never accumulates
+    uint16_t tick_time = OCR1A;
+    uint16_t frac = seq_clock.phase + (uint8_t) seq_clock.period;
+    seq_clock.phase = (uint8_t) frac;
+    OCR1A += (uint16_t) (seq_clock.period >> CLOCK_PERIOD_FRAC_BITS) + (frac >> CLOCK_PERIOD_FRAC_BITS);
+
+    if (seq_clock.ramp_ticks > 0) {
+        if (--seq_clock.ramp_ticks == 0) {
+            seq_clock.period = seq_clock.tempo_period;
+        } else {
+            seq_clock.ramp_period += seq_clock.ramp_step;
+            seq_clock.period = seq_clock.ramp_period >> 8;
+        }
+    }
+
+    if (seq_clock.sync == CLOCK_SYNC_EXTERNAL) {
+        if (seq_clock.ticks >= ((seq_clock.pulses + CLOCK_SYNC_HOLDOVER) * seq_clock.ticks_per_clock)) {
+            return; // the clock has dropped out for longer than the holdover, wait for it
+        }
+    } else if (++seq_clock.clock_div >= seq_clock.ticks_per_clock) {
+        seq_clock.clock_div = 0;
+        midi_send_realtime(MIDI_CLOCK);
+    }
+    seq_clock.ticks++;
+    seq_clock.tick_time = tick_time;
+    schedule_arm(); // notes due before the next tick
+
+    if (++seq_clock.step_div >= CLOCK_PPQN) {
+        seq_clock.step_div = 0;
+        seq_clock.step_tick = seq_clock.ticks;
+#ifdef LOOP_PROFILE
+        seq_clock.step_time = tick_time;
+#endif // LOOP_PROFILE
+        if (seq_clock.pending_steps < 0xFF) {
+            seq_clock.pending_steps++; // the step itself is played from loop()
+        }
+    }
+}
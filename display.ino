@@ -0,0 +1,154 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Drawing only ever touches matrix.displaybuffer in RAM, the LED backpack itself is updated by display_flush()
+// which runs once at the end of every loop() pass. It compares the buffer against a shadow copy of what was last
+// sent and only writes the display RAM bytes that changed, so an unchanged frame costs no I2C traffic at all.
+// The writes go through the TWI queue at display priority, so they never hold up a key scan for long.
+
+uint16_t display_shadow[8]; // what the HT16K33 display RAM currently holds
+bool display_full_refresh = true; // the shadow can't be trusted until the whole display RAM has been written once
+unsigned long display_last_flush = 0;
+uint8_t display_tx[16 + TWI_QUEUE_LEN]; // {RAM address, data...} for each run of a flush, at most one run per queue slot
+volatile uint8_t display_in_flight = 0; // transactions of the last flush that are still queued or on the bus
+
+// bootup banner, "ARDSEQUINO" in the 5x7 font of the Adafruit GFX library, one byte per column with bit 0 at the top
+const PROGMEM uint8_t boot_banner[] = {
+    0x7C, 0x12, 0x11, 0x12, 0x7C, 0x00, // A
+    0x7F, 0x09, 0x19, 0x29, 0x46, 0x00, // R
+    0x7F, 0x41, 0x41, 0x41, 0x3E, 0x00, // D
+    0x26, 0x49, 0x49, 0x49, 0x32, 0x00, // S
+    0x7F, 0x49, 0x49, 0x49, 0x41, 0x00, // E
+    0x3E, 0x41, 0x51, 0x21, 0x5E, 0x00, // Q
+    0x3F, 0x40, 0x40, 0x40, 0x3F, 0x00, // U
+    0x00, 0x41, 0x7F, 0x41, 0x00, 0x00, // I
+    0x7F, 0x04, 0x08, 0x10, 0x7F, 0x00, // N
+    0x3E, 0x41, 0x41, 0x41, 0x3E, 0x00, // O
+};
+
+/*
+ * Function: display_begin
+ * Description: switches on the HT16K33 oscillator and display at full brightness, blocks until done so only call it from setup()
+ * Output:
+ *    false if the HT16K33 did not acknowledge
+ */
+
+bool display_begin()
+{
+    const uint8_t osc_on[] = {HT16K33_OSC_ON};
+    const uint8_t display_on[] = {HT16K33_DISPLAY_ON};
+    const uint8_t brightness[] = {HT16K33_BRIGHTNESS_MAX};
+
+    if (twi_transfer(HT16K33_ADDR, osc_on, 1, NULL, 0) != TWI_OK) {
+        return false;
+    }
+    twi_transfer(HT16K33_ADDR, display_on, 1, NULL, 0);
+    twi_transfer(HT16K33_ADDR, brightness, 1, NULL, 0);
+    display_invalidate(); // display RAM contents are unknown until the first full flush
+    return true;
+}
+
+/*
+ * Function: draw_banner
+ * Description: draws the bootup banner with its left edge at column x, used to scroll it across the display
+ * Input:
+ *    x - column of the first banner column, may be negative
+ */
+
+void draw_banner(int16_t x)
+{
+    for (uint8_t col = 0; col < sizeof(boot_banner); col++) {
+        uint8_t line = pgm_read_byte(&boot_banner[col]);
+        for (uint8_t row = 0; row < 8; row++) {
+            if (line & (1 << row)) {
+                matrix.drawPixel(x + col, row, LED_ON);
+            }
+        }
+    }
+}
+
+/*
+ * Function: display_invalidate
+ * Description: forces the next display_flush() to rewrite the whole display RAM
+ */
+
+void display_invalidate()
+{
+    display_full_refresh = true;
+}
+
+void display_flush_done(uint8_t status)
+{
+    if (status != TWI_OK) {
+        display_invalidate(); // some bytes might not have made it, rewrite everything next time
+    }
+    display_in_flight--;
+}
+
+/*
+ * Function: display_flush
+ * Description: queues the bytes of matrix.displaybuffer that differ from the LED backpack, at most once every DISPLAY_FRAME_MS and only once the previous flush has gone out
+ * Input:
+ *    force - true == ignore the frame rate cap, used during bootup where the frames are paced by delay()
+ */
+
+void display_flush(bool force)
+{
+    if ((display_in_flight > 0) || (!force && ((millis() - display_last_flush) < DISPLAY_FRAME_MS))) {
+        return;
+    }
+
+    // display RAM byte 2n holds columns 0-7 of row n and byte 2n+1 columns 8-15, which is the in-memory layout of displaybuffer on the AVR
+    const uint8_t *frame = (const uint8_t *) matrix.displaybuffer;
+    uint8_t *shadow = (uint8_t *) display_shadow;
+    uint8_t runs = 0;
+    uint8_t len = 0;
+    uint8_t addr = 0;
+    uint8_t last = 16; // last byte that changed
+
+    for (uint8_t i = 0; i < 16; i++) {
+        if (display_full_refresh || (frame[i] != shadow[i])) {
+            last = i;
+        }
+    }
+    if (last == 16) {
+        return;
+    }
+
+    while (addr <= last) {
+        if (!display_full_refresh && (frame[addr] == shadow[addr])) {
+            addr++;
+            continue;
+        }
+        // extend the run over a single unchanged byte, resending it is cheaper than starting another transaction,
+        // and let the last run that still fits in the queue cover everything that is left
+        uint8_t end = addr + 1;
+        if (runs == (TWI_QUEUE_LEN - 1)) {
+            end = last + 1;
+        }
+        while ((end <= last) && (display_full_refresh || (frame[end] != shadow[end]) || (frame[end + 1] != shadow[end + 1]))) {
+            end++;
+        }
+        uint8_t *run = &display_tx[len];
+        display_tx[len++] = addr; // display RAM pointer, auto-increments after every byte
+        for (; addr < end; addr++) {
+            display_tx[len++] = frame[addr];
+            shadow[addr] = frame[addr];
+        }
+        noInterrupts();
+        display_in_flight++;
+        interrupts();
+        twi_queue_transaction(TWI_PRIO_DISPLAY, HT16K33_ADDR, run, &display_tx[len] - run, NULL, 0, display_flush_done);
+        runs++;
+    }
+
+    display_full_refresh = false;
+    display_last_flush = millis();
+}
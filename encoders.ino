@@ -0,0 +1,94 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// The encoders are decoded in their pin change interrupts rather than from loop(). Each interrupt takes one snapshot
+// of the port and runs the Gray code state machine of every encoder on it, so a transition is counted as soon as it
+// happens however long loop() is busy for, and loop() picks up whole detents whenever it gets to them.
+// A detent that comes quickly after one in the same direction counts for more than one step, ENCODER_ACCEL_MS / gap
+// times up to ENCODER_ACCEL_MAX, so a flick of the knob crosses a long range while slow turns still go one at a time.
+// The raw detents are kept alongside, for settings with only a handful of values where skipping any would be a nuisance.
+
+volatile encoder_t encoders[ENCODER_CT];
+
+/*
+ * Function: encoder_begin
+ * Description: seeds the state machines with the current channel levels, call it from setup() before the pin change interrupts are enabled
+ */
+
+void encoder_begin()
+{
+    uint8_t pind = PIND;
+    uint8_t pinb = PINB;
+
+    encoders[0].ab = (fast_pin<NANO_enc0_ch0>::read(pind) << 1) | fast_pin<NANO_enc0_ch1>::read(pind);
+    encoders[1].ab = (fast_pin<NANO_enc1_ch0>::read(pind) << 1) | fast_pin<NANO_enc1_ch1>::read(pind);
+    encoders[2].ab = (fast_pin<NANO_enc2_ch0>::read(pinb) << 1) | fast_pin<NANO_enc2_ch1>::read(pinb);
+}
+
+/*
+ * Function: encoder_decode
+ * Description: runs an encoder's state machine on a new sample of its channels, called from the pin change interrupts
+ * Input:
+ *    enc_num - encoder, valid values 0-2
+ *    ab - channel levels, ch0 << 1 | ch1
+ * Output:
+ *    true if a detent has been completed
+ */
+
+bool encoder_decode(uint8_t enc_num, uint8_t ab)
+{
+    volatile encoder_t *enc = &encoders[enc_num];
+
+    if (ab == (enc->ab & 0x03)) {
+        return false; // another pin on the same port changed
+    }
+    enc->ab = ((enc->ab << 2) | ab) & 0x0F;
+    enc->edges += (int8_t) pgm_read_byte(&enc_states[enc->ab]);
+    if ((enc->edges < ENCODER_EDGES) && (enc->edges > -ENCODER_EDGES)) {
+        return false;
+    }
+
+    int8_t dir = (enc->edges > 0) ? 1 : -1;
+    uint16_t now = millis();
+    uint16_t gap = now - enc->last_detent;
+    uint8_t weight = 1;
+
+    if ((dir == enc->dir) && (gap < ENCODER_ACCEL_MS)) {
+        weight = (gap <= (ENCODER_ACCEL_MS / ENCODER_ACCEL_MAX)) ? ENCODER_ACCEL_MAX : (ENCODER_ACCEL_MS / gap);
+    }
+    enc->edges = 0;
+    enc->dir = dir;
+    enc->last_detent = now;
+    enc->detents += dir;
+    enc->steps += dir * weight;
+    return true;
+}
+
+/*
+ * Function: encoder_take
+ * Description: takes the detents an encoder has turned since the last call
+ * Input:
+ *    enc_num - encoder, valid values 0-2
+ *    detents - set to the number of detents turned, + clockwise
+ * Output:
+ *    the detents scaled up by acceleration, + clockwise
+ */
+
+int16_t encoder_take(uint8_t enc_num, int8_t *detents)
+{
+    noInterrupts();
+    int16_t steps = encoders[enc_num].steps;
+    *detents = encoders[enc_num].detents;
+    encoders[enc_num].steps = 0;
+    encoders[enc_num].detents = 0;
+    interrupts();
+    return steps;
+}
@@ -0,0 +1,111 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LED_MATRIX_H
+#define LED_MATRIX_H
+
+#define LED_ON 1
+#define LED_OFF 0
+
+// Framebuffer for the 16x8 HT16K33 LED backpack. It keeps the drawing calls and the displaybuffer layout of
+// Adafruit_8x16matrix, but never touches I2C itself, display.ino pushes displaybuffer out through the TWI queue.
+typedef struct led_matrix {
+    uint16_t displaybuffer[8] = {0}; // one word per row, bit n is column n
+    uint8_t rotation = 0;
+
+    void setRotation(uint8_t r)
+    {
+        rotation = r & 3;
+    }
+
+    void clear()
+    {
+        memset(displaybuffer, 0, sizeof(displaybuffer));
+    }
+
+    void drawPixel(int16_t x, int16_t y, uint16_t color)
+    {
+        int16_t t;
+        switch (rotation) {
+            case 0:
+                t = x; x = y; y = 8 - t - 1;
+                break;
+            case 2:
+                t = x; x = 16 - y - 1; y = t;
+                break;
+            case 3:
+                x = 16 - x - 1;
+                y = 8 - y - 1;
+                break;
+            default:
+                break;
+        }
+        if ((x < 0) || (x >= 16) || (y < 0) || (y >= 8)) {
+            return;
+        }
+        if (color) {
+            displaybuffer[y] |= (1 << x);
+        } else {
+            displaybuffer[y] &= ~(1 << x);
+        }
+    }
+
+    void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color)
+    {
+        int16_t dx = abs(x1 - x0), sx = (x0 < x1) ? 1 : -1;
+        int16_t dy = -abs(y1 - y0), sy = (y0 < y1) ? 1 : -1;
+        int16_t err = dx + dy;
+        for (;;) {
+            drawPixel(x0, y0, color);
+            if ((x0 == x1) && (y0 == y1)) {
+                break;
+            }
+            int16_t e2 = 2 * err;
+            if (e2 >= dy) { err += dy; x0 += sx; }
+            if (e2 <= dx) { err += dx; y0 += sy; }
+        }
+    }
+
+    void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+    {
+        for (int16_t i = x; i < x + w; i++) {
+            for (int16_t j = y; j < y + h; j++) {
+                drawPixel(i, j, color);
+            }
+        }
+    }
+
+    // bitmaps are rows of MSB-first bytes, a const pointer is read from PROGMEM and a non-const one from RAM
+    void drawBitmap(int16_t x, int16_t y, const uint8_t *bitmap, int16_t w, int16_t h, uint16_t color)
+    {
+        int16_t byte_width = (w + 7) / 8;
+        for (int16_t j = 0; j < h; j++) {
+            for (int16_t i = 0; i < w; i++) {
+                if (pgm_read_byte(&bitmap[j * byte_width + i / 8]) & (0x80 >> (i & 7))) {
+                    drawPixel(x + i, y + j, color);
+                }
+            }
+        }
+    }
+
+    void drawBitmap(int16_t x, int16_t y, uint8_t *bitmap, int16_t w, int16_t h, uint16_t color)
+    {
+        int16_t byte_width = (w + 7) / 8;
+        for (int16_t j = 0; j < h; j++) {
+            for (int16_t i = 0; i < w; i++) {
+                if (bitmap[j * byte_width + i / 8] & (0x80 >> (i & 7))) {
+                    drawPixel(x + i, y + j, color);
+                }
+            }
+        }
+    }
+} led_matrix_t;
+
+#endif // LED_MATRIX_H
@@ -0,0 +1,394 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Parameter locks. A lock sets the velocity, note, probability or a CC value of one key on one step of a pattern, in
+// place of the key's own setting. Locks live in a small table shared by all patterns rather than next to every step, so
+// they only take up memory once they are set. The table is kept sorted by pattern, step, key and parameter, which puts
+// the locks of a step next to each other. The sequencer and every per-key track keep a cursor into the table that moves
+// along with their steps, so finding the locks of the next step is a step or two from where the last one was, and
+// only a wrap of the pattern walks the cursor back over the locks of the pattern once.
+// The probability lock is looked at when a step is scheduled, the others when its notes go out. Queued notes carry the
+// index of their key's first lock on the step, and the indexes are moved along whenever a lock is added or removed.
+// Holding a key in DETAILED_PARAM_MODE holds the step the key was hit on, see record_step(), and the encoders edit the
+// key's locks on that step instead of its settings: the note, shift for the CC value, the probability and the velocity.
+// The encoder 0 switch removes them again. A lock only goes on a step the key plays on, and taking the key off the
+// step, or restoring the pattern without it, takes its locks off as well, so the table never fills up with locks that
+// can't be heard.
+
+lock_table_t locks;
+
+/*
+ * Function: locks_where
+ * Description: the position of a key's locks on a step in the table order
+ * Input:
+ *    pat_num - pattern, 0 to PATTERN_CT - 1
+ *    step - step, 0 to MAX_SEQUENCER_LENGTH - 1
+ *    key_num - key, 0 for the start of the step
+ */
+
+uint16_t locks_where(uint8_t pat_num, uint16_t step, uint8_t key_num)
+{
+    return (((uint16_t) pat_num * MAX_SEQUENCER_LENGTH + step) << 4) | key_num;
+}
+
+/*
+ * Function: locks_order
+ * Description: the sort key of a lock in the table, its position followed by the parameter
+ * Input:
+ *    where - position of the key on the step, see locks_where()
+ *    param - one of LOCK_*
+ */
+
+uint32_t locks_order(uint16_t where, uint8_t param)
+{
+    return ((uint32_t) where << 8) | param;
+}
+
+/*
+ * Function: locks_seek
+ * Description: moves a cursor to the first lock at or after a position, walking from where the cursor was left
+ * Input:
+ *    cursor - the cursor, left at the lock found
+ *    where - position, see locks_where()
+ * Output:
+ *    index of the lock, locks.count if there is none past the position
+ */
+
+uint8_t locks_seek(uint8_t *cursor, uint16_t where)
+{
+    uint8_t i = min(*cursor, locks.count);
+
+    while ((i > 0) && (locks.lock[i - 1].where >= where)) {
+        i--;
+    }
+    while ((i < locks.count) && (locks.lock[i].where < where)) {
+        i++;
+    }
+    *cursor = i;
+    return i;
+}
+
+/*
+ * Function: locks_key
+ * Description: finds the first lock of a key on a step
+ * Input:
+ *    from - index at or before the key's locks, as returned by locks_seek() for the step
+ *    where - position of the key on the step
+ * Output:
+ *    index of the lock, LOCK_NONE if the key has none on the step
+ */
+
+uint8_t locks_key(uint8_t from, uint16_t where)
+{
+    while ((from < locks.count) && (locks.lock[from].where < where)) {
+        from++;
+    }
+    return ((from < locks.count) && (locks.lock[from].where == where)) ? from : LOCK_NONE;
+}
+
+/*
+ * Function: locks_value
+ * Description: the value a parameter is locked to, called from the note scheduler's interrupt as well
+ * Input:
+ *    first - first lock of the key on the step, as returned by locks_key()
+ *    param - one of LOCK_*
+ *    value - the value to use if the parameter isn't locked
+ */
+
+uint8_t locks_value(uint8_t first, uint8_t param, uint8_t value)
+{
+    if (first == LOCK_NONE) {
+        return value;
+    }
+    for (uint8_t i = first; (i < locks.count) && (locks.lock[i].where == locks.lock[first].where); i++) {
+        if (locks.lock[i].param == param) {
+            return locks.lock[i].value;
+        }
+    }
+    return value;
+}
+
+/*
+ * Function: locks_find
+ * Description: finds where a lock is in the table, or would go if it isn't set
+ * Input:
+ *    where - position of the key on the step, see locks_where()
+ *    param - one of LOCK_*
+ * Output:
+ *    index of the lock, or of the first lock that sorts after it
+ */
+
+uint8_t locks_find(uint16_t where, uint8_t param)
+{
+    uint8_t i = 0;
+
+    while ((i < locks.count) && (locks_order(locks.lock[i].where, locks.lock[i].param) < locks_order(where, param))) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Function: locks_is
+ * Description: whether the lock at an index is the one for a parameter of a key on a step
+ * Input:
+ *    i - index, as returned by locks_find()
+ *    where - position of the key on the step, see locks_where()
+ *    param - one of LOCK_*
+ */
+
+bool locks_is(uint8_t i, uint16_t where, uint8_t param)
+{
+    return (i < locks.count) && (locks.lock[i].where == where) && (locks.lock[i].param == param);
+}
+
+/*
+ * Function: locks_fires
+ * Description: whether the key of a lock position is programmed on its step
+ * Input:
+ *    where - position of the key on the step, see locks_where()
+ */
+
+bool locks_fires(uint16_t where)
+{
+    uint16_t steps = where >> 4;
+
+    return (pattern_step(steps / MAX_SEQUENCER_LENGTH, steps % MAX_SEQUENCER_LENGTH) >> (where & 0x0F)) & 0x0001;
+}
+
+/*
+ * Function: locks_set
+ * Description: sets a lock, adding it to the table if the parameter isn't locked on the step yet
+ * Input:
+ *    where - position of the key on the step, see locks_where()
+ *    param - one of LOCK_*
+ *    value - value to lock the parameter to
+ * Output:
+ *    false if the key doesn't play on the step, if the lock is new and the table is full, or while the settings
+ *    are being restored
+ */
+
+bool locks_set(uint16_t where, uint8_t param, uint8_t value)
+{
+    uint8_t i = locks_find(where, param);
+
+    if (!locks_fires(where) || sysex_restoring_settings()) {
+        return false;
+    }
+    if (locks_is(i, where, param)) {
+        locks.lock[i].value = value;
+        return true;
+    }
+    if (locks.count >= LOCK_MAX) {
+        return false;
+    }
+
+    noInterrupts(); // queued notes look locks up from the scheduler's interrupt
+    memmove(&locks.lock[i + 1], &locks.lock[i], (locks.count - i) * sizeof(param_lock_t));
+    locks.lock[i].where = where;
+    locks.lock[i].param = param;
+    locks.lock[i].value = value;
+    locks.count++;
+    bool first = (i + 1 >= locks.count) || (locks.lock[i + 1].where != where); // the key had no locks on the step yet
+    for (uint8_t e = 0; e < sched.count; e++) {
+        uint8_t *lock = &sched.event[e].lock;
+        if ((*lock == LOCK_NONE) || (*lock < i)) {
+            continue;
+        }
+        *lock = ((*lock == i) && !first) ? i : (*lock + 1); // the new lock comes first among the key's locks on the step
+    }
+    interrupts();
+    return true;
+}
+
+/*
+ * Function: locks_clear
+ * Description: removes every lock of a key on a step
+ * Input:
+ *    where - position of the key on the step, see locks_where()
+ */
+
+void locks_clear(uint16_t where)
+{
+    uint8_t first = locks_key(0, where);
+
+    if (first == LOCK_NONE) {
+        return;
+    }
+    uint8_t end = first;
+    while ((end < locks.count) && (locks.lock[end].where == where)) {
+        end++;
+    }
+
+    noInterrupts();
+    memmove(&locks.lock[first], &locks.lock[end], (LOCK_MAX - end) * sizeof(param_lock_t));
+    for (uint8_t i = LOCK_MAX - (end - first); i < LOCK_MAX; i++) {
+        locks.lock[i].where = LOCK_WHERE_NONE;
+    }
+    locks.count -= end - first;
+    for (uint8_t e = 0; e < sched.count; e++) {
+        uint8_t *lock = &sched.event[e].lock;
+        if ((*lock == LOCK_NONE) || (*lock < first)) {
+            continue;
+        }
+        *lock = (*lock < end) ? LOCK_NONE : (*lock - (end - first));
+    }
+    interrupts();
+}
+
+/*
+ * Function: locks_prune
+ * Description: removes the locks of a pattern whose key no longer plays on their step, called once the pattern has been restored
+ * Input:
+ *    pat_num - pattern, 0 to PATTERN_CT - 1
+ */
+
+void locks_prune(uint8_t pat_num)
+{
+    uint8_t i = 0;
+
+    locks_seek(&i, locks_where(pat_num, 0, 0));
+    while ((i < locks.count) && (locks.lock[i].where < locks_where(pat_num + 1, 0, 0))) {
+        if (locks_fires(locks.lock[i].where)) {
+            i++;
+        } else {
+            locks_clear(locks.lock[i].where); // the rest of the table moves down to i
+        }
+    }
+}
+
+/*
+ * Function: locks_restored
+ * Description: checks the table after it has been loaded from the EEPROM or restored over SysEx, it is cut short at the
+ *    first lock that is out of order or out of range. Queued notes let go of their locks, they may have moved
+ */
+
+void locks_restored()
+{
+    uint8_t n = 0;
+
+    noInterrupts();
+    while ((n < LOCK_MAX) && (locks.lock[n].where < locks_where(PATTERN_CT, 0, 0)) && ((locks.lock[n].where & 0x0F) < MAX_POLYPHONY)
+           && (locks.lock[n].param < LOCK_PARAMS) && (locks.lock[n].value <= 127)
+           && ((locks.lock[n].param != LOCK_PROBABILITY) || ((locks.lock[n].value >= 1) && (locks.lock[n].value <= MAX_PROBABILITY)))
+           && ((locks.lock[n].param != LOCK_VELOCITY) || (locks.lock[n].value >= 1)) // a velocity of 0 would be a note-off
+           && ((n == 0) || (locks_order(locks.lock[n - 1].where, locks.lock[n - 1].param) < locks_order(locks.lock[n].where, locks.lock[n].param)))) {
+        n++;
+    }
+    locks.count = n;
+    for (; n < LOCK_MAX; n++) {
+        locks.lock[n].where = LOCK_WHERE_NONE;
+    }
+    for (uint8_t e = 0; e < sched.count; e++) {
+        sched.event[e].lock = LOCK_NONE;
+    }
+    interrupts();
+}
+
+/*
+ * Function: locks_hold
+ * Description: called when a key is hit in DETAILED_PARAM_MODE, the encoders edit the key's locks on the step until it is released
+ * Input:
+ *    key_num - key that was hit
+ *    pat_num - pattern it was hit in
+ *    step - step it was hit on
+ */
+
+void locks_hold(uint8_t key_num, uint8_t pat_num, uint16_t step)
+{
+    locks.held = locks_where(pat_num, step, key_num);
+}
+
+/*
+ * Function: locks_release
+ * Description: called when a key is released, lets go of the step it held
+ * Input:
+ *    key_num - key that was released
+ */
+
+void locks_release(uint8_t key_num)
+{
+    if ((locks.held != LOCK_WHERE_NONE) && ((locks.held & 0x0F) == key_num)) {
+        locks.held = LOCK_WHERE_NONE;
+    }
+}
+
+/*
+ * Function: locks_holding
+ * Description: whether a key is holding a step, the encoders then edit its locks on the step
+ */
+
+bool locks_holding()
+{
+    return locks.held != LOCK_WHERE_NONE;
+}
+
+/*
+ * Function: locks_encoder
+ * Description: edits the locks of the held key on the held step, a parameter that isn't locked yet starts from the key's own setting.
+ *    When the key doesn't play on the step or the table is full a new lock isn't set and the key's setting is shown instead
+ * Input:
+ *    enc_num - There are 4 rotary encoders, valid values 0-3
+ *    steps - the detents scaled up by how quickly the knob was turned
+ */
+
+void locks_encoder(uint8_t enc_num, int16_t steps)
+{
+    sound_properties_t *key = &key_array[locks.held & 0x0F];
+    const uint8_t *bitmap;
+    uint8_t param;
+    uint8_t value;
+    uint8_t min_val = 1;
+    uint8_t max_val = 127;
+
+    switch (enc_num) {
+        case KIT_ENCODER:
+            if (fast_pin<NANO_sw0_pin>::read() == LOW) { // The CC value sent ahead of the note when shift is held
+                bitmap = enc0_alt_rotate_bmp;
+                param = LOCK_CC;
+                value = LOCK_CC_DEFAULT;
+                min_val = 0;
+            } else { // The note
+                bitmap = enc0_rotate_bmp;
+                param = LOCK_NOTE;
+                value = key->midi_note;
+                min_val = 0;
+                max_val = MAX_MIDI_NOTE;
+                note_stop(locks.held & 0x0F);
+            }
+            break;
+        case SEQUENCE_LENGTH_ENCODER: // The probability
+            bitmap = enc1_rotate_bmp;
+            param = LOCK_PROBABILITY;
+            value = key->probability;
+            max_val = MAX_PROBABILITY;
+            break;
+        case BPM_ENCODER: // The velocity
+            bitmap = enc2_rotate_bmp;
+            param = LOCK_VELOCITY;
+            value = (key->volume > 0) ? key->volume : 1; // a velocity of 0 would be a note-off
+            break;
+        default:
+            return;
+    }
+
+    uint8_t i = locks_find(locks.held, param);
+    if (locks_is(i, locks.held, param)) {
+        value = locks.lock[i].value;
+    }
+    uint8_t locked = value;
+    enc_8bit_val_calc(steps, &locked, max_val, min_val);
+    if (locks_set(locks.held, param, locked)) {
+        value = locked;
+    }
+    matrix.fillRect(0, 0, 16, 6, LED_OFF);
+    draw_image(bitmap);
+    load_bitmap(value);
+}
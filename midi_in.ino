@@ -0,0 +1,131 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// MIDI input. The receive interrupt drops bytes into a ring buffer, they are parsed from loop() by midi_in_handler().
+// Clock and transport messages are the exception, they are handed to the clock engine straight from the interrupt
+// so each clock pulse is time stamped the moment it arrives.
+//
+// The parser works a byte at a time and keeps running status, so it picks up where it left off whatever the stream
+// was split into between loop() passes. SysEx is handed to sysex.ino. A note on or off that matches a key, the key's
+// note on the key's channel, acts as a press or release of that key, playing it with its own settings and recording it
+// into the pattern while recording is on. All other channel messages go straight back out with MIDI_SOFT_THRU defined.
+// They are only handed to the MIDI output once complete, and a message is queued with interrupts off, so they merge
+// with the sequencer's notes on message boundaries and never split one. System common messages are dropped.
+
+midi_in_queue_t midi_in;
+
+/*
+ * Function: midi_in_init
+ * Description: enables the UART receiver and its interrupt, call after midi_out_init() which sets the baud rate
+ */
+
+void midi_in_init()
+{
+    UCSR0B |= (1 << RXEN0) | (1 << RXCIE0);
+}
+
+/*
+ * Function: midi_in_length
+ * Description: data bytes of a channel message
+ */
+
+uint8_t midi_in_length(uint8_t status)
+{
+    return ((status & 0xE0) == 0xC0) ? 1 : 2; // program change and channel pressure have one, the rest two
+}
+
+/*
+ * Function: midi_in_message
+ * Description: handles a complete channel message
+ * Input:
+ *    status - status byte, message type and channel
+ *    data1 - first data byte
+ *    data2 - second data byte, 0 for one data byte messages
+ */
+
+void midi_in_message(uint8_t status, uint8_t data1, uint8_t data2)
+{
+    uint8_t type = status & 0xF0;
+    uint8_t chan = (status & 0x0F) + 1;
+
+    if ((type == MIDI_NOTE_ON) || (type == MIDI_NOTE_OFF)) {
+        for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
+            if ((key_array[i].midi_note == data1) && (key_array[i].midi_chan == chan)) {
+                key_play(i, (type == MIDI_NOTE_ON) && (data2 > 0), clock_engine_ticks(), false); // a note on with velocity 0 is a note off
+                return;
+            }
+        }
+    }
+#ifdef MIDI_SOFT_THRU
+    midi_send_channel(type, chan, data1, data2, midi_in_length(status));
+#endif // MIDI_SOFT_THRU
+}
+
+/*
+ * Function: midi_in_handler
+ * Description: parses everything received since the last call
+ */
+
+void midi_in_handler()
+{
+    while (midi_in.count > 0) {
+        uint8_t data = midi_in.buf[midi_in.head];
+        noInterrupts();
+        midi_in.head = (midi_in.head + 1) & (MIDI_IN_QUEUE_LEN - 1);
+        midi_in.count--;
+        interrupts();
+
+        if (data >= 0xF8) { // real-time bytes can turn up anywhere, even inside SysEx
+            continue;
+        }
+        if (data == MIDI_SYSEX_START) {
+            midi_in.in_sysex = true;
+            midi_in.status = 0;
+            sysex_rx_start();
+        } else if (data == MIDI_SYSEX_END) {
+            if (midi_in.in_sysex) {
+                sysex_rx_end();
+            }
+            midi_in.in_sysex = false;
+        } else if (data & 0x80) {
+            midi_in.in_sysex = false; // any other status byte cuts a SysEx message short
+            midi_in.status = (data < 0xF0) ? data : 0; // system common messages cancel running status, their data bytes are dropped
+            midi_in.len = 0;
+        } else if (midi_in.in_sysex) {
+            sysex_rx_byte(data);
+        } else if (midi_in.status != 0) {
+            midi_in.data[midi_in.len++] = data;
+            if (midi_in.len == midi_in_length(midi_in.status)) {
+                midi_in_message(midi_in.status, midi_in.data[0], (midi_in.len > 1) ? midi_in.data[1] : 0);
+                midi_in.len = 0; // further data bytes are another message under the same running status
+            }
+        }
+    }
+}
+
+// UART receive complete, bytes are dropped if loop() has fallen this far behind
+ISR (USART_RX_vect)
+{
+    uint16_t now = TCNT1; // before anything else, this is the time stamp of a clock pulse
+    bool frame_error = UCSR0A & (1 << FE0); // has to be read before UDR0
+    uint8_t data = UDR0;
+
+    if (frame_error) {
+        return;
+    }
+    if (data == MIDI_CLOCK) {
+        clock_engine_midi_clock(now);
+    } else if ((data == MIDI_START) || (data == MIDI_CONTINUE) || (data == MIDI_STOP)) {
+        clock_engine_midi_transport(data);
+    } else if (midi_in.count < MIDI_IN_QUEUE_LEN) {
+        midi_in.buf[(midi_in.head + midi_in.count) & (MIDI_IN_QUEUE_LEN - 1)] = data;
+        midi_in.count++;
+    }
+}
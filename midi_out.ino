@@ -0,0 +1,173 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// MIDI output through the UART, drained byte by byte from the data register empty interrupt.
+// Real-time messages (clock/start/stop) have their own queue that is always served first. MIDI allows a real-time byte
+// between any two bytes of a channel message, so a clock pulse never waits for more than the byte already on the wire.
+// Channel messages get running status applied as they are queued, the status byte is left out whenever it matches the
+// previous one, so a step full of notes on one channel costs two bytes per note instead of three.
+// SysEx messages are queued whole in one go, the note scheduler's interrupt could otherwise slip a note in between.
+
+midi_out_queue_t midi_out;
+
+/*
+ * Function: midi_out_init
+ * Description: sets the UART up for MIDI, 31250 baud 8N1, transmit only
+ */
+
+void midi_out_init()
+{
+    UBRR0 = (F_CPU / 16 / MIDI_BAUD) - 1;
+    UCSR0A = 0;
+    UCSR0B = (1 << TXEN0);
+    UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+}
+
+/*
+ * Function: midi_send_realtime
+ * Description: queues a single byte real-time message, safe to call from interrupts
+ * Input:
+ *    status - MIDI_CLOCK, MIDI_START or MIDI_STOP
+ */
+
+void midi_send_realtime(uint8_t status)
+{
+    uint8_t sreg = SREG;
+    noInterrupts();
+    if (midi_out.rt_count < MIDI_RT_QUEUE_LEN) { // only fills up if the UART has stopped, dropping is all that is left then
+        midi_out.rt[(midi_out.rt_head + midi_out.rt_count) & (MIDI_RT_QUEUE_LEN - 1)] = status;
+        midi_out.rt_count++;
+        UCSR0B |= (1 << UDRIE0);
+    }
+    SREG = sreg;
+}
+
+/*
+ * Function: midi_out_room
+ * Description: free space in the channel message queue, in bytes
+ */
+
+uint8_t midi_out_room()
+{
+    return MIDI_OUT_QUEUE_LEN - midi_out.count;
+}
+
+/*
+ * Function: midi_queue_channel
+ * Description: queues a channel message without waiting, leaving out the status byte if running status allows it.
+ *    Interrupts must be disabled and the caller has to have made sure there is room for len + 1 bytes, this is what the note scheduler's interrupt sends with
+ * Input:
+ *    status - message type, i.e. MIDI_NOTE_ON
+ *    chan - MIDI channel, 1-16
+ *    data1 - first data byte
+ *    data2 - second data byte, ignored for one data byte messages
+ *    len - number of data bytes, 1 or 2
+ */
+
+void midi_queue_channel(uint8_t status, uint8_t chan, uint8_t data1, uint8_t data2, uint8_t len)
+{
+    status |= (chan - 1) & 0x0F;
+
+    uint8_t tail = midi_out.head + midi_out.count;
+    if (status != midi_out.running_status) {
+        midi_out.buf[tail++ & (MIDI_OUT_QUEUE_LEN - 1)] = status;
+        midi_out.running_status = status;
+    }
+    midi_out.buf[tail++ & (MIDI_OUT_QUEUE_LEN - 1)] = data1 & 0x7F;
+    if (len > 1) {
+        midi_out.buf[tail++ & (MIDI_OUT_QUEUE_LEN - 1)] = data2 & 0x7F;
+    }
+    midi_out.count = tail - midi_out.head;
+    UCSR0B |= (1 << UDRIE0);
+}
+
+void midi_queue_note_off(uint8_t note, uint8_t velocity, uint8_t chan)
+{
+#ifdef MIDI_NOTE_OFF_AS_NOTE_ON
+    if (velocity == 0) {
+        midi_queue_channel(MIDI_NOTE_ON, chan, note, 0, 2);
+        return;
+    }
+#endif // MIDI_NOTE_OFF_AS_NOTE_ON
+    midi_queue_channel(MIDI_NOTE_OFF, chan, note, velocity, 2);
+}
+
+/*
+ * Function: midi_send_channel
+ * Description: queues a channel message, only waits if the queue is full, which takes more than a full step of notes
+ * Input:
+ *    see midi_queue_channel()
+ */
+
+void midi_send_channel(uint8_t status, uint8_t chan, uint8_t data1, uint8_t data2, uint8_t len)
+{
+    // the room is checked with interrupts off, the note scheduler's interrupt queues notes too
+    noInterrupts();
+    while (midi_out_room() < (len + 1)) {
+        interrupts();
+        sleep_mode(); // the UART interrupt frees up space
+        noInterrupts();
+    }
+    midi_queue_channel(status, chan, data1, data2, len);
+    interrupts();
+}
+
+/*
+ * Function: midi_send_raw_block
+ * Description: queues a complete SysEx message behind the channel messages, waiting until there is room for all of it
+ *    so nothing can get queued in the middle. Cancels running status
+ * Input:
+ *    data - the message, from the start byte up to the end byte
+ *    len - its length, no more than MIDI_OUT_QUEUE_LEN
+ */
+
+void midi_send_raw_block(const uint8_t *data, uint8_t len)
+{
+    noInterrupts();
+    while (midi_out_room() < len) {
+        interrupts();
+        sleep_mode();
+        noInterrupts();
+    }
+    uint8_t tail = midi_out.head + midi_out.count;
+    for (uint8_t i = 0; i < len; i++) {
+        midi_out.buf[tail++ & (MIDI_OUT_QUEUE_LEN - 1)] = data[i];
+    }
+    midi_out.count = tail - midi_out.head;
+    midi_out.running_status = 0;
+    UCSR0B |= (1 << UDRIE0);
+    interrupts();
+}
+
+void midi_send_control_change(uint8_t control, uint8_t value, uint8_t chan)
+{
+    midi_send_channel(MIDI_CONTROL_CHANGE, chan, control, value, 2);
+}
+
+void midi_send_program_change(uint8_t program, uint8_t chan)
+{
+    midi_send_channel(MIDI_PROGRAM_CHANGE, chan, program, 0, 1);
+}
+
+// UART data register empty, hands the next byte to the UART or switches itself off once both queues are empty
+ISR (USART_UDRE_vect)
+{
+    if (midi_out.rt_count > 0) {
+        UDR0 = midi_out.rt[midi_out.rt_head];
+        midi_out.rt_head = (midi_out.rt_head + 1) & (MIDI_RT_QUEUE_LEN - 1);
+        midi_out.rt_count--;
+    } else if (midi_out.count > 0) {
+        UDR0 = midi_out.buf[midi_out.head];
+        midi_out.head = (midi_out.head + 1) & (MIDI_OUT_QUEUE_LEN - 1);
+        midi_out.count--;
+    } else {
+        UCSR0B &= ~(1 << UDRIE0);
+    }
+}
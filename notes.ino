@@ -0,0 +1,167 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Every note-on of a key with note-off enabled is recorded in active_notes, and every note-off is sent from there.
+// Keys without note-off keep working as plain triggers and are never tracked.
+// Sequenced notes are gated, they end global_seq.gate percent of a step after they started, counted in clock engine ticks.
+// Keys with a track of their own have steps of their own length, so every gated note keeps its own end tick.
+// A sequenced note plays the note and velocity its step has locked, if any, see locks.ino.
+// They are started from the note scheduler's interrupt (see schedule.ino), so active_notes is only ever changed with
+// interrupts disabled and the MIDI bytes are queued in the same go, the note-off of a key can never end up behind a
+// note-on the interrupt queued for it in the meantime.
+
+note_tracker_t active_notes;
+
+/*
+ * Function: notes_gate_ticks
+ * Description: length of the gate of a key's sequenced notes, in clock engine ticks
+ */
+
+uint8_t notes_gate_ticks(uint8_t key_num)
+{
+    uint8_t gate_ticks = ((uint16_t) global_seq.gate * key_array[key_num].rate) / MAX_GATE; // the rate is CLOCK_PPQN for keys without a track of their own
+
+    return (gate_ticks > 0) ? gate_ticks : 1;
+}
+
+/*
+ * Function: note_end
+ * Description: queues the note-off for the note a key is sounding without waiting, interrupts must be disabled when calling this
+ * Input:
+ *    key_num - key to silence
+ * Output:
+ *    false if the MIDI queue has no room for the note-off, the key is left sounding then
+ */
+
+bool note_end(uint8_t key_num)
+{
+    uint16_t key_bit = 1 << key_num;
+
+    if (active_notes.sounding & key_bit) {
+        if (midi_out_room() < 3) {
+            return false;
+        }
+        midi_queue_note_off(active_notes.key[key_num].note, 0, active_notes.key[key_num].chan);
+        active_notes.sounding &= ~key_bit;
+        active_notes.gated &= ~key_bit;
+    }
+    return true;
+}
+
+/*
+ * Function: note_play
+ * Description: queues the note-on for a key without waiting, a note the key is still sounding is ended first. Interrupts must be disabled when calling this
+ * Input:
+ *    key_num - key whose note/velocity/channel are sent
+ *    gated - true == the note ends on its own at gate_off, false == it is held until note_stop()
+ *    gate_off - low 16 bits of the clock engine tick a gated note ends at
+ *    lock - first parameter lock of the key on the step being played, LOCK_NONE for none
+ * Output:
+ *    false if the MIDI queue has no room for the note, nothing has been queued then
+ */
+
+bool note_play(uint8_t key_num, bool gated, uint16_t gate_off, uint8_t lock)
+{
+    uint8_t cc = locks_value(lock, LOCK_CC, LOCK_NONE);
+    uint8_t note = locks_value(lock, LOCK_NOTE, key_array[key_num].midi_note);
+
+    if (midi_out_room() < ((cc != LOCK_NONE) ? 9 : 6)) { // a note-off and a note-on, and the CC
+        return false;
+    }
+    note_end(key_num);
+    if (cc != LOCK_NONE) {
+        midi_queue_channel(MIDI_CONTROL_CHANGE, key_array[key_num].midi_chan, LOCK_CC_NUMBER, cc, 2);
+    }
+    midi_queue_channel(MIDI_NOTE_ON, key_array[key_num].midi_chan, note, locks_value(lock, LOCK_VELOCITY, key_array[key_num].volume), 2);
+    if (!key_array[key_num].note_off) {
+        return true;
+    }
+    active_notes.key[key_num].note = note;
+    active_notes.key[key_num].chan = key_array[key_num].midi_chan;
+    active_notes.sounding |= (1 << key_num);
+    if (gated) {
+        active_notes.gated |= (1 << key_num);
+        active_notes.key[key_num].gate_off = gate_off;
+    }
+    return true;
+}
+
+/*
+ * Function: note_start
+ * Description: sends a note-on for a key straight away, a note the key is still sounding is ended first
+ * Input:
+ *    key_num - key whose note/velocity/channel are sent
+ *    gated - true == the note ends on its own one gate from now, false == it is held until note_stop()
+ *    lock - first parameter lock of the key on the step being played, LOCK_NONE for a key played live
+ */
+
+void note_start(uint8_t key_num, bool gated, uint8_t lock)
+{
+    uint16_t gate_off = clock_engine_ticks() + notes_gate_ticks(key_num);
+
+    noInterrupts();
+    while (!note_play(key_num, gated, gate_off, lock)) {
+        interrupts();
+        sleep_mode(); // the UART interrupt frees up space
+        noInterrupts();
+    }
+    interrupts();
+}
+
+/*
+ * Function: note_stop
+ * Description: sends a note-off for the note a key is sounding, does nothing if it isn't sounding one
+ * Input:
+ *    key_num - key to silence
+ */
+
+void note_stop(uint8_t key_num)
+{
+    noInterrupts();
+    while (!note_end(key_num)) {
+        interrupts();
+        sleep_mode();
+        noInterrupts();
+    }
+    interrupts();
+}
+
+/*
+ * Function: notes_stop_all
+ * Description: silences every sounding note
+ */
+
+void notes_stop_all()
+{
+    for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
+        note_stop(i);
+    }
+}
+
+/*
+ * Function: notes_gate_handler
+ * Description: ends the gated notes once their gate has passed, called from every loop() pass.
+ *    A note-off that doesn't fit in the MIDI queue is left for the next pass
+ */
+
+void notes_gate_handler()
+{
+    if (active_notes.gated == 0) {
+        return;
+    }
+    uint16_t now = clock_engine_ticks();
+    noInterrupts();
+    for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
+        if ((active_notes.gated & (1 << i)) && ((int16_t) (now - active_notes.key[i].gate_off) >= 0)) {
+            note_end(i);
+        }
+    }
+    interrupts();
+}
@@ -0,0 +1,277 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Pattern bank. Steps are stored in pages of PATTERN_PAGE_STEPS, and a page only takes up pool memory once a note is
+// written to it. Reading a step is a page table lookup plus an array index, so the playback path costs the same for
+// every step no matter how the pattern is laid out. A page that has been cleared goes back to the pool.
+//
+// While the sequencer plays, selecting a pattern cues it rather than switching straight away. The patterns of the bank
+// are the buffers: the active one plays while the cued one can be edited or restored off air, and the cued pattern
+// takes over when the sequence wraps. The switch is decided when the scheduler looks ahead to the first step after the
+// wrap, that step is queued from the cued pattern with the rest of the notes so it isn't a tick late, and the active
+// index is flipped, a single byte, when the sequencer reaches the step. A pattern that is partway through a SysEx
+// restore is never switched to, its cue waits for the next wrap after the restore. A restore of the active pattern
+// is put together in pages of its own instead and takes over at a wrap as well, see pattern_install().
+
+pattern_bank_t pattern_bank;
+
+/*
+ * Function: pattern_step
+ * Description: the notes programmed on a step
+ * Input:
+ *    pat_num - pattern, 0 to PATTERN_CT - 1
+ *    step - step, 0 to MAX_SEQUENCER_LENGTH - 1
+ * Output:
+ *    one bit per key, bit n set == key n plays on this step
+ */
+
+uint16_t pattern_step(uint8_t pat_num, uint16_t step)
+{
+    uint8_t page = pattern_bank.pattern[pat_num].page[step / PATTERN_PAGE_STEPS];
+
+    if (page == PATTERN_PAGE_EMPTY) {
+        return 0;
+    }
+    return pattern_bank.pool[page - 1][step % PATTERN_PAGE_STEPS];
+}
+
+/*
+ * Function: pattern_page_alloc
+ * Description: takes a cleared page from the pool
+ * Output:
+ *    pool page + 1, PATTERN_PAGE_EMPTY if the pool is full
+ */
+
+uint8_t pattern_page_alloc()
+{
+    for (uint8_t i = 0; i < PATTERN_POOL_PAGES; i++) {
+        if (!(pattern_bank.pool_used & ((uint32_t) 1 << i))) {
+            pattern_bank.pool_used |= ((uint32_t) 1 << i);
+            memset(pattern_bank.pool[i], 0, sizeof(pattern_bank.pool[i]));
+            return i + 1;
+        }
+    }
+    return PATTERN_PAGE_EMPTY;
+}
+
+void pattern_page_free(uint8_t page)
+{
+    pattern_bank.pool_used &= ~((uint32_t) 1 << (page - 1));
+}
+
+/*
+ * Function: pattern_page_blank
+ * Description: whether a page has no notes on any of its steps
+ */
+
+bool pattern_page_blank(uint8_t page)
+{
+    for (uint8_t i = 0; i < PATTERN_PAGE_STEPS; i++) {
+        if (pattern_bank.pool[page - 1][i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Function: pattern_set_step
+ * Description: programs the notes of a step, allocating or releasing its storage page as needed
+ * Input:
+ *    pat_num - pattern, 0 to PATTERN_CT - 1
+ *    step - step, 0 to MAX_SEQUENCER_LENGTH - 1
+ *    keys - one bit per key
+ * Output:
+ *    false if the step needed a new page and the pool is full, the step is left unchanged
+ */
+
+bool pattern_set_step(uint8_t pat_num, uint16_t step, uint16_t keys)
+{
+    uint8_t *page = &pattern_bank.pattern[pat_num].page[step / PATTERN_PAGE_STEPS];
+
+    if (*page == PATTERN_PAGE_EMPTY) {
+        if (keys == 0) {
+            return true;
+        }
+        *page = pattern_page_alloc();
+        if (*page == PATTERN_PAGE_EMPTY) {
+            return false;
+        }
+    }
+
+    uint16_t *steps = pattern_bank.pool[*page - 1];
+    uint16_t cleared = steps[step % PATTERN_PAGE_STEPS] & ~keys;
+    if (steps[step % PATTERN_PAGE_STEPS] != keys) {
+        pattern_bank.page_dirty[pat_num] |= ((uint32_t) 1 << (step / PATTERN_PAGE_STEPS));
+    }
+    steps[step % PATTERN_PAGE_STEPS] = keys;
+    for (uint8_t i = 0; cleared != 0; i++, cleared >>= 1) {
+        if (cleared & 0x0001) {
+            locks_clear(locks_where(pat_num, step, i)); // a key taken off a step takes its locks with it
+        }
+    }
+    if ((keys == 0) && pattern_page_blank(*page)) {
+        pattern_page_free(*page);
+        *page = PATTERN_PAGE_EMPTY;
+    }
+    return true;
+}
+
+/*
+ * Function: pattern_install
+ * Description: replaces all the steps of a pattern with pages filled in off air, the pattern's own pages go back to the pool
+ * Input:
+ *    pat_num - pattern, 0 to PATTERN_CT - 1
+ *    pages - page table of the new steps, handed over and left empty
+ */
+
+void pattern_install(uint8_t pat_num, uint8_t *pages)
+{
+    uint8_t *page = pattern_bank.pattern[pat_num].page;
+
+    for (uint8_t p = 0; p < PATTERN_PAGES; p++) {
+        if ((pages[p] != PATTERN_PAGE_EMPTY) && pattern_page_blank(pages[p])) {
+            pattern_page_free(pages[p]);
+            pages[p] = PATTERN_PAGE_EMPTY;
+        }
+        if ((page[p] != PATTERN_PAGE_EMPTY) || (pages[p] != PATTERN_PAGE_EMPTY)) {
+            pattern_bank.page_dirty[pat_num] |= ((uint32_t) 1 << p);
+        }
+        if (page[p] != PATTERN_PAGE_EMPTY) {
+            pattern_page_free(page[p]);
+        }
+        page[p] = pages[p];
+        pages[p] = PATTERN_PAGE_EMPTY;
+    }
+    locks_prune(pat_num);
+}
+
+/*
+ * Function: pattern_length
+ * Description: the sequence length of a pattern, the active pattern's length lives in global_seq while it is playing
+ */
+
+uint16_t pattern_length(uint8_t pat_num)
+{
+    return (pat_num == pattern_bank.active) ? global_seq.length : pattern_bank.pattern[pat_num].length;
+}
+
+/*
+ * Function: pattern_first_step
+ * Description: the step a pattern starts on in the sequencer's direction
+ */
+
+uint16_t pattern_first_step(uint8_t pat_num)
+{
+    return global_seq.direction ? 0 : (pattern_length(pat_num) - 1);
+}
+
+/*
+ * Function: pattern_select
+ * Description: switches playback and editing over to another pattern, the sequence length goes with the pattern
+ * Input:
+ *    pat_num - pattern, 0 to PATTERN_CT - 1
+ */
+
+void pattern_select(uint8_t pat_num)
+{
+    pattern_bank.pattern[pattern_bank.active].length = global_seq.length;
+    pattern_bank.active = pat_num;
+    global_seq.length = pattern_bank.pattern[pat_num].length;
+    if (global_seq.step >= global_seq.length) {
+        global_seq.step = 0;
+    }
+}
+
+/*
+ * Function: pattern_cue
+ * Description: selects a pattern, while the sequencer plays it is cued to take over at the end of the current loop instead.
+ *    Cueing the active pattern cancels the cue
+ * Input:
+ *    pat_num - pattern, 0 to PATTERN_CT - 1
+ */
+
+void pattern_cue(uint8_t pat_num)
+{
+    if (!clock_engine_running() || global_seq.paused) {
+        pattern_bank.cued = PATTERN_NONE;
+        pattern_select(pat_num);
+        return;
+    }
+    pattern_bank.cued = (pat_num == pattern_bank.active) ? PATTERN_NONE : pat_num;
+}
+
+/*
+ * Function: pattern_wrap
+ * Description: called by the scheduler when the step it is about to queue is the first one after the sequence wraps, settles which pattern plays it
+ * Input:
+ *    tick - clock engine tick the step falls on
+ * Output:
+ *    pattern the step is played from
+ */
+
+uint8_t pattern_wrap(uint32_t tick)
+{
+    sysex_swap(); // a restore of the active pattern takes over at the wrap too
+    if ((pattern_bank.cued == PATTERN_NONE) || sysex_restoring(pattern_bank.cued)) {
+        return pattern_bank.active;
+    }
+    pattern_bank.wrap = pattern_bank.cued;
+    pattern_bank.wrap_tick = tick;
+    pattern_bank.cued = PATTERN_NONE;
+    return pattern_bank.wrap;
+}
+
+/*
+ * Function: pattern_take_wrap
+ * Description: makes the pattern settled by pattern_wrap() the active one, called as the sequencer moves on to its first step
+ * Output:
+ *    true if the pattern was switched, global_seq.step is then the first step of the new pattern
+ */
+
+bool pattern_take_wrap()
+{
+    if (pattern_bank.wrap == PATTERN_NONE) {
+        return false;
+    }
+    pattern_select(pattern_bank.wrap);
+    pattern_bank.wrap = PATTERN_NONE;
+    global_seq.step = pattern_first_step(pattern_bank.active);
+    return true;
+}
+
+/*
+ * Function: pattern_next
+ * Description: the pattern the sequence plays from its next wrap on, settled the same way pattern_wrap() settles it
+ */
+
+uint8_t pattern_next()
+{
+    if (pattern_bank.wrap != PATTERN_NONE) {
+        return pattern_bank.wrap;
+    }
+    if ((pattern_bank.cued == PATTERN_NONE) || sysex_restoring(pattern_bank.cued)) {
+        return pattern_bank.active;
+    }
+    return pattern_bank.cued;
+}
+
+/*
+ * Function: pattern_at
+ * Description: the pattern a step that falls on an engine tick is played from, the one being wrapped into once its first step has been reached
+ */
+
+uint8_t pattern_at(uint32_t tick)
+{
+    if ((pattern_bank.wrap != PATTERN_NONE) && ((int32_t) (tick - pattern_bank.wrap_tick) >= 0)) {
+        return pattern_bank.wrap;
+    }
+    return pattern_bank.active;
+}
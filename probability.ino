@@ -0,0 +1,159 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// Probability and conditional trigs of the sequenced notes. Whether a key plays on a step comes down to a 16-bit
+// xorshift generator, three shifts and three XORs per number, compared against a threshold looked up from the key's
+// probability, so 100% always plays and 0% never does. The generator is seeded from the noise on a floating analog
+// pin at bootup, or from PROBABILITY_SEED if that is defined, in which case it is reseeded on every start as well.
+// On top of that a key can have a condition that ties it to the fill switch or to the pass through the pattern, the
+// sequencer counts its passes and every track with a length or rate of its own counts its own.
+// A step can lock a key's probability to another value, see locks.ino.
+
+uint16_t probability_state = 1; // never 0, xorshift would get stuck there
+
+/*
+ * Function: probability_seed
+ * Description: seeds the generator, from PROBABILITY_SEED if it is defined, otherwise from the low bits of a few reads of a floating analog pin
+ */
+
+void probability_seed()
+{
+#ifdef PROBABILITY_SEED
+    probability_state = PROBABILITY_SEED;
+#else
+    uint16_t seed = 0;
+    for (uint8_t i = 0; i < 16; i++) {
+        seed = (seed << 3) ^ (seed >> 13) ^ analogRead(PROBABILITY_SEED_PIN); // the noise is in the low bits, spread it over the whole word
+    }
+    probability_state = seed;
+#endif // PROBABILITY_SEED
+    if (probability_state == 0) {
+        probability_state = 1;
+    }
+}
+
+/*
+ * Function: probability_restart
+ * Description: called when the sequencer starts, with a fixed seed every run leaves out the same notes
+ */
+
+void probability_restart()
+{
+#ifdef PROBABILITY_SEED
+    probability_seed();
+#endif // PROBABILITY_SEED
+}
+
+/*
+ * Function: probability_next
+ * Description: next number of the 16-bit xorshift generator (shifts 7, 9, 8), full period of 65535
+ * Output:
+ *    the high byte, the better mixed half
+ */
+
+uint8_t probability_next()
+{
+    uint16_t x = probability_state;
+
+    x ^= x << 7;
+    x ^= x >> 9;
+    x ^= x << 8;
+    probability_state = x;
+    return x >> 8;
+}
+
+/*
+ * Function: trig_next_pass
+ * Description: counts a pass, after 255 the count carries on from TRIG_PASS_WRAP so only the very first pass is ever 0
+ */
+
+uint8_t trig_next_pass(uint8_t pass)
+{
+    return (pass == 0xFF) ? TRIG_PASS_WRAP : (pass + 1);
+}
+
+/*
+ * Function: trig_condition_met
+ * Description: checks a key's trig condition
+ * Input:
+ *    key_num - key to check
+ *    pass - pass through the pattern or the key's track, 0 == the first one since the sequencer started
+ */
+
+bool trig_condition_met(uint8_t key_num, uint8_t pass)
+{
+    uint8_t trig = key_array[key_num].trig;
+
+    switch (trig) {
+        case TRIG_FILL:
+            return global_seq.fill;
+        case TRIG_NOT_FILL:
+            return !global_seq.fill;
+        case TRIG_FIRST:
+            return pass == 0;
+        case TRIG_EVERY_2:
+        case TRIG_EVERY_4:
+        case TRIG_EVERY_8:
+            return (pass & ((2 << (trig - TRIG_EVERY_2)) - 1)) == 0; // every N is a power of 2, so the low bits of the pass are the pass modulo N
+        default:
+            return true;
+    }
+}
+
+/*
+ * Function: trig_keys
+ * Description: works out which of the keys set on a step actually play, by their conditions and probabilities
+ * Input:
+ *    keys - keys set on the step, bit n == key n
+ *    pass - pass the step belongs to
+ *    lock - index of the step's first parameter lock, as returned by locks_seek()
+ *    where - position of the step in the lock table, see locks_where()
+ * Output:
+ *    the keys that play
+ */
+
+uint16_t trig_keys(uint16_t keys, uint8_t pass, uint8_t lock, uint16_t where)
+{
+    uint16_t play = keys;
+
+    for (uint8_t i = 0; keys != 0; i++, keys >>= 1) {
+        if (!(keys & 0x0001)) {
+            continue;
+        }
+        uint8_t probability = locks_value(locks_key(lock, where | i), LOCK_PROBABILITY, key_array[i].probability);
+        uint8_t threshold = pgm_read_byte(&probability_thresholds[probability]);
+        if (!trig_condition_met(i, pass) || ((threshold != PROBABILITY_ALWAYS) && (probability_next() >= threshold))) {
+            play &= ~(1 << i);
+        }
+    }
+    return play;
+}
+
+/*
+ * Function: trig_draw_fill
+ * Description: shows whether fill is on in the sequencer mode status rows, a single LED in column 13 above the record LED
+ */
+
+void trig_draw_fill()
+{
+    matrix.drawPixel(12, 6, global_seq.fill ? LED_ON : LED_OFF);
+}
+
+/*
+ * Function: trig_toggle_fill
+ * Description: turns fill on or off, takes effect from the next step that is scheduled
+ */
+
+void trig_toggle_fill()
+{
+    global_seq.fill = !global_seq.fill;
+    trig_draw_fill();
+}
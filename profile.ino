@@ -0,0 +1,116 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// Loop profiler. With LOOP_PROFILE defined the tasks loop() runs (see tasks.ino) are wrapped in PROFILE(), which reads
+// Timer1 before and after the call and adds the difference to the task's slot: a call count, the shortest and longest call
+// and a histogram with doubling bucket widths. The time between loop() passes and how late the sequencer steps are
+// picked up after the clock engine made them due go into slots of their own. Everything lives in one fixed block of
+// SRAM that is dumped over SysEx as section SYSEX_SECTION_PROFILE, the statistics start over once a dump has gone out.
+// The chunks of a dump go out over a few passes, so the later slots can be a few calls ahead of the earlier ones.
+// Without LOOP_PROFILE none of this is compiled in and PROFILE() is just the call.
+
+#ifdef LOOP_PROFILE
+
+profile_stat_t profile[PROFILE_SLOTS];
+uint16_t profile_last_pass = 0;
+bool profile_passing = false;
+
+/*
+ * Function: profile_now
+ * Description: reads Timer1, with interrupts disabled as the interrupts read 16-bit timer registers too
+ */
+
+uint16_t profile_now()
+{
+    noInterrupts();
+    uint16_t now = TCNT1;
+    interrupts();
+    return now;
+}
+
+/*
+ * Function: profile_record
+ * Description: adds a time to a slot's statistics
+ * Input:
+ *    slot - one of PROFILE_*
+ *    counts - time in Timer1 counts
+ */
+
+void profile_record(uint8_t slot, uint16_t counts)
+{
+    profile_stat_t *stat = &profile[slot];
+    uint16_t scaled = counts >> PROFILE_BUCKET_SHIFT;
+    uint8_t bucket = 0;
+
+    while ((scaled > 0) && (bucket < (PROFILE_BUCKETS - 1))) {
+        scaled >>= 1;
+        bucket++;
+    }
+    if (stat->count < 0xFFFF) {
+        stat->count++;
+    }
+    if (stat->hist[bucket] < 0xFFFF) {
+        stat->hist[bucket]++;
+    }
+    stat->min = min(stat->min, counts);
+    stat->max = max(stat->max, counts);
+}
+
+/*
+ * Function: profile_pass
+ * Description: records the time since the previous loop() pass, called at the top of loop()
+ */
+
+void profile_pass()
+{
+    uint16_t now = profile_now();
+
+    if (profile_passing) {
+        profile_record(PROFILE_LOOP, now - profile_last_pass);
+    }
+    profile_last_pass = now;
+    profile_passing = true;
+}
+
+/*
+ * Function: profile_step_taken
+ * Description: records how late loop() is in picking up a sequencer step, called as soon as the step has been taken
+ */
+
+void profile_step_taken()
+{
+    profile_record(PROFILE_STEP_LATE, profile_now() - clock_engine_step_time());
+}
+
+/*
+ * Function: profile_reset
+ * Description: starts the statistics over
+ */
+
+void profile_reset()
+{
+    for (uint8_t i = 0; i < PROFILE_SLOTS; i++) {
+        profile[i] = profile_stat_t();
+    }
+    profile_passing = false; // the pass in progress began before the reset, time from the next one on
+}
+
+/*
+ * Function: profile_byte
+ * Description: reads a byte of the statistics for a SysEx dump, slot after slot in the AVR's little endian layout, bytes past the end read as 0
+ */
+
+uint8_t profile_byte(uint16_t i)
+{
+    return (i < sizeof(profile)) ? ((const uint8_t *) profile)[i] : 0;
+}
+
+#endif // LOOP_PROFILE
@@ -0,0 +1,110 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// Live recording. Every key hit carries the clock engine tick the SX1509 interrupt fired on (or the tick a MIDI note
+// came in on), and the sequencer remembers the tick its current step became due on, so a hit is placed by when it was
+// played rather than by when loop() got round to it. Display traffic holding up a scan or a step only delays the
+// writing of the note, not where it lands. A hit goes on the nearest point of the record grid, every rec_grid steps
+// counted from the first step of the pattern in the direction it plays, so a key played a little ahead of a step
+// lands on that step. The swing is taken back out of the hit's time first, a hit right on a swung step lands on it
+// rather than halfway to the next one, and a hit that rounds on past the wrap goes to the pattern cued to play next.
+// Recording overdubs: a hit only ever adds its key to a step, shift + key takes the key off the step instead.
+
+/*
+ * Function: record_since
+ * Description: the time between the current step becoming due and a hit, with the swing taken out, the inverse of schedule_time()
+ * Input:
+ *    stamp - clock engine tick the key was hit on
+ * Output:
+ *    time in 1/256ths of an engine tick, negative when loop() has already moved on past the step the hit was in
+ */
+
+int32_t record_since(uint32_t stamp)
+{
+    uint8_t pos = (stamp + sched.swing_phase) % (2 * CLOCK_PPQN); // ticks into the pair of steps
+    uint16_t split = ((uint32_t) global_seq.swing * (2 * CLOCK_PPQN * 256)) / 100; // where the second step of the pair was moved to
+    uint16_t at = (uint16_t) pos << 8;
+    uint16_t straight;
+
+    if (at < split) {
+        straight = ((uint32_t) at * (CLOCK_PPQN * 256)) / split;
+    } else {
+        straight = (CLOCK_PPQN * 256) + ((uint32_t) (at - split) * (CLOCK_PPQN * 256)) / ((2 * CLOCK_PPQN * 256) - split);
+    }
+    return (int32_t) (stamp - pos - global_seq.step_due) * 256 + straight;
+}
+
+/*
+ * Function: record_step
+ * Description: works out the step a hit lands on
+ * Input:
+ *    stamp - clock engine tick the key was hit on
+ *    pat_num - set to the pattern the step is in, the active one unless the hit rounds on into a cued pattern
+ * Output:
+ *    step, 0 to the pattern's length - 1
+ */
+
+uint16_t record_step(uint32_t stamp, uint8_t *pat_num)
+{
+    *pat_num = pattern_bank.active;
+    if (!clock_engine_running() || global_seq.paused) {
+        return global_seq.step; // nothing is moving, the hit goes on the step on display
+    }
+    int32_t loop = (int32_t) global_seq.length * (CLOCK_PPQN * 256);
+    int32_t grid = (int32_t) global_seq.rec_grid * (CLOCK_PPQN * 256);
+    uint16_t first = pattern_first_step(pattern_bank.active);
+    uint16_t played = global_seq.direction ? (global_seq.step - first) : (first - global_seq.step); // steps into the loop
+    int32_t pos = (int32_t) played * (CLOCK_PPQN * 256) + record_since(stamp);
+    int32_t wraps = pos / loop; // loops on from the current one, loop() may not have caught up with the wrap yet
+
+    pos %= loop;
+    if (pos < 0) {
+        pos += loop;
+        wraps--;
+    }
+    int32_t down = pos - (pos % grid);
+    int32_t up = down + grid;
+    if (up > loop) {
+        up = loop; // the last grid point of a pattern that isn't a whole number of grids long is the wrap back to the first step
+    }
+    pos = ((pos - down) < (up - pos)) ? down : up;
+    if (pos >= loop) {
+        pos = 0;
+        wraps++;
+    }
+    if (wraps > 0) {
+        *pat_num = pattern_next();
+        first = pattern_first_step(*pat_num);
+    }
+    played = (pos / (CLOCK_PPQN * 256)) % pattern_length(*pat_num);
+    return global_seq.direction ? (first + played) : (first - played);
+}
+
+/*
+ * Function: record_hit
+ * Description: records a key hit into the pattern it lands in
+ * Input:
+ *    key_num - key that was hit
+ *    stamp - clock engine tick the key was hit on
+ *    erase - true == take the key off the step, false == add it
+ * Output:
+ *    false if the hit needed a new page of steps and every pool page is taken
+ */
+
+bool record_hit(uint8_t key_num, uint32_t stamp, bool erase)
+{
+    uint8_t pat_num;
+    uint16_t step = record_step(stamp, &pat_num);
+    uint16_t keys = pattern_step(pat_num, step);
+
+    keys = erase ? (keys & ~(1 << key_num)) : (keys | (1 << key_num));
+    return pattern_set_step(pat_num, step, keys);
+}
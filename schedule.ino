@@ -0,0 +1,235 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Sequenced notes go out through a note scheduler rather than straight from loop(). Every note-on gets a due time in
+// 1/256ths of a clock engine tick and waits in a small queue kept in time order, so a late note never holds up an early
+// one queued behind it. The engine's tick interrupt works out where in the tick the next note falls and sets the OCR1B
+// compare match for it, the compare match interrupt then sends the note-on, to the 4us resolution of Timer1.
+// The sequencer schedules the notes of a step while the step before it plays, so they are already waiting when their
+// time comes, and per-key tracks hand their steps over a little ahead of time as well.
+//
+// Swing moves the second step of every pair of sequencer steps from halfway through the pair to global_seq.swing
+// percent of it, stretching the first half of the pair and squeezing the second. It is applied to engine ticks rather
+// than to step numbers, so tracks of any rate swing along with the sequencer and the pairs stay on the MIDI clock grid.
+// On top of that every key has a timing offset of up to half of one of its steps either way.
+// Each queued note carries the first parameter lock of its key on its step, see locks.ino.
+
+schedule_queue_t sched;
+
+/*
+ * Function: schedule_clear
+ * Description: drops every note that hasn't gone out yet, interrupts must be disabled when calling this
+ */
+
+void schedule_clear()
+{
+    TIMSK1 &= ~(1 << OCIE1B);
+    sched.count = 0;
+    sched.ahead = false;
+}
+
+/*
+ * Function: schedule_start
+ * Description: lines the swing pairs up with the sequencer steps when the sequencer starts, so every even step starts a pair
+ * Input:
+ *    downbeat - true == the first step is due straight away, as with MIDI Start, false == one step in, as with the play button
+ */
+
+void schedule_start(bool downbeat)
+{
+    uint16_t first_step = global_sequencer_next(global_seq.step, global_seq.direction);
+    uint8_t first_tick = downbeat ? 0 : CLOCK_PPQN;
+
+    sched.swing_phase = ((first_step & 1) * CLOCK_PPQN + (2 * CLOCK_PPQN) - first_tick) % (2 * CLOCK_PPQN);
+    global_seq.step_due = (uint32_t) first_tick - CLOCK_PPQN; // the step before the first one, as far as recording is concerned
+    sched.pass = 0;
+    pattern_bank.wrap = PATTERN_NONE; // a switch settled before the stop happens at the next wrap instead, the cue is still there
+    probability_restart();
+}
+
+/*
+ * Function: schedule_time
+ * Description: works out when a key's step is played once swing and the key's timing offset have been applied
+ * Input:
+ *    tick - clock engine tick the step falls on without swing
+ *    key_num - key being played
+ * Output:
+ *    due time in 1/256ths of an engine tick, low 16 bits
+ */
+
+uint16_t schedule_time(uint32_t tick, uint8_t key_num)
+{
+    uint8_t pos = (tick + sched.swing_phase) % (2 * CLOCK_PPQN); // ticks into the pair of steps
+    uint16_t split = ((uint32_t) global_seq.swing * (2 * CLOCK_PPQN * 256)) / 100; // where the second step of the pair moves to
+    uint16_t warped;
+
+    if (pos < CLOCK_PPQN) {
+        warped = ((uint32_t) pos * split) / CLOCK_PPQN;
+    } else {
+        warped = split + ((uint32_t) (pos - CLOCK_PPQN) * ((2 * CLOCK_PPQN * 256) - split)) / CLOCK_PPQN;
+    }
+    int16_t offset = ((int32_t) key_array[key_num].offset * key_array[key_num].rate * 256) / 100;
+    return (uint16_t) ((tick - pos) << 8) + warped + offset;
+}
+
+/*
+ * Function: schedule_lead
+ * Description: how many engine ticks before its step a key's note can be due, swing only ever delays a step so this is down to the offset alone
+ */
+
+uint8_t schedule_lead(uint8_t key_num)
+{
+    if (key_array[key_num].offset >= 0) {
+        return 0;
+    }
+    return ((uint16_t) -key_array[key_num].offset * key_array[key_num].rate + 99) / 100;
+}
+
+/*
+ * Function: schedule_next_at
+ * Description: works out the Timer1 count the next note is due at, interrupts must be disabled when calling this
+ * Input:
+ *    at - set to the Timer1 count, notes that are overdue get the count of the last engine tick
+ * Output:
+ *    false if there is no note due before the next engine tick
+ */
+
+bool schedule_next_at(uint16_t *at)
+{
+    if (sched.count == 0) {
+        return false;
+    }
+    int16_t into = sched.event[sched.count - 1].due - (uint16_t) (seq_clock.ticks << 8); // 1/256ths of a tick since the last tick
+    if (into >= 256) {
+        return false;
+    }
+    *at = seq_clock.tick_time;
+    if (into > 0) {
+        *at += ((uint32_t) into * seq_clock.period) >> (8 + CLOCK_PERIOD_FRAC_BITS);
+    }
+    return true;
+}
+
+/*
+ * Function: schedule_arm
+ * Description: sets the OCR1B compare match for the next note if it is due before the next engine tick, interrupts must be disabled when calling this.
+ *    Notes further out are armed from the tick interrupt of the tick they fall in
+ */
+
+void schedule_arm()
+{
+    uint16_t at;
+
+    if (!schedule_next_at(&at)) {
+        TIMSK1 &= ~(1 << OCIE1B);
+        return;
+    }
+    if ((int16_t) (at - TCNT1) < 2) {
+        at = TCNT1 + 2; // the time has come already, go as soon as possible
+    }
+    OCR1B = at;
+    TIFR1 = (1 << OCF1B);
+    TIMSK1 |= (1 << OCIE1B);
+}
+
+/*
+ * Function: schedule_note
+ * Description: queues a sequenced note-on for a key
+ * Input:
+ *    key_num - key to play
+ *    due - time the note goes out, as returned by schedule_time()
+ *    lock - first parameter lock of the key on the step, as returned by locks_key()
+ */
+
+void schedule_note(uint8_t key_num, uint16_t due, uint8_t lock)
+{
+    noInterrupts();
+    if (sched.count >= SCHEDULE_QUEUE_LEN) {
+        interrupts();
+        note_start(key_num, true, lock); // nowhere to keep it, play it now rather than lose it
+        return;
+    }
+    uint8_t i = sched.count++;
+    for (; (i > 0) && ((int16_t) (sched.event[i - 1].due - due) <= 0); i--) {
+        sched.event[i] = sched.event[i - 1]; // notes due no later than this one move up, notes due at the same time go out in the order they were queued
+    }
+    sched.event[i].due = due;
+    sched.event[i].key = key_num;
+    sched.event[i].lock = lock;
+    if (i == (sched.count - 1)) {
+        schedule_arm(); // the new note is the next to go out
+    }
+    interrupts();
+}
+
+/*
+ * Function: schedule_keys
+ * Description: queues the notes of the keys that play on a sequencer step
+ * Input:
+ *    pat_num - pattern the step is played from
+ *    step - step of the pattern
+ *    tick - clock engine tick the step falls on
+ */
+
+void schedule_keys(uint8_t pat_num, uint16_t step, uint32_t tick)
+{
+    if ((step == pattern_first_step(pat_num)) && sched.ahead) {
+        sched.pass = trig_next_pass(sched.pass); // the first step played after a start is part of pass 0 whichever step it is
+    }
+    uint16_t where = locks_where(pat_num, step, 0);
+    uint8_t lock = locks_seek(&sched.lock, where);
+    uint16_t step_keys = trig_keys(pattern_step(pat_num, step) & ~tracks.queued, sched.pass, lock, where); // keys with a track of their own are played by tracks_handler()
+
+    for (uint8_t i = 0; step_keys != 0; i++, step_keys >>= 1) {
+        if (step_keys & 0x0001) {
+            schedule_note(i, schedule_time(tick, i), locks_key(lock, where | i));
+        }
+    }
+}
+
+/*
+ * Function: schedule_sequencer_step
+ * Description: called when a sequencer step has become due, queues the notes of the step after it, from the cued pattern when the sequence wraps.
+ *    Right after a start nothing has been queued for the step that has become due, its notes are queued as well and go out straight away
+ * Input:
+ *    step - the step that has become due
+ *    step_tick - clock engine tick it became due on
+ */
+
+void schedule_sequencer_step(uint16_t step, uint32_t step_tick)
+{
+    if (!sched.ahead) {
+        schedule_keys(pattern_bank.active, step, step_tick);
+        sched.ahead = true;
+    }
+    uint8_t pat_num = pattern_bank.active;
+    uint16_t next = global_sequencer_next(step, global_seq.direction);
+    if (next == pattern_first_step(pat_num)) {
+        pat_num = pattern_wrap(step_tick + CLOCK_PPQN);
+        next = pattern_first_step(pat_num);
+    }
+    schedule_keys(pat_num, next, step_tick + CLOCK_PPQN);
+}
+
+// Timer1 compare match B, sends the notes that are due
+ISR (TIMER1_COMPB_vect)
+{
+    uint16_t at;
+
+    while (schedule_next_at(&at) && ((int16_t) (at - TCNT1) <= 0)) {
+        uint8_t key = sched.event[sched.count - 1].key;
+        if (!note_play(key, true, (uint16_t) seq_clock.ticks + notes_gate_ticks(key), sched.event[sched.count - 1].lock)) {
+            OCR1B = TCNT1 + SCHEDULE_RETRY_COUNTS; // the MIDI queue is full, try again once a byte has gone out
+            return;
+        }
+        sched.count--;
+    }
+    schedule_arm();
+}
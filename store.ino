@@ -0,0 +1,514 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Patterns, key parameters, global settings and parameter locks are kept in the EEPROM as a set of fixed size records:
+//   one per pattern page that has notes in it, tag = (pattern << 5) | page
+//   STORE_SETTINGS_RECORDS holding the key parameters, pattern lengths and global settings, then the parameter locks
+//   a commit record holding the layout version and which pages have notes
+// Each record carries the generation of the save that wrote it and a CRC. A save only writes the pages that changed
+// and the settings records whose CRC changed, always into free slots, then writes a commit record. On bootup the
+// newest valid commit decides which generation is loaded, so a save that was cut short by a power loss is ignored.
+// Records are written one byte per store_handler() call and bytes that already hold the right value are skipped,
+// which also keeps the wear down. Free slots are handed out round robin so every slot sees the same number of writes.
+// Generations are 16 bits and wrap, so they are only ever compared by their difference. A record that hasn't changed
+// for STORE_GEN_REFRESH saves is written again with the next save, which keeps every live record within half the range
+// of the newest commit and the differences meaningful.
+
+store_t store;
+
+static_assert((STORE_LOCKS_AT + sizeof(locks.lock)) <= (STORE_SETTINGS_RECORDS * STORE_PAYLOAD), "the parameter locks don't fit in the settings records");
+
+// a full pool, the settings and a commit all live at once, and a save needs a free slot for a record and one for its commit.
+// Every commit drops the pages that have been cleared by then, so the pages it leaves live never outnumber the pool
+static_assert((PATTERN_POOL_PAGES + STORE_SETTINGS_RECORDS + 1 + 2) <= STORE_SLOTS, "the pattern pool can't be saved to the EEPROM");
+
+uint8_t store_read(uint16_t addr)
+{
+    while (EECR & (1 << EEPE));
+    EEAR = addr;
+    EECR |= (1 << EERE);
+    return EEDR;
+}
+
+uint16_t store_read_word(uint16_t addr)
+{
+    return store_read(addr) | ((uint16_t) store_read(addr + 1) << 8);
+}
+
+/*
+ * Function: store_write
+ * Description: starts writing a byte, returns straight away while the EEPROM takes ~3.4ms to program it
+ */
+
+void store_write(uint16_t addr, uint8_t val)
+{
+    EEAR = addr;
+    EEDR = val;
+    noInterrupts();
+    EECR = (1 << EEMPE); // erase and write in one operation, EEPE has to be set within 4 cycles of EEMPE
+    EECR |= (1 << EEPE);
+    interrupts();
+}
+
+/*
+ * Function: store_key_byte
+ * Description: reads a byte of a key's settings, the bit-fields are saved packed the way sound_properties_t holds them
+ * Input:
+ *    key - key the byte belongs to
+ *    i - 0 to STORE_KEY_BYTES - 1
+ */
+
+uint8_t store_key_byte(const sound_properties_t *key, uint8_t i)
+{
+    switch (i) {
+        case 0: return key->midi_note | (key->note_off << 7);
+        case 1: return key->volume;
+        case 2: return key->probability;
+        case 3: return key->midi_chan | (key->trig << 5);
+        case 4: return key->length;
+        case 5: return key->rate;
+        default: return (uint8_t) key->offset;
+    }
+}
+
+/*
+ * Function: store_set_key_byte
+ * Description: writes a byte of a key's settings, the counterpart of store_key_byte()
+ */
+
+void store_set_key_byte(sound_properties_t *key, uint8_t i, uint8_t val)
+{
+    switch (i) {
+        case 0:
+            key->midi_note = val & 0x7F;
+            key->note_off = val >> 7;
+            break;
+        case 1: key->volume = val; break;
+        case 2: key->probability = val; break;
+        case 3:
+            key->midi_chan = val & 0x1F;
+            key->trig = val >> 5;
+            break;
+        case 4: key->length = val; break;
+        case 5: key->rate = val; break;
+        default: key->offset = (int8_t) val; break;
+    }
+}
+
+/*
+ * Function: store_settings_ptr
+ * Description: maps the settings records past the key parameters onto the variables they hold
+ * Input:
+ *    i - byte of the settings records, MAX_POLYPHONY * STORE_KEY_BYTES to STORE_SETTINGS_RECORDS * STORE_PAYLOAD - 1
+ * Output:
+ *    the variable byte backing it, NULL for unused bytes
+ */
+
+uint8_t *store_settings_ptr(uint8_t i)
+{
+    if (i >= STORE_LOCKS_AT) {
+        return ((uint8_t *) locks.lock) + (i - STORE_LOCKS_AT); // saved as they are, checked by locks_restored() once loaded
+    }
+    i -= MAX_POLYPHONY * STORE_KEY_BYTES;
+    if (i < (PATTERN_CT * 2)) {
+        return ((uint8_t *) &pattern_bank.pattern[i / 2].length) + (i % 2);
+    }
+    switch (i - (PATTERN_CT * 2)) {
+        case 0: return (uint8_t *) &global_seq.tempo;
+        case 1: return ((uint8_t *) &global_seq.tempo) + 1;
+        case 2: return &global_seq.npb;
+        case 3: return &global_seq.midi_chan;
+        case 4: return &global_seq.volume;
+        case 5: return &global_seq.attack;
+        case 6: return &global_seq.release;
+        case 7: return &global_seq.PCNum;
+        case 8: return &global_seq.gate;
+        case 9: return (uint8_t *) &global_seq.direction;
+        case 10: return &pattern_bank.active;
+        case 11: return &global_seq.swing;
+        case 12: return &global_seq.ramp;
+        case 13: return &global_seq.rec_grid;
+        default: return NULL;
+    }
+}
+
+uint8_t store_settings_byte(uint8_t i)
+{
+    if (i < (MAX_POLYPHONY * STORE_KEY_BYTES)) {
+        return store_key_byte(&key_array[i / STORE_KEY_BYTES], i % STORE_KEY_BYTES);
+    }
+    uint8_t *val = store_settings_ptr(i);
+    return (val != NULL) ? *val : 0;
+}
+
+void store_set_settings_byte(uint8_t i, uint8_t val)
+{
+    if (i < (MAX_POLYPHONY * STORE_KEY_BYTES)) {
+        store_set_key_byte(&key_array[i / STORE_KEY_BYTES], i % STORE_KEY_BYTES, val);
+        return;
+    }
+    uint8_t *setting = store_settings_ptr(i);
+    if (setting != NULL) {
+        *setting = val;
+    }
+}
+
+uint16_t store_settings_crc(uint8_t rec_num)
+{
+    uint16_t crc = 0xFFFF;
+
+    pattern_bank.pattern[pattern_bank.active].length = global_seq.length; // the active pattern's length lives in global_seq while it is playing
+    for (uint8_t i = 0; i < STORE_PAYLOAD; i++) {
+        crc = _crc16_update(crc, store_settings_byte(rec_num * STORE_PAYLOAD + i));
+    }
+    return crc;
+}
+
+/*
+ * Function: store_newer
+ * Description: whether generation a was written after generation b, across the wrap of the 16-bit count
+ */
+
+bool store_newer(uint16_t a, uint16_t b)
+{
+    return (int16_t) (a - b) > 0;
+}
+
+/*
+ * Function: store_slot_valid
+ * Description: checks the CRC of a slot
+ */
+
+bool store_slot_valid(uint8_t slot)
+{
+    uint16_t addr = slot * STORE_SLOT_SIZE;
+    uint16_t crc = 0xFFFF;
+    uint8_t tag = store_read(addr);
+
+    if (!((tag & 0x1F) < PATTERN_PAGES) && !((tag >= STORE_TAG_SETTINGS) && (tag < (STORE_TAG_SETTINGS + STORE_SETTINGS_RECORDS))) && (tag != STORE_TAG_COMMIT)) {
+        return false;
+    }
+    for (uint8_t i = 0; i < (STORE_SLOT_SIZE - 2); i++) {
+        crc = _crc16_update(crc, store_read(addr + i));
+    }
+    return crc == store_read_word(addr + STORE_SLOT_SIZE - 2);
+}
+
+/*
+ * Function: store_scan
+ * Description: works out from the slot headers which slots belong to the newest complete save, and reads back its page occupancy
+ * Output:
+ *    slot of the newest commit record, -1 if there is no complete save in the EEPROM
+ */
+
+int8_t store_scan()
+{
+    uint8_t tag[STORE_SLOTS];
+    uint16_t gen[STORE_SLOTS];
+    int8_t commit = -1;
+
+    for (uint8_t s = 0; s < STORE_SLOTS; s++) {
+        if (store.valid & ((uint32_t) 1 << s)) {
+            tag[s] = store_read(s * STORE_SLOT_SIZE);
+            gen[s] = store_read_word(s * STORE_SLOT_SIZE + 1);
+            if ((tag[s] == STORE_TAG_COMMIT) && (store_read(s * STORE_SLOT_SIZE + 3) == STORE_VERSION) && ((commit < 0) || store_newer(gen[s], gen[commit]))) {
+                commit = s;
+            }
+        }
+    }
+
+    store.live = 0;
+    if (commit < 0) {
+        memset(store.occupied, 0, sizeof(store.occupied));
+        return -1;
+    }
+    store.live = (uint32_t) 1 << commit;
+    for (uint8_t i = 0; i < (PATTERN_CT * sizeof(uint32_t)); i++) {
+        ((uint8_t *) store.occupied)[i] = store_read(commit * STORE_SLOT_SIZE + 4 + i);
+    }
+
+    for (uint8_t s = 0; s < STORE_SLOTS; s++) {
+        if (!(store.valid & ((uint32_t) 1 << s)) || (tag[s] == STORE_TAG_COMMIT) || store_newer(gen[s], gen[commit])) {
+            continue;
+        }
+        if ((tag[s] < STORE_TAG_SETTINGS) || (tag[s] >= (STORE_TAG_SETTINGS + STORE_SETTINGS_RECORDS))) {
+            if (!(store.occupied[tag[s] >> 5] & ((uint32_t) 1 << (tag[s] & 0x1F)))) {
+                continue; // the page was cleared by a later save
+            }
+        }
+        bool newest = true;
+        for (uint8_t o = 0; o < STORE_SLOTS; o++) {
+            if ((store.valid & ((uint32_t) 1 << o)) && (tag[o] == tag[s]) && store_newer(gen[o], gen[s]) && !store_newer(gen[o], gen[commit])) {
+                newest = false;
+                break;
+            }
+        }
+        if (newest) {
+            store.live |= (uint32_t) 1 << s;
+        }
+    }
+    return commit;
+}
+
+/*
+ * Function: store_load
+ * Description: loads the newest complete save from the EEPROM, blocks so only call it from setup(). Leaves the defaults in place if there is none
+ */
+
+void store_load()
+{
+    for (uint8_t s = 0; s < STORE_SLOTS; s++) {
+        if (store_slot_valid(s)) {
+            uint16_t gen = store_read_word(s * STORE_SLOT_SIZE + 1);
+            if ((store.valid == 0) || !store_newer(store.next_gen, gen)) {
+                store.next_gen = gen + 1; // never reuse the generation of a save that didn't complete
+                store.last_slot = s; // carry on round robin from the newest record
+            }
+            store.valid |= (uint32_t) 1 << s;
+        }
+    }
+
+    if (store_scan() >= 0) {
+        for (uint8_t s = 0; s < STORE_SLOTS; s++) {
+            if (!(store.live & ((uint32_t) 1 << s))) {
+                continue;
+            }
+            uint16_t addr = s * STORE_SLOT_SIZE;
+            uint8_t tag = store_read(addr);
+            if ((tag >= STORE_TAG_SETTINGS) && (tag < (STORE_TAG_SETTINGS + STORE_SETTINGS_RECORDS))) {
+                for (uint8_t i = 0; i < STORE_PAYLOAD; i++) {
+                    store_set_settings_byte((tag - STORE_TAG_SETTINGS) * STORE_PAYLOAD + i, store_read(addr + 3 + i));
+                }
+            } else if (tag != STORE_TAG_COMMIT) {
+                for (uint8_t i = 0; i < PATTERN_PAGE_STEPS; i++) {
+                    pattern_set_step(tag >> 5, (tag & 0x1F) * PATTERN_PAGE_STEPS + i, store_read_word(addr + 3 + i * 2));
+                }
+            }
+        }
+        pattern_bank.active %= PATTERN_CT;
+        global_seq.length = pattern_bank.pattern[pattern_bank.active].length;
+        locks_restored();
+    }
+
+    memset(pattern_bank.page_dirty, 0, sizeof(pattern_bank.page_dirty));
+    for (uint8_t i = 0; i < STORE_SETTINGS_RECORDS; i++) {
+        store.settings_crc[i] = store_settings_crc(i);
+    }
+}
+
+/*
+ * Function: store_build
+ * Description: fills in the header and CRC of the record in store.rec, the payload has to be in place already
+ */
+
+void store_build(uint8_t tag)
+{
+    uint16_t crc = 0xFFFF;
+
+    store.rec[0] = tag;
+    store.rec[1] = store.gen & 0xFF;
+    store.rec[2] = store.gen >> 8;
+    for (uint8_t i = 0; i < (STORE_SLOT_SIZE - 2); i++) {
+        crc = _crc16_update(crc, store.rec[i]);
+    }
+    store.rec[STORE_SLOT_SIZE - 2] = crc & 0xFF;
+    store.rec[STORE_SLOT_SIZE - 1] = crc >> 8;
+}
+
+/*
+ * Function: store_next_record
+ * Description: builds the next settings or page record the save in progress has to write
+ * Output:
+ *    false once everything has been written and only the commit is left
+ */
+
+bool store_next_record()
+{
+    while (store.cursor < (STORE_SETTINGS_RECORDS + (PATTERN_CT * PATTERN_PAGES))) {
+        uint8_t c = store.cursor++;
+        if (c < STORE_SETTINGS_RECORDS) {
+            uint16_t crc = store_settings_crc(c);
+            if (crc == store.settings_crc[c]) {
+                continue;
+            }
+            store.settings_crc[c] = crc;
+            for (uint8_t i = 0; i < STORE_PAYLOAD; i++) {
+                store.rec[3 + i] = store_settings_byte(c * STORE_PAYLOAD + i);
+            }
+            store_build(STORE_TAG_SETTINGS + c);
+            return true;
+        }
+
+        c -= STORE_SETTINGS_RECORDS;
+        uint8_t pat_num = c / PATTERN_PAGES;
+        uint8_t page = c % PATTERN_PAGES;
+        uint32_t page_bit = (uint32_t) 1 << page;
+        if (!(pattern_bank.page_dirty[pat_num] & page_bit)) {
+            continue;
+        }
+        pattern_bank.page_dirty[pat_num] &= ~page_bit;
+        if (pattern_bank.pattern[pat_num].page[page] == PATTERN_PAGE_EMPTY) {
+            store.occupied[pat_num] &= ~page_bit; // a cleared page needs no record, the commit drops it
+            continue;
+        }
+        store.occupied[pat_num] |= page_bit;
+        for (uint8_t i = 0; i < PATTERN_PAGE_STEPS; i++) {
+            uint16_t keys = pattern_step(pat_num, page * PATTERN_PAGE_STEPS + i);
+            store.rec[3 + i * 2] = keys & 0xFF;
+            store.rec[4 + i * 2] = keys >> 8;
+        }
+        store_build((pat_num << 5) | page);
+        return true;
+    }
+    return false;
+}
+
+void store_build_commit()
+{
+    for (uint8_t i = 0; i < PATTERN_CT; i++) {
+        for (uint8_t p = 0; p < PATTERN_PAGES; p++) {
+            if (pattern_bank.pattern[i].page[p] == PATTERN_PAGE_EMPTY) {
+                store.occupied[i] &= ~((uint32_t) 1 << p); // frees its old record, even before the save has got to the page
+            }
+        }
+    }
+    memset(&store.rec[3], 0, STORE_PAYLOAD);
+    store.rec[3] = STORE_VERSION;
+    memcpy(&store.rec[4], store.occupied, sizeof(store.occupied));
+    store_build(STORE_TAG_COMMIT);
+}
+
+uint8_t store_free_slots()
+{
+    uint8_t free_slots = 0;
+
+    for (uint8_t s = 0; s < STORE_SLOTS; s++) {
+        if (!(store.live & ((uint32_t) 1 << s))) {
+            free_slots++;
+        }
+    }
+    return free_slots;
+}
+
+/*
+ * Function: store_refresh
+ * Description: marks the records whose live copy is STORE_GEN_REFRESH or more generations old as changed, so the save writes them again
+ */
+
+void store_refresh()
+{
+    for (uint8_t s = 0; s < STORE_SLOTS; s++) {
+        if (!(store.live & ((uint32_t) 1 << s))) {
+            continue;
+        }
+        uint8_t tag = store_read(s * STORE_SLOT_SIZE);
+        if ((tag == STORE_TAG_COMMIT) || ((uint16_t) (store.gen - store_read_word(s * STORE_SLOT_SIZE + 1)) < STORE_GEN_REFRESH)) {
+            continue;
+        }
+        if ((tag >= STORE_TAG_SETTINGS) && (tag < (STORE_TAG_SETTINGS + STORE_SETTINGS_RECORDS))) {
+            store.settings_crc[tag - STORE_TAG_SETTINGS] = ~store_settings_crc(tag - STORE_TAG_SETTINGS);
+        } else {
+            pattern_bank.page_dirty[tag >> 5] |= (uint32_t) 1 << (tag & 0x1F);
+        }
+    }
+}
+
+/*
+ * Function: store_start
+ * Description: starts a save of everything that changed, the save itself is done a byte at a time by store_handler()
+ */
+
+void store_start()
+{
+    store.gen = store.next_gen++;
+    store_refresh();
+    store.cursor = 0;
+    store.state = STORE_NEXT;
+}
+
+/*
+ * Function: store_handler
+ * Description: runs the background save, writing at most one EEPROM byte per call, and starts a save once changes have been around for STORE_DELAY_MS
+ */
+
+void store_handler()
+{
+    if (EECR & (1 << EEPE)) { // the last byte is still being programmed
+        return;
+    }
+
+    if (store.state == STORE_IDLE) {
+        if (ms_since(store.last_check) < STORE_CHECK_MS) {
+            return;
+        }
+        store.last_check = millis();
+        bool dirty = false;
+        for (uint8_t i = 0; i < PATTERN_CT; i++) {
+            dirty |= (pattern_bank.page_dirty[i] != 0);
+        }
+        for (uint8_t i = 0; i < STORE_SETTINGS_RECORDS; i++) {
+            dirty |= (store_settings_crc(i) != store.settings_crc[i]);
+        }
+        if (!dirty) {
+            store.dirty = false;
+        } else if (!store.dirty) {
+            store.dirty = true;
+            store.dirty_since = millis();
+        } else if (ms_since(store.dirty_since) >= STORE_DELAY_MS) {
+            store.dirty = false;
+            store_start();
+        }
+        return;
+    }
+
+    if (store.state == STORE_NEXT) {
+        // a record always needs a free slot and the commit one more, if the spare slots run out the records
+        // written so far are committed first and the rest of the save carries on under a new generation
+        if (store_free_slots() < 2) {
+            if (!store.written) {
+                store.state = STORE_IDLE; // another commit wouldn't free anything, what is left is still dirty for the next save
+                return;
+            }
+            store_build_commit();
+        } else if (!store_next_record()) {
+            store_build_commit();
+        }
+        do {
+            store.last_slot = (store.last_slot + 1) % STORE_SLOTS;
+        } while (store.live & ((uint32_t) 1 << store.last_slot));
+        store.slot = store.last_slot;
+        store.valid &= ~((uint32_t) 1 << store.slot);
+        store.pos = 0;
+        store.state = STORE_WRITING;
+    }
+
+    while (store.pos < STORE_SLOT_SIZE) {
+        uint16_t addr = store.slot * STORE_SLOT_SIZE + store.pos;
+        uint8_t val = store.rec[store.pos++];
+        if (store_read(addr) != val) {
+            store_write(addr, val);
+            return;
+        }
+    }
+
+    // the record is complete
+    store.valid |= (uint32_t) 1 << store.slot;
+    store.live |= (uint32_t) 1 << store.slot;
+    store.state = STORE_NEXT;
+    store.written = (store.rec[0] != STORE_TAG_COMMIT);
+    if (store.rec[0] == STORE_TAG_COMMIT) {
+        store_scan(); // the records this commit replaced are free from now on
+        if (store.cursor >= (STORE_SETTINGS_RECORDS + (PATTERN_CT * PATTERN_PAGES))) {
+            store.state = STORE_IDLE;
+        } else {
+            store.gen = store.next_gen++;
+        }
+    }
+}
@@ -0,0 +1,121 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SX1509 register access on top of the TWI queue. Word registers are read and written B bank (pins 8-15) first,
+// the SX1509 auto-increments the register address so a word access is a single transaction.
+
+// register writes done at bootup, {register, bank B value, bank A value}
+const PROGMEM uint8_t sx1509_init_seq[][3] = {
+    {SX1509_REG_DIR_B, 0xFF, 0xFF}, // all 16 pins are inputs
+    {SX1509_REG_PULL_UP_B, 0xFF, 0xFF}, // with pull-ups, the keys are active low
+    {SX1509_REG_SENSE_HIGH_B, 0xFF, 0xFF}, // interrupt on both edges for pins 8-15
+    {SX1509_REG_SENSE_HIGH_A, 0xFF, 0xFF}, // and for pins 0-7
+    {SX1509_REG_INT_MASK_B, 0x00, 0x00}, // unmask all 16 pins
+    {SX1509_REG_INT_SRC_B, 0xFF, 0xFF}, // clear anything that fired during bootup
+};
+
+// transaction buffers, these have to outlive the transactions that point at them
+const uint8_t sx1509_src_clear[] = {SX1509_REG_INT_SRC_B, 0xFF, 0xFF};
+const uint8_t sx1509_data_reg[] = {SX1509_REG_DATA_B};
+uint8_t sx1509_data_buf[2];
+
+volatile bool sx1509_scan_busy = false;
+volatile bool sx1509_scan_ready = false;
+
+// all 16 pin levels as of the last completed scan, the keys are active low
+uint16_t sx1509_pin_state = 0xFFFF;
+
+/*
+ * Function: sx1509_begin
+ * Description: resets the SX1509 and configures all 16 pins as interrupt enabled inputs, blocks until done so only call it from setup()
+ * Output:
+ *    false if the SX1509 did not respond as expected
+ */
+
+bool sx1509_begin()
+{
+    const uint8_t reset_0[] = {SX1509_REG_RESET, 0x12}; // software reset is this two byte sequence
+    const uint8_t reset_1[] = {SX1509_REG_RESET, 0x34};
+    const uint8_t test_reg[] = {SX1509_REG_INT_MASK_A};
+    uint8_t test_val[2];
+    uint8_t word[3];
+
+    if ((twi_transfer(SX1509_ADDR, reset_0, 2, NULL, 0) != TWI_OK) || (twi_transfer(SX1509_ADDR, reset_1, 2, NULL, 0) != TWI_OK)) {
+        return false;
+    }
+
+    // after a reset RegInterruptMaskA reads 0xFF and the following RegSenseHighB 0x00
+    if ((twi_transfer(SX1509_ADDR, test_reg, 1, test_val, 2) != TWI_OK) || (test_val[0] != 0xFF) || (test_val[1] != 0x00)) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < ArraySize(sx1509_init_seq); i++) {
+        memcpy_P(word, sx1509_init_seq[i], sizeof(word));
+        if (twi_transfer(SX1509_ADDR, word, 3, NULL, 0) != TWI_OK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void sx1509_scan_done(uint8_t status)
+{
+    sx1509_scan_busy = false;
+    if (status == TWI_OK) {
+        sx1509_scan_ready = true;
+    }
+}
+
+/*
+ * Function: sx1509_request_scan
+ * Description: queues an interrupt clear followed by a single burst read of both data registers, the result is picked up with sx1509_take_scan().
+ *    The interrupt source itself is never read, the caller works out which pins changed from the levels. Any edge after the clear raises
+ *    the interrupt again, so nothing is lost between the two transactions.
+ * Output:
+ *    false if a scan is already in flight or the input queue is full
+ */
+
+bool sx1509_request_scan()
+{
+    if (sx1509_scan_busy || (twi_queue_free(TWI_PRIO_INPUT) < 2)) {
+        return false;
+    }
+    sx1509_scan_busy = true;
+    twi_queue_transaction(TWI_PRIO_INPUT, SX1509_ADDR, sx1509_src_clear, 3, NULL, 0, NULL);
+    twi_queue_transaction(TWI_PRIO_INPUT, SX1509_ADDR, sx1509_data_reg, 1, sx1509_data_buf, 2, sx1509_scan_done);
+    return true;
+}
+
+/*
+ * Function: sx1509_take_scan
+ * Description: copies a completed scan into sx1509_pin_state
+ * Output:
+ *    true if a new scan was available
+ */
+
+bool sx1509_take_scan()
+{
+    if (!sx1509_scan_ready) {
+        return false;
+    }
+    sx1509_scan_ready = false;
+    sx1509_pin_state = ((uint16_t) sx1509_data_buf[0] << 8) | sx1509_data_buf[1];
+    return true;
+}
+
+/*
+ * Function: sx1509_clear_interrupts
+ * Description: queues a write that clears every pending SX1509 interrupt without reading them
+ */
+
+void sx1509_clear_interrupts()
+{
+    twi_queue_transaction(TWI_PRIO_INPUT, SX1509_ADDR, sx1509_src_clear, 3, NULL, 0, NULL);
+}
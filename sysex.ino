@@ -0,0 +1,537 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SysEx dump and restore of the settings and patterns. Every message is
+//   F0 7D 41 <command> <section> ... F7
+// where section 0 is the settings (key parameters, pattern lengths, global settings and parameter locks in the same
+// layout as the EEPROM settings records, 192 bytes) and sections 1-8 are the patterns, 2 bytes per step, low byte first, for all 384 steps.
+// With LOOP_PROFILE defined section 0x10 dumps the loop profiler statistics, see profile.ino, it can't be restored.
+//   dump request  F0 7D 41 01 <section> F7
+//   chunk         F0 7D 41 02 <section> <index hi> <index lo> <28 bytes> <checksum> F7
+//   ack           F0 7D 41 03 <section> <index hi> <index lo> <status> F7
+//   end           F0 7D 41 04 <section> <chunk count hi> <chunk count lo> F7
+// A chunk carries 24 data bytes in 7-bit groups, a byte with the high bits of the next (up to) 7 bytes followed by
+// those bytes. The checksum is the XOR of everything from the command byte up to the last data byte.
+// A dump is started by a dump request, the device then sends one chunk at a time and only moves on once the host
+// has acknowledged it, resending after SYSEX_ACK_TIMEOUT_MS. A restore is the same the other way around, the host
+// sends chunks starting at index 0 and the device acknowledges each one. Chunks are encoded straight from and decoded
+// straight into the live arrays. Restored settings are brought back into range after every chunk, but the ones that
+// change what the sequencer plays, the active pattern, its length, the tracks and the tempo, only take effect once the
+// end message is in. A restore of the active pattern while the sequencer plays is staged in free pool pages and takes
+// over at the next wrap. A restore is given up on when a chunk is refused or no chunk has come in for
+// SYSEX_RX_TIMEOUT_MS, and the pages it had staged go back to the pool. A chunk only goes out once the MIDI output
+// queue is empty, so notes never queue up behind more than one chunk and the clock, which has its own queue, isn't
+// held up at all. Every message is put together first and queued whole, see midi_send_raw_block().
+
+static_assert((SYSEX_CHUNK_LEN + 2) <= MIDI_OUT_QUEUE_LEN, "a SysEx chunk doesn't fit in the MIDI output queue");
+
+sysex_t sysex;
+
+uint16_t sysex_section_len(uint8_t section)
+{
+#ifdef LOOP_PROFILE
+    if (section == SYSEX_SECTION_PROFILE) {
+        return SYSEX_PROFILE_BYTES;
+    }
+#endif // LOOP_PROFILE
+    return (section == SYSEX_SECTION_SETTINGS) ? SYSEX_SETTINGS_BYTES : SYSEX_PATTERN_BYTES;
+}
+
+/*
+ * Function: sysex_restoring
+ * Description: whether a pattern is partway through a restore, or the settings are, which hold the pattern lengths
+ */
+
+bool sysex_restoring(uint8_t pat_num)
+{
+    return (sysex.rx_next > 0) && ((sysex.rx_restore == (pat_num + 1)) || (sysex.rx_restore == SYSEX_SECTION_SETTINGS));
+}
+
+/*
+ * Function: sysex_restoring_settings
+ * Description: whether the settings are partway through a restore, the lock table is being written until the end message
+ */
+
+bool sysex_restoring_settings()
+{
+    return (sysex.rx_next > 0) && (sysex.rx_restore == SYSEX_SECTION_SETTINGS);
+}
+
+/*
+ * Function: sysex_data_byte
+ * Description: reads a byte of a section from the live data
+ */
+
+uint8_t sysex_data_byte(uint8_t section, uint16_t i)
+{
+    if (section == SYSEX_SECTION_SETTINGS) {
+        return store_settings_byte(i);
+    }
+#ifdef LOOP_PROFILE
+    if (section == SYSEX_SECTION_PROFILE) {
+        return profile_byte(i);
+    }
+#endif // LOOP_PROFILE
+    uint16_t keys = pattern_step(section - 1, i / 2);
+    return (i & 1) ? (keys >> 8) : (keys & 0xFF);
+}
+
+/*
+ * Function: sysex_stage
+ * Description: writes a byte of a staged pattern restore, the bytes are kept in pool pages in section order
+ * Output:
+ *    false if the byte needed a page and the pool is full
+ */
+
+bool sysex_stage(uint16_t i, uint8_t val)
+{
+    uint8_t *page = &sysex.rx_page[i / sizeof(pattern_bank.pool[0])];
+
+    if (*page == PATTERN_PAGE_EMPTY) {
+        if (val == 0) {
+            return true;
+        }
+        *page = pattern_page_alloc();
+        if (*page == PATTERN_PAGE_EMPTY) {
+            return false;
+        }
+    }
+    ((uint8_t *) pattern_bank.pool[*page - 1])[i % sizeof(pattern_bank.pool[0])] = val; // little endian, the same as the steps
+    return true;
+}
+
+void sysex_unstage()
+{
+    for (uint8_t p = 0; p < PATTERN_PAGES; p++) {
+        if (sysex.rx_page[p] != PATTERN_PAGE_EMPTY) {
+            pattern_page_free(sysex.rx_page[p]);
+            sysex.rx_page[p] = PATTERN_PAGE_EMPTY;
+        }
+    }
+}
+
+/*
+ * Function: sysex_swap
+ * Description: hands a staged restore of the active pattern over to the pattern, called at the wrap of the sequence
+ */
+
+void sysex_swap()
+{
+    if (sysex.rx_swap != PATTERN_NONE) {
+        pattern_install(sysex.rx_swap, sysex.rx_page);
+        sysex.rx_swap = PATTERN_NONE;
+    }
+}
+
+/*
+ * Function: sysex_store_byte
+ * Description: writes a byte of a section into the live data, or into the staging pages
+ * Output:
+ *    false if a pattern step needed a page and the pool is full
+ */
+
+bool sysex_store_byte(uint8_t section, uint16_t i, uint8_t val)
+{
+    if (section == SYSEX_SECTION_SETTINGS) {
+        if ((i >= (MAX_POLYPHONY * STORE_KEY_BYTES)) && (store_settings_ptr(i) == &pattern_bank.active)) {
+            sysex.rx_active = val; // switched to once the end message is in
+        } else {
+            store_set_settings_byte(i, val);
+        }
+        return true;
+    }
+    if (sysex.rx_staging) {
+        return sysex_stage(i, val);
+    }
+    uint16_t keys = pattern_step(section - 1, i / 2);
+    keys = (i & 1) ? ((keys & 0x00FF) | ((uint16_t) val << 8)) : ((keys & 0xFF00) | val);
+    return pattern_set_step(section - 1, i / 2, keys);
+}
+
+/*
+ * Function: sysex_restore_start
+ * Description: the first chunk of a restore has come in, a restore of the active pattern is staged while the sequencer plays
+ */
+
+void sysex_restore_start(uint8_t section)
+{
+    sysex_swap(); // the staging pages are needed again, an earlier restore still waiting for the wrap goes in now
+    sysex_unstage();
+    sysex.rx_staging = (section != SYSEX_SECTION_SETTINGS) && ((section - 1) == pattern_bank.active) && clock_engine_running() && !global_seq.paused;
+    sysex.rx_active = pattern_bank.active;
+}
+
+/*
+ * Function: sysex_restore_abandon
+ * Description: gives up on the restore in progress, the pages it staged go back to the pool
+ */
+
+void sysex_restore_abandon()
+{
+    sysex.rx_staging = false;
+    sysex_unstage();
+    sysex.rx_next = 0;
+}
+
+/*
+ * Function: sysex_restore_end
+ * Description: the end message of a complete restore has come in, applies the settings or hands a staged pattern over
+ */
+
+void sysex_restore_end(uint8_t section)
+{
+    if (section == SYSEX_SECTION_SETTINGS) {
+        sysex_settings_apply();
+        return;
+    }
+    if (!sysex.rx_staging) {
+        return;
+    }
+    sysex.rx_staging = false;
+    if (((section - 1) == pattern_bank.active) && clock_engine_running() && !global_seq.paused) {
+        sysex.rx_swap = section - 1;
+    } else {
+        pattern_install(section - 1, sysex.rx_page);
+    }
+}
+
+/*
+ * Function: sysex_settings_restored
+ * Description: brings the settings back into range after a chunk of them has been restored, called with interrupts
+ *    disabled so queued notes never see a half written lock, locks_restored() enables them again
+ */
+
+void sysex_settings_restored()
+{
+    locks_restored();
+    for (uint8_t i = 0; i < PATTERN_CT; i++) {
+        pattern_bank.pattern[i].length = constrain(pattern_bank.pattern[i].length, 1, MAX_SEQUENCER_LENGTH);
+    }
+    global_seq.tempo = constrain(global_seq.tempo, MIN_BPM * TEMPO_SCALE, MAX_BPM * TEMPO_SCALE);
+    global_seq.npb = constrain(global_seq.npb, 1, MAX_NOTES_PER_BEAT);
+    global_seq.midi_chan = constrain(global_seq.midi_chan, 1, MAX_MIDI_CHANNEL);
+    global_seq.gate = constrain(global_seq.gate, 1, MAX_GATE);
+    global_seq.swing = constrain(global_seq.swing, SWING_STRAIGHT, SWING_MAX);
+    global_seq.ramp = min(global_seq.ramp, pgm_read_byte(&tempo_ramp_bars[ArraySize(tempo_ramp_bars) - 1]));
+    global_seq.rec_grid = constrain(global_seq.rec_grid, 1, pgm_read_byte(&record_grids[ArraySize(record_grids) - 1]));
+    global_seq.direction = *((uint8_t *) &global_seq.direction) != 0; // bools came in as whole bytes
+    for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
+        key_array[i].midi_note = min(key_array[i].midi_note, MAX_MIDI_NOTE);
+        key_array[i].volume = min(key_array[i].volume, 127);
+        key_array[i].midi_chan = constrain(key_array[i].midi_chan, 1, MAX_MIDI_CHANNEL);
+        key_array[i].probability = min(key_array[i].probability, MAX_PROBABILITY);
+        if (key_array[i].rate == 0) {
+            key_array[i].rate = TRACK_RATE_DEFAULT;
+        }
+        key_array[i].offset = constrain(key_array[i].offset, -TIMING_OFFSET_MAX, TIMING_OFFSET_MAX);
+        if (key_array[i].trig >= TRIG_CONDITIONS) {
+            key_array[i].trig = TRIG_ALWAYS;
+        }
+    }
+}
+
+/*
+ * Function: sysex_settings_apply
+ * Description: applies restored settings that need more than a variable set, once the whole section is in
+ */
+
+void sysex_settings_apply()
+{
+    pattern_bank.active = sysex.rx_active % PATTERN_CT;
+    global_seq.length = pattern_bank.pattern[pattern_bank.active].length;
+    if (global_seq.step >= global_seq.length) {
+        global_seq.step = 0;
+    }
+    tracks_update_all();
+    clock_engine_set_tempo(global_seq.tempo, global_seq.npb, 0);
+}
+
+/*
+ * Function: sysex_header
+ * Description: puts the start of a message together, up to and including the index
+ * Input:
+ *    msg - where the message goes
+ *    cmd - SYSEX_CMD_*
+ *    section - settings, pattern or profile section
+ *    index - chunk index, or the chunk count in an end message
+ * Output:
+ *    number of bytes written
+ */
+
+uint8_t sysex_header(uint8_t *msg, uint8_t cmd, uint8_t section, uint16_t index)
+{
+    msg[0] = MIDI_SYSEX_START;
+    msg[1] = SYSEX_MANUFACTURER;
+    msg[2] = SYSEX_DEVICE;
+    msg[3] = cmd;
+    msg[4] = section;
+    msg[5] = (index >> 7) & 0x7F;
+    msg[6] = index & 0x7F;
+    return 7;
+}
+
+void sysex_send_ack(uint8_t section, uint16_t index, uint8_t status)
+{
+    uint8_t msg[9];
+
+    sysex_header(msg, SYSEX_CMD_ACK, section, index);
+    msg[7] = status;
+    msg[8] = MIDI_SYSEX_END;
+    midi_send_raw_block(msg, sizeof(msg));
+}
+
+void sysex_send_end(uint8_t section, uint16_t chunks)
+{
+    uint8_t msg[8];
+
+    sysex_header(msg, SYSEX_CMD_END, section, chunks);
+    msg[7] = MIDI_SYSEX_END;
+    midi_send_raw_block(msg, sizeof(msg));
+}
+
+/*
+ * Function: sysex_send_chunk
+ * Description: encodes a chunk of a section from the live data and queues it
+ */
+
+void sysex_send_chunk(uint8_t section, uint16_t index)
+{
+    uint8_t msg[SYSEX_CHUNK_LEN + 2];
+    uint16_t base = index * SYSEX_CHUNK_BYTES;
+    uint8_t checksum = SYSEX_CMD_CHUNK ^ section ^ ((index >> 7) & 0x7F) ^ (index & 0x7F);
+
+    if (section == SYSEX_SECTION_SETTINGS) {
+        pattern_bank.pattern[pattern_bank.active].length = global_seq.length;
+    }
+    uint8_t len = sysex_header(msg, SYSEX_CMD_CHUNK, section, index);
+    for (uint8_t group = 0; group < SYSEX_CHUNK_BYTES; group += 7) {
+        uint8_t group_len = min(7, SYSEX_CHUNK_BYTES - group);
+        uint8_t msbs = 0;
+        for (uint8_t i = 0; i < group_len; i++) {
+            msbs |= (sysex_data_byte(section, base + group + i) >> 7) << i;
+        }
+        msg[len++] = msbs;
+        checksum ^= msbs;
+        for (uint8_t i = 0; i < group_len; i++) {
+            uint8_t data = sysex_data_byte(section, base + group + i) & 0x7F;
+            msg[len++] = data;
+            checksum ^= data;
+        }
+    }
+    msg[len++] = checksum;
+    msg[len++] = MIDI_SYSEX_END;
+    midi_send_raw_block(msg, len);
+}
+
+/*
+ * Function: sysex_rx_start
+ * Description: a SysEx start byte has been received
+ */
+
+void sysex_rx_start()
+{
+    sysex.rx_pos = 0;
+    sysex.rx_checksum = 0;
+}
+
+/*
+ * Function: sysex_rx_byte
+ * Description: takes in a data byte of a SysEx message, chunk data is decoded into rx_chunk as it arrives
+ */
+
+void sysex_rx_byte(uint8_t data)
+{
+    uint8_t pos = sysex.rx_pos;
+
+    if (pos == 0xFF) {
+        return;
+    }
+    if (((pos == 0) && (data != SYSEX_MANUFACTURER)) || ((pos == 1) && (data != SYSEX_DEVICE)) || (pos >= SYSEX_CHUNK_LEN)) {
+        sysex.rx_pos = 0xFF; // someone else's message, or too long to be ours
+        return;
+    }
+    sysex.rx_pos++;
+
+    if (pos >= 2) {
+        sysex.rx_checksum ^= data; // including the checksum itself, which leaves 0 for an intact chunk
+    }
+    switch (pos) {
+        case 2:
+            sysex.rx_cmd = data;
+            break;
+        case 3:
+            sysex.rx_section = data;
+            break;
+        case 4:
+            sysex.rx_index = (uint16_t) data << 7;
+            break;
+        case 5:
+            sysex.rx_index |= data;
+            break;
+        case 6:
+            sysex.rx_status = data;
+            // fall through, in a chunk this is the first byte of high bits
+        default:
+            if ((pos >= 6) && (pos < (6 + SYSEX_CHUNK_ENCODED))) {
+                uint8_t group = (pos - 6) / 8;
+                uint8_t k = (pos - 6) % 8;
+                if (k == 0) {
+                    sysex.rx_msbs = data;
+                } else {
+                    sysex.rx_chunk[group * 7 + k - 1] = data | (((sysex.rx_msbs >> (k - 1)) & 1) << 7);
+                }
+            }
+            break;
+    }
+}
+
+/*
+ * Function: sysex_rx_end
+ * Description: a SysEx end byte has been received, acts on the message if it was complete and one of ours
+ */
+
+void sysex_rx_end()
+{
+    uint8_t len = sysex.rx_pos;
+    uint8_t section = sysex.rx_section;
+
+    sysex.rx_pos = 0xFF;
+    if ((len < 4) || (len == 0xFF)) {
+        return;
+    }
+    bool known = (section <= PATTERN_CT);
+#ifdef LOOP_PROFILE
+    known = known || ((section == SYSEX_SECTION_PROFILE) && (sysex.rx_cmd != SYSEX_CMD_CHUNK)); // the profile can be dumped but not restored
+#endif // LOOP_PROFILE
+    if (!known) {
+        if (sysex.rx_cmd == SYSEX_CMD_CHUNK) {
+            sysex_send_ack(section, sysex.rx_index, SYSEX_ACK_SECTION);
+        }
+        return;
+    }
+
+    switch (sysex.rx_cmd) {
+        case SYSEX_CMD_DUMP_REQUEST:
+            sysex.tx_section = section;
+            sysex.tx_index = 0;
+            sysex.tx_active = true;
+            sysex.tx_waiting = false;
+            sysex.tx_retries = 0;
+            break;
+        case SYSEX_CMD_ACK:
+            if ((len == 7) && sysex.tx_active && sysex.tx_waiting && (section == sysex.tx_section) && (sysex.rx_index == sysex.tx_index)) {
+                sysex.tx_waiting = false;
+                if (sysex.rx_status == SYSEX_ACK_OK) {
+                    sysex.tx_index++;
+                    sysex.tx_retries = 0;
+                } else if (++sysex.tx_retries > SYSEX_RETRIES) {
+                    sysex.tx_active = false;
+                }
+            }
+            break;
+        case SYSEX_CMD_CHUNK: {
+            if (len != SYSEX_CHUNK_LEN) {
+                return;
+            }
+            uint16_t index = sysex.rx_index;
+            uint8_t status = SYSEX_ACK_OK;
+            if (sysex.rx_checksum != 0) {
+                status = SYSEX_ACK_CHECKSUM;
+            } else if ((index > sysex.rx_next) || ((index > 0) && (section != sysex.rx_restore)) || (((index + 1) * SYSEX_CHUNK_BYTES) > sysex_section_len(section))) {
+                status = SYSEX_ACK_SEQUENCE;
+            } else {
+                if (index == 0) {
+                    sysex_restore_start(section);
+                }
+                if (section == SYSEX_SECTION_SETTINGS) {
+                    noInterrupts(); // until sysex_settings_restored() has checked the locks
+                }
+                for (uint8_t i = 0; i < SYSEX_CHUNK_BYTES; i++) {
+                    if (!sysex_store_byte(section, index * SYSEX_CHUNK_BYTES + i, sysex.rx_chunk[i])) {
+                        status = SYSEX_ACK_FULL;
+                    }
+                }
+                if (section == SYSEX_SECTION_SETTINGS) {
+                    sysex_settings_restored();
+                }
+                sysex.rx_restore = section;
+                sysex.rx_next = index + 1; // a resent chunk the host missed the ack for is simply written again
+                sysex.rx_last = millis();
+            }
+            if ((status == SYSEX_ACK_FULL) || (status == SYSEX_ACK_SEQUENCE)) {
+                sysex_restore_abandon(); // the host gives up on a refused chunk, a checksum error is resent
+            }
+            sysex_send_ack(section, index, status);
+            break;
+        }
+        case SYSEX_CMD_END: {
+            uint8_t status = SYSEX_ACK_OK;
+            if (sysex.rx_next > 0) { // otherwise a resent end message the host missed the ack for
+                if ((section != sysex.rx_restore) || (((uint32_t) sysex.rx_next * SYSEX_CHUNK_BYTES) != sysex_section_len(section))) {
+                    status = SYSEX_ACK_SEQUENCE; // chunks are missing
+                    sysex_restore_abandon();
+                } else {
+                    sysex_restore_end(section);
+                }
+                sysex.rx_next = 0;
+            }
+            sysex_send_ack(section, sysex.rx_index, status);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/*
+ * Function: sysex_handler
+ * Description: moves a dump along, sends the next chunk once the previous one has been acknowledged and resends it if the ack doesn't turn up
+ */
+
+void sysex_handler()
+{
+    if ((sysex.rx_swap != PATTERN_NONE) && (!clock_engine_running() || global_seq.paused)) {
+        sysex_swap(); // stopped before the wrap came round
+    }
+    if ((sysex.rx_next > 0) && (ms_since(sysex.rx_last) >= SYSEX_RX_TIMEOUT_MS)) {
+        sysex_restore_abandon(); // the host has gone away
+    }
+    if (!sysex.tx_active) {
+        return;
+    }
+    if (sysex.tx_waiting) {
+        if (ms_since(sysex.tx_sent) < SYSEX_ACK_TIMEOUT_MS) {
+            return;
+        }
+        sysex.tx_waiting = false;
+        if (++sysex.tx_retries > SYSEX_RETRIES) {
+            sysex.tx_active = false; // the host has gone away
+            return;
+        }
+    }
+    if (midi_out.count > 0) { // wait for the notes that are queued already, the chunk goes out behind them
+        return;
+    }
+
+    uint16_t chunks = sysex_section_len(sysex.tx_section) / SYSEX_CHUNK_BYTES;
+    if (sysex.tx_index >= chunks) {
+        sysex_send_end(sysex.tx_section, chunks);
+        sysex.tx_active = false;
+#ifdef LOOP_PROFILE
+        if (sysex.tx_section == SYSEX_SECTION_PROFILE) {
+            profile_reset(); // the next dump covers the time since this one
+        }
+#endif // LOOP_PROFILE
+        return;
+    }
+    sysex_send_chunk(sysex.tx_section, sysex.tx_index);
+    sysex.tx_waiting = true;
+    sysex.tx_sent = millis();
+}
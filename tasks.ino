@@ -0,0 +1,282 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// Cooperative task scheduler. loop() hands over to tasks_run(), which runs the handlers as tasks from task_table, each
+// with a priority and a deadline: the longest its work may wait once it has turned up. A pass runs every step task that
+// has work (MIDI transport and input, note gates, the sequencer step and the tracks), then the input tasks one at a
+// time, earliest deadline first, and last the display and background tasks the same way for as long as the pass is
+// within TASK_IDLE_BUDGET_US. The step tasks are looked at again before every other task, so a step that becomes due
+// while the keys are being handled only waits for the task that is running, not for the rest of the pass. The worst
+// case step latency is therefore the longest single task, the loop profiler records it as PROFILE_STEP_LATE.
+// An idle task that has gone past its deadline runs even once the budget is spent, so the display keeps moving however
+// busy the inputs get. Apart from the step tasks every task runs at most once per pass.
+
+bool task_always()
+{
+    return true;
+}
+
+bool task_gates_pending()
+{
+    return !global_seq.paused && (active_notes.gated != 0);
+}
+
+void task_gates()
+{
+    notes_gate_handler(); // end the notes of the previous step before the next one starts
+}
+
+bool task_step_pending()
+{
+    return !global_seq.paused && (seq_clock.pending_steps > 0);
+}
+
+bool task_tracks_pending()
+{
+    return !global_seq.paused && (tracks.count > 0);
+}
+
+bool task_midi_in_pending()
+{
+    return midi_in.count > 0;
+}
+
+bool task_sw0_pending()
+{
+    return sw0_flag && !shift_op();
+}
+
+bool task_enc0_sw_pending()
+{
+    return enc0_sw_flag && (ms_since(enc0_sw_last_trig) > sw_debounce_time);
+}
+
+void task_enc0_sw()
+{
+    enc0_sw_func();
+    enc0_sw_last_trig = millis();
+}
+
+bool task_enc1_sw_pending()
+{
+    return enc1_sw_flag && (ms_since(enc1_sw_last_trig) > sw_debounce_time);
+}
+
+void task_enc1_sw()
+{
+    enc1_sw_func();
+    enc1_sw_last_trig = millis();
+}
+
+bool task_enc2_sw_pending()
+{
+    return enc2_sw_flag && (ms_since(enc2_sw_last_trig) > sw_debounce_time);
+}
+
+void task_enc2_sw()
+{
+    enc2_sw_func();
+    enc2_sw_last_trig = millis();
+}
+
+bool task_enc0_knob_pending()
+{
+    return enc0_knob_flag;
+}
+
+bool task_enc1_knob_pending()
+{
+    return enc1_knob_flag;
+}
+
+bool task_enc2_knob_pending()
+{
+    return enc2_knob_flag;
+}
+
+bool task_scan_pending()
+{
+    return sx1509_int_flag && (ms_since(sx1509_int_pin_last_trig) > sw_debounce_time);
+}
+
+bool task_keys_pending()
+{
+    return sx1509_scan_ready;
+}
+
+void task_keys()
+{
+    if (sx1509_take_scan()) {
+        sx1509_input_handler();
+    }
+}
+
+bool task_pots_pending()
+{
+    return adc_scan.fresh;
+}
+
+void task_pots()
+{
+    if (adc_take_round()) {
+        analog_potentiometer_handler();
+    }
+}
+
+bool task_blink_pending()
+{
+    return global_seq.record && (menu_mode == GLOBAL_SEQUENCER_MODE) && (ms_since(global_seq.record_last_blink) >= 500);
+}
+
+bool task_sysex_pending()
+{
+    return sysex.tx_active || (sysex.rx_next > 0) || ((sysex.rx_swap != PATTERN_NONE) && (!clock_engine_running() || global_seq.paused));
+}
+
+void task_display()
+{
+    display_flush(false); // everything drawn since the last flush goes out to the LED backpack in one go
+}
+
+// step tasks run in table order, the others by deadline, the order here only breaks ties
+const PROGMEM task_t task_table[] = {
+    {task_always, midi_transport_handler, TASK_PRIO_STEP, 0, PROFILE_NONE},
+    {task_gates_pending, task_gates, TASK_PRIO_STEP, 0, PROFILE_NONE},
+    {task_step_pending, sequencer_step, TASK_PRIO_STEP, 0, PROFILE_SEQUENCER},
+    {task_tracks_pending, tracks_handler, TASK_PRIO_STEP, 0, PROFILE_NONE},
+    {task_midi_in_pending, midi_in_handler, TASK_PRIO_STEP, 0, PROFILE_NONE},
+    {task_scan_pending, sx1509_scan_handler, TASK_PRIO_INPUT, 2, PROFILE_NONE},
+    {task_keys_pending, task_keys, TASK_PRIO_INPUT, 5, PROFILE_KEYS},
+    {task_enc0_knob_pending, enc0_knob_func, TASK_PRIO_INPUT, 10, PROFILE_ENCODERS},
+    {task_enc1_knob_pending, enc1_knob_func, TASK_PRIO_INPUT, 10, PROFILE_ENCODERS},
+    {task_enc2_knob_pending, enc2_knob_func, TASK_PRIO_INPUT, 10, PROFILE_ENCODERS},
+    {task_enc0_sw_pending, task_enc0_sw, TASK_PRIO_INPUT, 20, PROFILE_ENCODERS},
+    {task_enc1_sw_pending, task_enc1_sw, TASK_PRIO_INPUT, 20, PROFILE_ENCODERS},
+    {task_enc2_sw_pending, task_enc2_sw, TASK_PRIO_INPUT, 20, PROFILE_ENCODERS},
+    {task_sw0_pending, sw0_handler, TASK_PRIO_INPUT, 20, PROFILE_NONE},
+    {task_pots_pending, task_pots, TASK_PRIO_INPUT, 30, PROFILE_POTS},
+    {task_always, sequencer_display, TASK_PRIO_IDLE, DISPLAY_FRAME_MS, PROFILE_NONE},
+    {task_blink_pending, record_blink, TASK_PRIO_IDLE, 50, PROFILE_NONE},
+    {task_always, task_display, TASK_PRIO_IDLE, DISPLAY_FRAME_MS, PROFILE_DISPLAY},
+    {task_sysex_pending, sysex_handler, TASK_PRIO_IDLE, 20, PROFILE_NONE},
+    {task_always, store_handler, TASK_PRIO_IDLE, 50, PROFILE_NONE},
+};
+
+uint16_t task_since[sizeof(task_table) / sizeof(task_table[0])]; // millis() when a task's work turned up, or when it last ran if that was later
+uint32_t task_waiting = 0; // bit n set == task n had work the last time it was looked at
+
+/*
+ * Function: task_call
+ * Description: runs a task, timed in its profiler slot if it has one
+ */
+
+void task_call(uint8_t task_num, const task_t *task)
+{
+#ifdef LOOP_PROFILE
+    if (task->slot != PROFILE_NONE) {
+        PROFILE(task->slot, task->run());
+    } else {
+        task->run();
+    }
+#else
+    task->run();
+#endif // LOOP_PROFILE
+    task_since[task_num] = millis();
+}
+
+/*
+ * Function: tasks_run_steps
+ * Description: runs every step task that has work, in table order
+ */
+
+void tasks_run_steps()
+{
+    task_t task;
+
+    for (uint8_t i = 0; i < ArraySize(task_table); i++) {
+        memcpy_P(&task, &task_table[i], sizeof(task));
+        if ((task.prio == TASK_PRIO_STEP) && task.pending()) {
+            task_call(i, &task);
+        }
+    }
+}
+
+/*
+ * Function: tasks_next
+ * Description: picks the task of a priority with the earliest deadline among those that have work
+ * Input:
+ *    prio - TASK_PRIO_INPUT or TASK_PRIO_IDLE
+ *    ran - bit n set == task n has run this pass already and is skipped
+ *    late - set to true if the task picked is past its deadline
+ * Output:
+ *    task number, -1 if none of them has work
+ */
+
+int8_t tasks_next(uint8_t prio, uint32_t ran, bool *late)
+{
+    uint16_t now = millis();
+    int8_t next = -1;
+    uint16_t next_due = 0;
+    task_t task;
+
+    for (uint8_t i = 0; i < ArraySize(task_table); i++) {
+        uint32_t task_bit = (uint32_t) 1 << i;
+        memcpy_P(&task, &task_table[i], sizeof(task));
+        if ((task.prio != prio) || (ran & task_bit)) {
+            continue;
+        }
+        if (!task.pending()) {
+            task_waiting &= ~task_bit;
+            continue;
+        }
+        if (!(task_waiting & task_bit)) {
+            task_waiting |= task_bit;
+            task_since[i] = now;
+        }
+        uint16_t due = task_since[i] + task.deadline;
+        if ((next < 0) || ((int16_t) (due - next_due) < 0)) {
+            next = i;
+            next_due = due;
+        }
+    }
+    *late = (next >= 0) && ((int16_t) (now - next_due) >= 0);
+    return next;
+}
+
+/*
+ * Function: tasks_run
+ * Description: one pass of the scheduler, called from loop()
+ */
+
+void tasks_run()
+{
+    unsigned long start = micros();
+    uint32_t ran = 0;
+    bool late;
+    task_t task;
+
+    for (;;) {
+        tasks_run_steps();
+        int8_t next = tasks_next(TASK_PRIO_INPUT, ran, &late);
+        if (next < 0) {
+            next = tasks_next(TASK_PRIO_IDLE, ran, &late);
+            if ((next >= 0) && !late && ((micros() - start) >= TASK_IDLE_BUDGET_US)) {
+                break; // out of time, the rest wait for the next pass unless they are about to miss their deadline
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+        ran |= (uint32_t) 1 << next;
+        memcpy_P(&task, &task_table[next], sizeof(task));
+        task_call(next, &task);
+    }
+}
@@ -0,0 +1,429 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Host side of the SysEx dump/restore protocol, see sysex.ino for the message layout.
+// Talks to any raw MIDI byte stream that can be opened as a file: an ALSA raw MIDI device (/dev/snd/midiC1D0),
+// one end of an snd-virmidi pair for testing against other software, a USB MIDI/serial adapter or a pseudo terminal.
+//
+//   g++ -O2 -o ardsequino_sysex tools/ardsequino_sysex.cpp
+//   ./ardsequino_sysex /dev/snd/midiC1D0 dump settings settings.bin
+//   ./ardsequino_sysex /dev/snd/midiC1D0 restore 3 pattern3.bin
+//
+//   ./ardsequino_sysex /dev/snd/midiC1D0 dump profile profile.bin
+//
+// Sections are "settings" (192 bytes) or a pattern number 1-8 (768 bytes, 2 bytes per step, low byte first).
+// "profile" dumps the loop profiler statistics of firmware built with LOOP_PROFILE and prints them as a table as well.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define SYSEX_START 0xF0
+#define SYSEX_END 0xF7
+#define SYSEX_MANUFACTURER 0x7D
+#define SYSEX_DEVICE 0x41
+#define SYSEX_CMD_DUMP_REQUEST 0x01
+#define SYSEX_CMD_CHUNK 0x02
+#define SYSEX_CMD_ACK 0x03
+#define SYSEX_CMD_END 0x04
+#define SYSEX_ACK_OK 0x00
+#define SYSEX_ACK_CHECKSUM 0x01
+#define SYSEX_ACK_SEQUENCE 0x02
+#define SYSEX_SECTION_SETTINGS 0
+#define SYSEX_SECTION_PROFILE 0x10
+#define SYSEX_SETTINGS_BYTES 192
+#define SYSEX_PROFILE_BYTES 168
+#define SYSEX_PATTERN_BYTES 768
+#define SYSEX_CHUNK_BYTES 24
+#define SYSEX_CHUNK_ENCODED 28
+#define SYSEX_CHUNK_LEN (6 + SYSEX_CHUNK_ENCODED + 1) // data bytes between F0 and F7
+
+#define ACK_TIMEOUT_MS 500 // the device answers within a few milliseconds unless its output queue is full of notes
+#define DUMP_TIMEOUT_MS 2000 // the device resends a chunk 4 times, 250 ms apart, before it gives up
+#define RETRIES 4
+
+#define PROFILE_SLOTS 7
+#define PROFILE_BUCKETS 8
+#define PROFILE_STAT_BYTES (2 * (3 + PROFILE_BUCKETS)) // count, min, max and the histogram, 16-bit little endian
+#define PROFILE_COUNT_US 4 // Timer1 runs at clk/64
+
+static const char *ack_names[] = {"ok", "checksum error", "out of sequence", "pattern memory full", "no such section"};
+static const char *profile_names[PROFILE_SLOTS] = {"loop pass", "sequencer", "pots", "keys", "encoders", "display", "step late"};
+
+static int midi_fd = -1;
+
+static long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/*
+ * Function: midi_open
+ * Description: opens the MIDI port for reading and writing, terminals are switched to raw mode so no bytes get translated
+ */
+
+static bool midi_open(const char *path)
+{
+    midi_fd = open(path, O_RDWR | O_NOCTTY);
+    if (midi_fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (isatty(midi_fd)) {
+        struct termios tio;
+        tcgetattr(midi_fd, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(midi_fd, TCSANOW, &tio);
+    }
+    return true;
+}
+
+static bool midi_write(const std::vector<uint8_t> &msg)
+{
+    size_t done = 0;
+    while (done < msg.size()) {
+        ssize_t n = write(midi_fd, msg.data() + done, msg.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+/*
+ * Function: midi_read_sysex
+ * Description: waits for the next SysEx message of ours, everything else on the port (clock, notes, other SysEx) is skipped
+ * Input:
+ *    msg - receives the data bytes between F0 and F7
+ *    timeout_ms - how long to wait in total
+ * Output:
+ *    false on timeout
+ */
+
+static bool midi_read_sysex(std::vector<uint8_t> &msg, long timeout_ms)
+{
+    static bool in_sysex = false;
+    static std::vector<uint8_t> partial;
+    long deadline = now_ms() + timeout_ms;
+
+    for (;;) {
+        long left = deadline - now_ms();
+        if (left <= 0) {
+            return false;
+        }
+        struct pollfd pfd = {midi_fd, POLLIN, 0};
+        if (poll(&pfd, 1, left) <= 0) {
+            continue;
+        }
+        uint8_t data;
+        if (read(midi_fd, &data, 1) != 1) {
+            continue;
+        }
+        if (data >= 0xF8) {
+            continue; // real-time bytes can turn up in the middle of a message
+        }
+        if (data == SYSEX_START) {
+            in_sysex = true;
+            partial.clear();
+        } else if (data == SYSEX_END) {
+            bool ours = in_sysex && (partial.size() >= 4) && (partial[0] == SYSEX_MANUFACTURER) && (partial[1] == SYSEX_DEVICE);
+            in_sysex = false;
+            if (ours) {
+                msg = partial;
+                return true;
+            }
+        } else if (data & 0x80) {
+            in_sysex = false;
+        } else if (in_sysex) {
+            partial.push_back(data);
+        }
+    }
+}
+
+static std::vector<uint8_t> sysex_header(uint8_t cmd, uint8_t section, uint16_t index)
+{
+    return {SYSEX_START, SYSEX_MANUFACTURER, SYSEX_DEVICE, cmd, section, (uint8_t) ((index >> 7) & 0x7F), (uint8_t) (index & 0x7F)};
+}
+
+static bool send_ack(uint8_t section, uint16_t index, uint8_t status)
+{
+    std::vector<uint8_t> msg = sysex_header(SYSEX_CMD_ACK, section, index);
+    msg.push_back(status);
+    msg.push_back(SYSEX_END);
+    return midi_write(msg);
+}
+
+static uint16_t msg_index(const std::vector<uint8_t> &msg)
+{
+    return (msg[4] << 7) | msg[5];
+}
+
+/*
+ * Function: chunk_encode
+ * Description: builds a chunk message, the data goes out in 7-bit groups, a byte of high bits followed by up to 7 data bytes
+ */
+
+static std::vector<uint8_t> chunk_encode(uint8_t section, uint16_t index, const uint8_t *data)
+{
+    std::vector<uint8_t> msg = sysex_header(SYSEX_CMD_CHUNK, section, index);
+    uint8_t checksum = 0;
+
+    for (int group = 0; group < SYSEX_CHUNK_BYTES; group += 7) {
+        int group_len = (SYSEX_CHUNK_BYTES - group < 7) ? (SYSEX_CHUNK_BYTES - group) : 7;
+        uint8_t msbs = 0;
+        for (int i = 0; i < group_len; i++) {
+            msbs |= (data[group + i] >> 7) << i;
+        }
+        msg.push_back(msbs);
+        for (int i = 0; i < group_len; i++) {
+            msg.push_back(data[group + i] & 0x7F);
+        }
+    }
+    for (size_t i = 3; i < msg.size(); i++) {
+        checksum ^= msg[i];
+    }
+    msg.push_back(checksum);
+    msg.push_back(SYSEX_END);
+    return msg;
+}
+
+/*
+ * Function: chunk_decode
+ * Description: unpacks the data of a received chunk message
+ * Output:
+ *    false if the checksum doesn't match
+ */
+
+static bool chunk_decode(const std::vector<uint8_t> &msg, uint8_t *data)
+{
+    uint8_t checksum = 0;
+
+    for (int i = 2; i < SYSEX_CHUNK_LEN; i++) {
+        checksum ^= msg[i];
+    }
+    if (checksum != 0) {
+        return false;
+    }
+    for (int pos = 0; pos < SYSEX_CHUNK_ENCODED; pos++) {
+        int group = pos / 8;
+        int k = pos % 8;
+        if (k > 0) {
+            data[group * 7 + k - 1] = msg[6 + pos] | (((msg[6 + group * 8] >> (k - 1)) & 1) << 7);
+        }
+    }
+    return true;
+}
+
+/*
+ * Function: dump
+ * Description: requests a section from the device and acknowledges its chunks until the end message
+ */
+
+static bool dump(uint8_t section, std::vector<uint8_t> &image)
+{
+    uint16_t next = 0;
+    uint16_t chunks = image.size() / SYSEX_CHUNK_BYTES;
+    std::vector<uint8_t> msg = sysex_header(SYSEX_CMD_DUMP_REQUEST, section, 0);
+
+    msg.resize(5);
+    msg.push_back(SYSEX_END);
+    if (!midi_write(msg)) {
+        return false;
+    }
+    for (;;) {
+        if (!midi_read_sysex(msg, DUMP_TIMEOUT_MS)) {
+            fprintf(stderr, "device stopped responding at chunk %u of %u\n", next, chunks);
+            return false;
+        }
+        if ((msg[2] == SYSEX_CMD_END) && (msg[3] == section)) {
+            if (next != chunks) {
+                fprintf(stderr, "dump ended after %u of %u chunks\n", next, chunks);
+                return false;
+            }
+            return true;
+        }
+        if ((msg[2] != SYSEX_CMD_CHUNK) || (msg[3] != section) || (msg.size() != SYSEX_CHUNK_LEN)) {
+            continue;
+        }
+        uint16_t index = msg_index(msg);
+        uint8_t data[SYSEX_CHUNK_BYTES];
+        if (!chunk_decode(msg, data)) {
+            send_ack(section, index, SYSEX_ACK_CHECKSUM);
+        } else if (index > next) {
+            send_ack(section, index, SYSEX_ACK_SEQUENCE);
+        } else {
+            if (index == next) {
+                memcpy(&image[(size_t) index * SYSEX_CHUNK_BYTES], data, SYSEX_CHUNK_BYTES);
+                next++;
+            }
+            send_ack(section, index, SYSEX_ACK_OK); // an earlier chunk means our ack got lost, just ack it again
+        }
+    }
+}
+
+static bool wait_ack(uint8_t section, uint16_t index, uint8_t *status)
+{
+    std::vector<uint8_t> msg;
+    long deadline = now_ms() + ACK_TIMEOUT_MS;
+
+    while (midi_read_sysex(msg, deadline - now_ms())) {
+        if ((msg.size() == 7) && (msg[2] == SYSEX_CMD_ACK) && (msg[3] == section) && (msg_index(msg) == index)) {
+            *status = msg[6];
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Function: restore
+ * Description: sends a section to the device one chunk at a time, resending a chunk until the device acknowledges it
+ */
+
+static bool restore(uint8_t section, const std::vector<uint8_t> &image)
+{
+    uint16_t chunks = image.size() / SYSEX_CHUNK_BYTES;
+    uint8_t status = SYSEX_ACK_OK;
+
+    for (uint16_t index = 0; index <= chunks; index++) {
+        std::vector<uint8_t> msg;
+        if (index < chunks) {
+            msg = chunk_encode(section, index, &image[(size_t) index * SYSEX_CHUNK_BYTES]);
+        } else {
+            msg = sysex_header(SYSEX_CMD_END, section, chunks);
+            msg.push_back(SYSEX_END);
+        }
+        int tries = 0;
+        for (;;) {
+            if (!midi_write(msg)) {
+                return false;
+            }
+            if (wait_ack(section, index, &status) && (status != SYSEX_ACK_CHECKSUM)) {
+                break;
+            }
+            if (++tries > RETRIES) {
+                fprintf(stderr, "no acknowledgement for chunk %u\n", index);
+                return false;
+            }
+        }
+        if (status != SYSEX_ACK_OK) {
+            fprintf(stderr, "chunk %u rejected: %s\n", index, (status < 5) ? ack_names[status] : "unknown error");
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Function: print_profile
+ * Description: prints the loop profiler statistics, times in microseconds, histogram bucket n counts times under 16us << n
+ */
+
+static void print_profile(const std::vector<uint8_t> &image)
+{
+    printf("%-10s %6s %8s %8s   <16us  <32us  <64us <128us <256us <512us   <1ms  >=1ms\n", "", "count", "min", "max");
+    for (int slot = 0; slot < PROFILE_SLOTS; slot++) {
+        const uint8_t *stat = &image[slot * PROFILE_STAT_BYTES];
+        uint16_t val[3 + PROFILE_BUCKETS];
+        for (int i = 0; i < 3 + PROFILE_BUCKETS; i++) {
+            val[i] = stat[2 * i] | (stat[2 * i + 1] << 8);
+        }
+        printf("%-10s %6u", profile_names[slot], val[0]);
+        if (val[0] == 0) {
+            printf(" %8s %8s", "-", "-");
+        } else {
+            printf(" %8u %8u", val[1] * PROFILE_COUNT_US, val[2] * PROFILE_COUNT_US);
+        }
+        for (int i = 0; i < PROFILE_BUCKETS; i++) {
+            printf(" %6u", val[3 + i]);
+        }
+        printf("\n");
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s <midi device> dump|restore settings|<pattern 1-8> <file>\n", name);
+    fprintf(stderr, "       %s <midi device> dump profile <file>\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 5) {
+        usage(argv[0]);
+        return 2;
+    }
+    const char *port = argv[1];
+    const char *action = argv[2];
+    const char *file = argv[4];
+    uint8_t section;
+    if (strcmp(argv[3], "settings") == 0) {
+        section = SYSEX_SECTION_SETTINGS;
+    } else if ((strcmp(argv[3], "profile") == 0) && (strcmp(action, "dump") == 0)) {
+        section = SYSEX_SECTION_PROFILE;
+    } else {
+        section = atoi(argv[3]);
+        if ((section < 1) || (section > 8)) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    std::vector<uint8_t> image((section == SYSEX_SECTION_SETTINGS) ? SYSEX_SETTINGS_BYTES : ((section == SYSEX_SECTION_PROFILE) ? SYSEX_PROFILE_BYTES : SYSEX_PATTERN_BYTES));
+
+    if (strcmp(action, "dump") == 0) {
+        if (!midi_open(port) || !dump(section, image)) {
+            return 1;
+        }
+        FILE *f = fopen(file, "wb");
+        if ((f == NULL) || (fwrite(image.data(), 1, image.size(), f) != image.size()) || (fclose(f) != 0)) {
+            fprintf(stderr, "%s: %s\n", file, strerror(errno));
+            return 1;
+        }
+        if (section == SYSEX_SECTION_PROFILE) {
+            print_profile(image);
+        }
+    } else if (strcmp(action, "restore") == 0) {
+        FILE *f = fopen(file, "rb");
+        if (f == NULL) {
+            fprintf(stderr, "%s: %s\n", file, strerror(errno));
+            return 1;
+        }
+        size_t len = fread(image.data(), 1, image.size(), f);
+        bool extra = fgetc(f) != EOF;
+        fclose(f);
+        if ((len != image.size()) || extra) {
+            fprintf(stderr, "%s: expected %zu bytes\n", file, image.size());
+            return 1;
+        }
+        if (!midi_open(port) || !restore(section, image)) {
+            return 1;
+        }
+    } else {
+        usage(argv[0]);
+        return 2;
+    }
+    printf("%s %s: %zu bytes\n", action, argv[3], image.size());
+    return 0;
+}
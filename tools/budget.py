@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+#
+# This file is part of the ARDSEQUINO project, see ../LICENSE.
+#
+# Static SRAM and flash budget of a sketch build. Reads the section sizes and the symbol table of the linked ELF and
+# prints how much of the ATmega328P's SRAM the globals take, what that leaves for the stack and heap, the largest
+# globals, and how full the flash is. Exits with 1 if either is over budget, so it can fail a build.
+#
+#   budget.py [--nm avr-nm] [--size avr-size] [--ram 2048] [--flash 30720] [--top 16] <sketch.elf>
+
+import argparse
+import subprocess
+import sys
+
+RAM_SECTIONS = ('.data', '.bss', '.noinit')
+FLASH_SECTIONS = ('.text', '.data')
+STACK_MIN = 256 # less headroom than this for the stack is reported as a warning
+
+parser = argparse.ArgumentParser(description='SRAM and flash budget of a sketch build')
+parser.add_argument('elf')
+parser.add_argument('--nm', default='avr-nm')
+parser.add_argument('--size', default='avr-size')
+parser.add_argument('--ram', type=int, default=2048, help='SRAM bytes, 2048 on the ATmega328P')
+parser.add_argument('--flash', type=int, default=30720, help='flash bytes left by the bootloader, 30720 on a Nano with the old bootloader')
+parser.add_argument('--top', type=int, default=16, help='how many of the largest globals to list')
+args = parser.parse_args()
+
+
+def run(cmd):
+    try:
+        return subprocess.run(cmd, check=True, capture_output=True, text=True).stdout
+    except (OSError, subprocess.CalledProcessError) as err:
+        sys.exit('budget.py: %s failed: %s' % (cmd[0], err))
+
+
+# "size -A" lists every section with its size and address
+sections = {}
+for line in run([args.size, '-A', args.elf]).splitlines():
+    fields = line.split()
+    if (len(fields) == 3) and fields[0].startswith('.') and fields[1].isdigit():
+        sections[fields[0]] = int(fields[1])
+
+# "nm -S" gives "address size type name" for every symbol with a size, b/B/d/D are the ones that live in SRAM
+symbols = []
+for line in run([args.nm, '-S', '-C', '--size-sort', args.elf]).splitlines():
+    fields = line.split(None, 3)
+    if (len(fields) == 4) and (fields[2] in 'bBdD'):
+        symbols.append((int(fields[1], 16), fields[3]))
+symbols.sort(reverse=True)
+
+ram = sum(sections.get(name, 0) for name in RAM_SECTIONS)
+flash = sum(sections.get(name, 0) for name in FLASH_SECTIONS)
+left = args.ram - ram
+
+print('SRAM:  %5d of %5d bytes (%d%%), %d left for the stack' % (ram, args.ram, (100 * ram) // args.ram, left))
+print('       ' + ', '.join('%s %d' % (name, sections.get(name, 0)) for name in RAM_SECTIONS))
+print('flash: %5d of %5d bytes (%d%%)' % (flash, args.flash, (100 * flash) // args.flash))
+print('largest globals:')
+for size, name in symbols[:args.top]:
+    print('  %5d  %s' % (size, name))
+
+if (ram > args.ram) or (flash > args.flash):
+    print('over budget')
+    sys.exit(1)
+if left < STACK_MIN:
+    print('warning: less than %d bytes left for the stack' % STACK_MIN)
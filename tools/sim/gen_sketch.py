@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+#
+# This file is part of the ARDSEQUINO project, see ../../LICENSE.
+#
+# Turns the sketch into a single C++ file the way the Arduino builder does: the main tab first, the other tabs after it
+# in alphabetical order, and a prototype for every function ahead of the first function definition.
+#
+#   gen_sketch.py <sketch dir> <main tab> <output file>
+
+import os
+import re
+import sys
+
+sketch_dir, main_name, out = sys.argv[1], sys.argv[2], sys.argv[3]
+tabs = [main_name] + sorted(f for f in os.listdir(sketch_dir) if f.endswith('.ino') and f != main_name)
+
+lines, where = [], []
+for tab in tabs:
+    path = os.path.abspath(os.path.join(sketch_dir, tab))
+    lines.append('#line 1 "%s"' % path)
+    where.append((path, 0))
+    for n, line in enumerate(open(path, encoding='utf-8').read().replace('\r\n', '\n').split('\n')):
+        lines.append(line)
+        where.append((path, n + 1))
+
+definition = re.compile(r'^([A-Za-z_][\w<>\*&: ]*?[\s\*&]+)([A-Za-z_]\w*)\s*\(([^;{}]*)\)\s*(\{.*)?$')
+protos, first = [], None
+for i, line in enumerate(lines):
+    m = definition.match(line)
+    if not m or m.group(2) in ('ISR', 'if', 'while', 'for', 'switch'):
+        continue
+    body = line if m.group(4) else next((x for x in lines[i + 1:] if x.strip()), '')
+    if not body.strip().startswith('{'):
+        continue
+    if first is None:
+        first = i
+    protos.append('%s%s(%s);' % (m.group(1), m.group(2), m.group(3)))
+
+lines[first:first] = protos + ['#line %d "%s"' % (where[first][1], where[first][0])]
+open(out, 'w').write('#include <Arduino.h>\n' + '\n'.join(lines) + '\n')
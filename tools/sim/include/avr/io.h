@@ -0,0 +1,94 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "../sim.h"
+
+// Timer1
+extern SimReg8 TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+extern SimReg16 TCNT1, OCR1A, OCR1B, ICR1;
+#define WGM10 0
+#define WGM11 1
+#define WGM12 3
+#define WGM13 4
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+
+// pin change interrupts and GPIO ports
+extern SimReg8 PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2, EIMSK, EIFR, EICRA;
+extern SimReg8 PINB, PINC, PIND, PORTB, PORTC, PORTD, DDRB, DDRC, DDRD;
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+
+extern SimReg8 SREG;
+
+// TWI
+extern SimReg8 TWBR, TWSR, TWAR, TWDR, TWCR, TWAMR;
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC 3
+#define TWEN 2
+#define TWIE 0
+#define TWPS0 0
+#define TWPS1 1
+
+extern SimReg8 UDR0, UCSR0A, UCSR0B, UCSR0C;
+extern SimReg16 UBRR0;
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+#define U2X0 1
+#define MPCM0 0
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ02 2
+#define UCSZ01 2
+#define UCSZ00 1
+
+// ADC
+extern SimReg8 ADMUX, ADCSRA, ADCSRB, DIDR0;
+extern SimReg16 ADC;
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+
+#define E2END 0x3FF
+extern SimReg8 EECR, EEDR;
+extern SimReg16 EEAR;
+#define EEPM1 5
+#define EEPM0 4
+#define EERIE 3
+#define EEMPE 2
+#define EEPE 1
+#define EERE 0
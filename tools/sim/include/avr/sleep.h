@@ -0,0 +1,19 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "io.h"
+// idle sleep, the virtual clock moves on to the next Timer0 overflow which is the latest an interrupt can wake the CPU
+#define SLEEP_MODE_IDLE 0
+#define set_sleep_mode(m) ((void) (m))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu() sim_sleep()
+#define sleep_mode() sim_sleep()
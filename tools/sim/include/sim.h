@@ -0,0 +1,82 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Host simulation of the ARDSEQUINO hardware, shared by the AVR and Arduino stand-in headers and the simulator sources.
+#pragma once
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+
+#define F_CPU 16000000L
+
+// virtual clock, in CPU cycles since reset
+extern uint64_t sim_cycles;
+void sim_advance(uint32_t cycles);
+void sim_at(uint64_t at, std::function<void()> fn);
+void sim_fire_pending(void);
+void sim_sleep(void);
+
+// output logs, one line per entry stamped with the virtual time in microseconds
+void sim_open_logs(const char *dir);
+void sim_log(const char *kind, const char *fmt, ...);
+
+// stimulus for the scenario runner
+extern uint64_t sim_next_stimulus;
+extern void (*sim_stimulus_hook)(void);
+extern int sim_midi_pty;
+void sim_set_pin(uint8_t pin, uint8_t level);
+uint8_t sim_get_pin(uint8_t pin);
+void sim_set_pot(uint8_t ch, int v);
+void sim_sx1509_set_key(uint8_t pin, bool pressed);
+void sim_usart_rx(uint8_t b);
+void sim_eeprom_open(const char *dir);
+void sim_eeprom_close(void);
+
+#define SIM_VECT(name) extern "C" void name(void) __attribute__((weak));
+SIM_VECT(sim_vect_pcint0)
+SIM_VECT(sim_vect_pcint2)
+SIM_VECT(sim_vect_timer1_compa)
+SIM_VECT(sim_vect_timer1_compb)
+SIM_VECT(sim_vect_timer1_ovf)
+SIM_VECT(sim_vect_twi)
+SIM_VECT(sim_vect_usart_udre)
+SIM_VECT(sim_vect_usart_rx)
+SIM_VECT(sim_vect_adc)
+#define ISR(vector, ...) extern "C" void vector(void)
+#define PCINT0_vect sim_vect_pcint0
+#define PCINT2_vect sim_vect_pcint2
+#define TIMER1_COMPA_vect sim_vect_timer1_compa
+#define TIMER1_COMPB_vect sim_vect_timer1_compb
+#define TIMER1_OVF_vect sim_vect_timer1_ovf
+#define TWI_vect sim_vect_twi
+#define USART_UDRE_vect sim_vect_usart_udre
+#define USART_RX_vect sim_vect_usart_rx
+#define ADC_vect sim_vect_adc
+
+// registers with side effects are modelled as small proxy objects
+struct SimReg8 {
+    uint8_t v = 0;
+    uint8_t (*rd)(SimReg8 &) = nullptr;
+    void (*wr)(SimReg8 &, uint8_t) = nullptr;
+    operator uint8_t() { return rd ? rd(*this) : v; }
+    SimReg8 &operator=(uint8_t x) { if (wr) wr(*this, x); else v = x; return *this; }
+    SimReg8 &operator|=(uint8_t x) { return *this = (uint8_t) (uint8_t(*this) | x); }
+    SimReg8 &operator&=(uint8_t x) { return *this = (uint8_t) (uint8_t(*this) & x); }
+    SimReg8 &operator^=(uint8_t x) { return *this = (uint8_t) (uint8_t(*this) ^ x); }
+};
+struct SimReg16 {
+    uint16_t v = 0;
+    uint16_t (*rd)(SimReg16 &) = nullptr;
+    void (*wr)(SimReg16 &, uint16_t) = nullptr;
+    operator uint16_t() { return rd ? rd(*this) : v; }
+    SimReg16 &operator=(uint16_t x) { if (wr) wr(*this, x); else v = x; return *this; }
+    SimReg16 &operator+=(uint16_t x) { return *this = (uint16_t) (uint16_t(*this) + x); }
+    SimReg16 &operator-=(uint16_t x) { return *this = (uint16_t) (uint16_t(*this) - x); }
+};
@@ -0,0 +1,242 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Virtual AVR core: a 16MHz cycle counter standing in for the CPU clock, Timer1, GPIO, external and pin change
+// interrupts and the interrupt dispatch. Nothing runs in parallel, time only moves on when the sketch touches a register
+// or calls into the Arduino API, and every peripheral event lands on the exact cycle it is due on, so a run is fully
+// deterministic.
+
+#include <functional>
+#include <map>
+#include <stdarg.h>
+#include <string>
+#include <Arduino.h>
+
+uint64_t sim_cycles = 0;
+static FILE *log_files[8];
+static const char *log_kinds[] = {"midi", "i2c", "display", "event", "eeprom", nullptr};
+
+void sim_log(const char *kind, const char *fmt, ...)
+{
+    for (int i = 0; log_kinds[i]; i++) {
+        if (strcmp(kind, log_kinds[i]) == 0 && log_files[i]) {
+            va_list ap;
+            va_start(ap, fmt);
+            fprintf(log_files[i], "%llu ", (unsigned long long) (sim_cycles / 16));
+            vfprintf(log_files[i], fmt, ap);
+            fputc('\n', log_files[i]);
+            va_end(ap);
+        }
+    }
+}
+
+// ---- timed peripheral events
+static std::multimap<uint64_t, std::function<void()>> timed_events;
+void sim_at(uint64_t at, std::function<void()> fn) { timed_events.emplace(at, fn); }
+
+// ---- registers
+static void sreg_wr(SimReg8 &r, uint8_t x);
+static void tifr1_wr(SimReg8 &r, uint8_t x) { r.v &= ~x; }
+static uint8_t pin_levels[22];
+static uint8_t pin_pullup[22];
+static uint8_t port_rd(int base) { uint8_t v = 0; for (int i = 0; i < 8 && base + i < 22; i++) v |= (pin_levels[base + i] & 1) << i; return v; }
+static uint8_t pind_rd(SimReg8 &) { sim_advance(1); return port_rd(0); }
+static uint8_t pinb_rd(SimReg8 &) { sim_advance(1); return port_rd(8) & 0x3F; }
+static uint8_t pinc_rd(SimReg8 &) { sim_advance(1); return port_rd(14) & 0x3F; }
+
+SimReg8 SREG{0x80, nullptr, sreg_wr};
+SimReg8 TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1{0, nullptr, tifr1_wr};
+SimReg16 TCNT1, OCR1A, OCR1B, ICR1;
+SimReg8 PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2, EIMSK, EIFR, EICRA;
+SimReg8 PINB{0, pinb_rd}, PINC{0, pinc_rd}, PIND{0, pind_rd}, PORTB, PORTC, PORTD, DDRB, DDRC, DDRD;
+
+static void (*int_handlers[2])(void);
+static int int_modes[2];
+
+// ---- Timer1
+static uint32_t t1_rem;
+static uint32_t t1_prescale()
+{
+    static const uint32_t p[] = {0, 1, 8, 64, 256, 1024, 0, 0};
+    return p[TCCR1B.v & 7];
+}
+static bool t1_ctc() { return (TCCR1B.v & (1 << WGM12)) != 0; }
+static uint32_t t1_counts_to_event()
+{
+    uint16_t c = TCNT1.v;
+    uint32_t to_a = (uint16_t) (OCR1A.v - c);
+    if (to_a == 0) to_a = 0x10000;
+    uint32_t to_b = (uint16_t) (OCR1B.v - c);
+    if (to_b == 0) to_b = 0x10000;
+    uint32_t to_ovf = 0x10000 - c;
+    if (t1_ctc()) {
+        to_ovf = 0x7FFFFFFF;
+        if (c > OCR1A.v) to_a = 0x10000 - c + OCR1A.v;
+    }
+    uint32_t m = to_a < to_b ? to_a : to_b;
+    return m < to_ovf ? m : to_ovf;
+}
+static void t1_count(uint32_t counts)
+{
+    while (counts--) {
+        if (t1_ctc() && TCNT1.v == OCR1A.v) TCNT1.v = 0;
+        else TCNT1.v++;
+        if (TCNT1.v == 0 && !t1_ctc()) TIFR1.v |= 1 << TOV1;
+        if (TCNT1.v == OCR1A.v) TIFR1.v |= 1 << OCF1A;
+        if (TCNT1.v == OCR1B.v) TIFR1.v |= 1 << OCF1B;
+    }
+}
+
+// ---- ADC, single conversions of 13 ADC clocks, the result is the scenario's pot setting for the selected channel
+static int pot_values[8];
+static void adcsra_wr(SimReg8 &r, uint8_t x)
+{
+    bool start = (x & (1 << ADSC)) && (x & (1 << ADEN)) && !(r.v & (1 << ADSC));
+    uint8_t flag = (r.v & (1 << ADIF)) & ~(x & (1 << ADIF)); // ADIF is cleared by writing one
+    r.v = (x & ~(1 << ADIF)) | flag;
+    if (!start) return;
+    static const uint32_t p[] = {2, 2, 4, 8, 16, 32, 64, 128};
+    sim_at(sim_cycles + 13 * p[x & 7], [] {
+        uint8_t ch = ADMUX.v & 0x0F;
+        ADC.v = ch < 8 ? pot_values[ch] : 0;
+        ADCSRA.v = (ADCSRA.v & ~(1 << ADSC)) | (1 << ADIF);
+        sim_fire_pending();
+    });
+}
+SimReg8 ADMUX, ADCSRA{0, nullptr, adcsra_wr}, ADCSRB, DIDR0;
+SimReg16 ADC;
+
+// ---- interrupt dispatch
+static bool in_isr;
+void sim_fire_pending()
+{
+    if (in_isr || !(SREG.v & 0x80)) return;
+    for (;;) {
+        void (*fn)(void) = nullptr;
+        if (EIFR.v & 1) { EIFR.v &= ~1; fn = int_handlers[0]; }
+        else if ((PCIFR.v & 1) && (PCICR.v & 1)) { PCIFR.v &= ~1; fn = sim_vect_pcint0; }
+        else if ((PCIFR.v & 4) && (PCICR.v & 4)) { PCIFR.v &= ~4; fn = sim_vect_pcint2; }
+        else if ((TIFR1.v & (1 << OCF1A)) && (TIMSK1.v & (1 << OCIE1A))) { TIFR1.v &= ~(1 << OCF1A); fn = sim_vect_timer1_compa; }
+        else if ((TIFR1.v & (1 << OCF1B)) && (TIMSK1.v & (1 << OCIE1B))) { TIFR1.v &= ~(1 << OCF1B); fn = sim_vect_timer1_compb; }
+        else if ((TIFR1.v & (1 << TOV1)) && (TIMSK1.v & (1 << TOIE1))) { TIFR1.v &= ~(1 << TOV1); fn = sim_vect_timer1_ovf; }
+        else if ((UCSR0A.v & (1 << RXC0)) && (UCSR0B.v & (1 << RXCIE0)) && sim_vect_usart_rx) { fn = sim_vect_usart_rx; }
+        else if ((UCSR0A.v & (1 << UDRE0)) && (UCSR0B.v & (1 << UDRIE0)) && sim_vect_usart_udre) { fn = sim_vect_usart_udre; }
+        else if ((ADCSRA.v & (1 << ADIF)) && (ADCSRA.v & (1 << ADIE))) { ADCSRA.v &= ~(1 << ADIF); fn = sim_vect_adc; }
+        else if ((TWCR.v & (1 << TWINT)) && (TWCR.v & (1 << TWIE)) && (TWCR.v & (1 << TWEN))) { fn = sim_vect_twi; if (!fn) break; }
+        else break;
+        if (!fn) continue;
+        in_isr = true;
+        SREG.v &= 0x7F;
+        sim_cycles += 40; // vector entry and register save/restore
+        fn();
+        SREG.v |= 0x80;
+        in_isr = false;
+    }
+}
+static void sreg_wr(SimReg8 &r, uint8_t x)
+{
+    bool enabling = !(r.v & 0x80) && (x & 0x80);
+    r.v = x;
+    if (enabling) sim_fire_pending();
+}
+
+uint64_t sim_next_stimulus = ~0ULL;
+void (*sim_stimulus_hook)(void);
+
+void sim_advance(uint32_t cycles)
+{
+    uint64_t target = sim_cycles + cycles;
+    while (sim_cycles < target) {
+        uint64_t step = target - sim_cycles;
+        if (sim_next_stimulus > sim_cycles && sim_next_stimulus - sim_cycles < step) step = sim_next_stimulus - sim_cycles;
+        uint32_t presc = t1_prescale();
+        if (presc) {
+            uint64_t to_ev = (uint64_t) t1_counts_to_event() * presc - t1_rem;
+            if (to_ev < step) step = to_ev;
+        }
+        if (!timed_events.empty() && timed_events.begin()->first > sim_cycles && timed_events.begin()->first - sim_cycles < step) step = timed_events.begin()->first - sim_cycles;
+        if (step == 0) step = 1;
+        sim_cycles += step;
+        if (presc) {
+            uint64_t total = t1_rem + step;
+            t1_count(total / presc);
+            t1_rem = total % presc;
+        }
+        while (!timed_events.empty() && timed_events.begin()->first <= sim_cycles) {
+            auto fn = timed_events.begin()->second;
+            timed_events.erase(timed_events.begin());
+            fn();
+        }
+        if (sim_cycles >= sim_next_stimulus && sim_stimulus_hook && !in_isr) sim_stimulus_hook();
+        sim_fire_pending();
+    }
+}
+
+// ---- Arduino API
+unsigned long millis(void) { sim_advance(20); return (unsigned long) (sim_cycles / 16000); }
+unsigned long micros(void) { sim_advance(20); return (unsigned long) (sim_cycles / 16) & ~3UL; }
+void delay(unsigned long ms) { sim_advance(ms * 16000); }
+void delayMicroseconds(unsigned int us) { sim_advance(us * 16); }
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    sim_advance(40);
+    if (pin < 22) { pin_pullup[pin] = mode == INPUT_PULLUP; if (mode == INPUT_PULLUP) pin_levels[pin] = 1; }
+}
+int digitalRead(uint8_t pin) { sim_advance(50); return pin < 22 ? pin_levels[pin] : 0; }
+void digitalWrite(uint8_t pin, uint8_t val) { sim_advance(50); if (pin < 22) pin_levels[pin] = val ? 1 : 0; }
+int analogRead(uint8_t pin) { sim_advance(1760); uint8_t ch = pin >= 14 ? pin - 14 : pin; return ch < 8 ? pot_values[ch] : 0; }
+void attachInterrupt(uint8_t num, void (*fn)(void), int mode) { if (num < 2) { int_handlers[num] = fn; int_modes[num] = mode; EIMSK.v |= 1 << num; } }
+void detachInterrupt(uint8_t num) { if (num < 2) { int_handlers[num] = nullptr; EIMSK.v &= ~(1 << num); } }
+
+// avr-libc random(), Park-Miller minimal standard generator
+static unsigned long rand_state = 1;
+static long do_random(unsigned long *ctx)
+{
+    long hi, lo, x = *ctx;
+    if (x == 0) x = 123459876L;
+    hi = x / 127773L;
+    lo = x % 127773L;
+    x = 16807L * lo - 2836L * hi;
+    if (x < 0) x += 0x7fffffffL;
+    return ((*ctx = x) % (0x7fffffffUL + 1));
+}
+long random(long howbig) { sim_advance(700); return howbig ? do_random(&rand_state) % howbig : 0; }
+long random(long howsmall, long howbig) { return howsmall >= howbig ? howsmall : random(howbig - howsmall) + howsmall; }
+void randomSeed(unsigned long seed) { if (seed) rand_state = seed; }
+
+// ---- stimulus helpers used by the scenario runner
+void sim_set_pin(uint8_t pin, uint8_t level)
+{
+    if (pin >= 22 || pin_levels[pin] == level) return;
+    uint8_t old = pin_levels[pin];
+    pin_levels[pin] = level;
+    if (pin < 8 && (PCMSK2.v & (1 << pin))) PCIFR.v |= 4;
+    else if (pin >= 8 && pin < 14 && (PCMSK0.v & (1 << (pin - 8)))) PCIFR.v |= 1;
+    for (int n = 0; n < 2; n++) {
+        if (pin != 2 + n || !int_handlers[n]) continue;
+        if ((int_modes[n] == FALLING && old && !level) || (int_modes[n] == RISING && !old && level) || int_modes[n] == CHANGE) EIFR.v |= 1 << n;
+    }
+    sim_fire_pending();
+}
+uint8_t sim_get_pin(uint8_t pin) { return pin < 22 ? pin_levels[pin] : 0; }
+void sim_set_pot(uint8_t ch, int v) { if (ch < 8) pot_values[ch] = v; }
+
+void sim_open_logs(const char *dir)
+{
+    for (int i = 0; log_kinds[i]; i++) {
+        std::string p = std::string(dir) + "/" + log_kinds[i] + ".log";
+        log_files[i] = fopen(p.c_str(), "w");
+    }
+}
+
+void sim_sleep(void)
+{
+    sim_advance(16384 - (uint32_t) (sim_cycles % 16384));
+}
@@ -0,0 +1,65 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// EEPROM: 1KB, ~3.4ms per erase+write, EEMPE has to be set just before EEPE. Contents persist in <out>/eeprom.bin
+#include <string>
+#include <string.h>
+#include "sim.h"
+#include <avr/io.h>
+
+static uint8_t mem[E2END + 1];
+static std::string path;
+static uint64_t mempe_at;
+uint32_t sim_eeprom_writes;
+
+static uint8_t eecr_rd(SimReg8 &r) { sim_advance(1); return r.v; }
+static void eecr_wr(SimReg8 &r, uint8_t x)
+{
+    sim_advance(1);
+    if ((x & (1 << EERE)) && !(r.v & (1 << EEPE))) {
+        EEDR.v = mem[EEAR.v & E2END];
+        sim_advance(4);
+    }
+    if ((x & (1 << EEMPE)) && !(x & (1 << EEPE))) {
+        mempe_at = sim_cycles;
+        r.v = (r.v & (1 << EEPE)) | (x & 0x3C);
+        return;
+    }
+    if ((x & (1 << EEPE)) && !(r.v & (1 << EEPE)) && (r.v & (1 << EEMPE)) && sim_cycles - mempe_at <= 8) {
+        uint16_t a = EEAR.v & E2END;
+        uint8_t d = EEDR.v;
+        r.v = (r.v | (1 << EEPE)) & ~(1 << EEMPE);
+        sim_eeprom_writes++;
+        sim_at(sim_cycles + 3400 * 16, [a, d] {
+            mem[a] = d;
+            EECR.v &= ~(1 << EEPE);
+            sim_log("eeprom", "%03X %02X", a, d);
+        });
+        return;
+    }
+    r.v = (r.v & (1 << EEPE)) | (x & 0x38);
+}
+
+SimReg8 EECR{0, eecr_rd, eecr_wr}, EEDR;
+SimReg16 EEAR;
+
+void sim_eeprom_open(const char *dir)
+{
+    memset(mem, 0xFF, sizeof(mem));
+    path = std::string(dir) + "/eeprom.bin";
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f) { fread(mem, 1, sizeof(mem), f); fclose(f); }
+}
+
+void sim_eeprom_close(void)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f) { fwrite(mem, 1, sizeof(mem), f); fclose(f); }
+}
@@ -0,0 +1,140 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// scenario runner: drives the sketch's inputs from a script on the virtual clock
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <Arduino.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <termios.h>
+
+
+struct event { uint64_t at; std::string cmd; std::vector<std::string> args; };
+static std::vector<event> events;
+static size_t next_event;
+static const uint8_t enc_pins[3][3] = {{4, 3, 5}, {7, 6, 8}, {10, 9, 11}}; // ch0, ch1, sw
+
+static void schedule(uint64_t at_us, const std::string &cmd, std::vector<std::string> args)
+{
+    event e{at_us * 16, cmd, args};
+    auto it = events.begin() + next_event;
+    while (it != events.end() && it->at <= e.at) ++it;
+    events.insert(it, e);
+}
+
+static void run_event(const event &e)
+{
+    sim_log("event", "%s", e.cmd.c_str());
+    uint64_t t = e.at / 16;
+    if (e.cmd == "key") {
+        sim_sx1509_set_key(atoi(e.args[0].c_str()), e.args[1] == "down");
+    } else if (e.cmd == "sw0") {
+        sim_set_pin(12, e.args[0] == "down" ? 0 : 1);
+    } else if (e.cmd == "pot") {
+        sim_set_pot(atoi(e.args[0].c_str()), atoi(e.args[1].c_str()));
+    } else if (e.cmd == "encsw") {
+        uint8_t n = atoi(e.args[0].c_str());
+        sim_set_pin(enc_pins[n][2], 0);
+        schedule(t + 40000, "pin", {std::to_string(enc_pins[n][2]), "1"});
+    } else if (e.cmd == "pin") {
+        sim_set_pin(atoi(e.args[0].c_str()), atoi(e.args[1].c_str()));
+    } else if (e.cmd == "midi") {
+        for (auto &a : e.args) sim_usart_rx(strtoul(a.c_str(), nullptr, 16));
+    } else if (e.cmd == "enc") {
+        // one detent is a full Gray code cycle, 11 -> 01 -> 00 -> 10 -> 11 for clockwise
+        uint8_t n = atoi(e.args[0].c_str());
+        bool cw = e.args[1] == "cw";
+        int count = e.args.size() > 2 ? atoi(e.args[2].c_str()) : 1;
+        int gap = e.args.size() > 3 ? atoi(e.args[3].c_str()) : 1000;
+        static const uint8_t seq_cw[4] = {1, 0, 2, 3}, seq_ccw[4] = {2, 0, 1, 3};
+        for (int d = 0; d < count; d++) {
+            for (int s = 0; s < 4; s++) {
+                uint8_t ab = cw ? seq_cw[s] : seq_ccw[s];
+                uint64_t at = t + (uint64_t) (d * 4 + s) * gap;
+                schedule(at, "pin", {std::to_string(enc_pins[n][0]), std::to_string((ab >> 1) & 1)});
+                schedule(at, "pin", {std::to_string(enc_pins[n][1]), std::to_string(ab & 1)});
+            }
+        }
+    }
+}
+
+static void stimulus()
+{
+    while (next_event < events.size() && events[next_event].at <= sim_cycles) {
+        event e = events[next_event++];
+        run_event(e);
+    }
+    sim_next_stimulus = next_event < events.size() ? events[next_event].at : ~0ULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <scenario> <output dir> [pty]\n", argv[0]);
+        return 2;
+    }
+    std::ifstream in(argv[1]);
+    std::string line;
+    uint64_t end_us = 10000000;
+    while (std::getline(in, line)) {
+        std::istringstream ls(line);
+        double ms;
+        std::string cmd, a;
+        if (line.empty() || line[0] == '#' || !(ls >> ms >> cmd)) continue;
+        std::vector<std::string> args;
+        while (ls >> a) args.push_back(a);
+        if (cmd == "end") end_us = (uint64_t) (ms * 1000);
+        else schedule((uint64_t) (ms * 1000), cmd, args);
+    }
+    sim_open_logs(argv[2]);
+    sim_eeprom_open(argv[2]);
+    sim_stimulus_hook = stimulus;
+    sim_next_stimulus = events.empty() ? ~0ULL : events[0].at;
+    sim_set_pin(12, 1);
+    // in pty mode the MIDI port is a pseudo terminal for host tools to talk to, and the virtual clock is held back to wall time
+    bool realtime = argc > 3 && std::string(argv[3]) == "pty";
+    struct timespec start;
+    if (realtime) {
+        sim_midi_pty = posix_openpt(O_RDWR | O_NOCTTY);
+        grantpt(sim_midi_pty);
+        unlockpt(sim_midi_pty);
+        struct termios tio;
+        tcgetattr(sim_midi_pty, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(sim_midi_pty, TCSANOW, &tio);
+        fcntl(sim_midi_pty, F_SETFL, O_NONBLOCK);
+        std::string link = std::string(argv[2]) + "/midi_port";
+        unlink(link.c_str());
+        if (symlink(ptsname(sim_midi_pty), link.c_str()) != 0) perror("symlink");
+        printf("MIDI port %s\n", ptsname(sim_midi_pty));
+        fflush(stdout);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+    setup();
+    while (sim_cycles / 16 < end_us) {
+        loop();
+        sim_advance(200); // loop() call overhead and whatever the stubs do not account for
+        if (realtime) {
+            uint8_t buf[64];
+            ssize_t n = read(sim_midi_pty, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n; i++) sim_usart_rx(buf[i]);
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            uint64_t wall_us = (now.tv_sec - start.tv_sec) * 1000000ULL + (now.tv_nsec - start.tv_nsec) / 1000;
+            if (sim_cycles / 16 > wall_us + 1000) usleep(sim_cycles / 16 - wall_us);
+        }
+    }
+    sim_eeprom_close();
+    return 0;
+}
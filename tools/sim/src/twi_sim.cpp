@@ -0,0 +1,204 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// TWI peripheral and the two I2C devices on the ARDSEQUINO bus, an HT16K33 LED backpack and an SX1509 expander
+#include <string>
+#include <Arduino.h>
+#include <util/twi.h>
+
+struct i2c_device {
+    uint8_t addr;
+    virtual void start(bool read) = 0;
+    virtual void write(uint8_t b) = 0;
+    virtual uint8_t read() = 0;
+    virtual void stop() {}
+};
+
+// ---- HT16K33
+struct ht16k33 : i2c_device {
+    uint8_t ram[16] = {0}, shown[16] = {0};
+    uint8_t ptr = 0;
+    bool first = true, osc = false, on = false;
+    void start(bool) override { first = true; }
+    void write(uint8_t b) override
+    {
+        if (first) {
+            first = false;
+            if (b < 0x10) ptr = b;
+            else if ((b & 0xF0) == 0x20) osc = b & 1;
+            else if ((b & 0xF0) == 0x80) on = b & 1;
+            return;
+        }
+        ram[ptr] = b;
+        ptr = (ptr + 1) & 0x0F;
+    }
+    uint8_t read() override { uint8_t b = ram[ptr]; ptr = (ptr + 1) & 0x0F; return b; }
+    void stop() override
+    {
+        if (memcmp(ram, shown, 16) == 0) return;
+        memcpy(shown, ram, 16);
+        // one line per frame, rows top to bottom as they appear with FLIPPED_LEDS, '#' for a lit LED
+        std::string f;
+        for (int y = 7; y >= 0; y--) {
+            uint16_t row = ram[y * 2] | (ram[y * 2 + 1] << 8);
+            for (int x = 15; x >= 0; x--) f += (row >> x) & 1 ? '#' : '.';
+            if (y) f += '/';
+        }
+        sim_log("display", "%s", f.c_str());
+    }
+};
+
+// ---- SX1509
+struct sx1509 : i2c_device {
+    uint8_t regs[0x80];
+    uint8_t ptr = 0;
+    bool first = true;
+    uint8_t reset_step = 0;
+    uint16_t pins = 0xFFFF; // external levels, keys pull pins low
+    sx1509() { reset(); }
+    void reset()
+    {
+        memset(regs, 0, sizeof(regs));
+        regs[0x0E] = regs[0x0F] = 0xFF; // RegDir, all inputs
+        regs[0x10] = regs[0x11] = 0xFF; // RegData
+        regs[0x12] = regs[0x13] = 0xFF; // RegInterruptMask, all masked
+        update_nint();
+    }
+    uint16_t word(uint8_t reg) { return (regs[reg] << 8) | regs[reg + 1]; }
+    void update_nint() { sim_set_pin(2, word(0x18) ? 0 : 1); }
+    void start(bool) override { first = true; }
+    void write(uint8_t b) override
+    {
+        if (first) { first = false; ptr = b & 0x7F; return; }
+        if (ptr == 0x7D) {
+            reset_step = (b == 0x12) ? 1 : ((reset_step == 1 && b == 0x34) ? 2 : 0);
+            if (reset_step == 2) { reset(); reset_step = 0; }
+        } else if (ptr == 0x18 || ptr == 0x19) {
+            regs[ptr] &= ~b; // write 1 to clear
+            update_nint();
+        } else if (ptr != 0x10 && ptr != 0x11) {
+            regs[ptr] = b;
+        }
+        ptr = (ptr + 1) & 0x7F;
+    }
+    uint8_t read() override
+    {
+        uint8_t b = regs[ptr];
+        if (ptr == 0x10) b = pins >> 8;
+        if (ptr == 0x11) b = pins & 0xFF;
+        ptr = (ptr + 1) & 0x7F;
+        return b;
+    }
+    void set_pin(uint8_t p, bool level)
+    {
+        uint16_t m = 1 << p;
+        bool old = pins & m;
+        if (old == level) return;
+        pins = level ? (pins | m) : (pins & ~m);
+        if (word(0x12) & m) return;
+        static const uint8_t sense_reg[4] = {0x17, 0x16, 0x15, 0x14};
+        uint8_t sense = (regs[sense_reg[p / 4]] >> ((p % 4) * 2)) & 3;
+        if ((level && (sense & 1)) || (!level && (sense & 2))) {
+            regs[p >= 8 ? 0x18 : 0x19] |= 1 << (p & 7);
+            update_nint();
+        }
+    }
+};
+
+static ht16k33 backpack;
+static sx1509 expander;
+static i2c_device *devices[] = {&backpack, &expander};
+
+void sim_sx1509_set_key(uint8_t pin, bool pressed) { expander.set_pin(pin, !pressed); }
+
+// ---- TWI peripheral
+static i2c_device *dev;
+static bool bus_active, awaiting_sla, reading;
+static std::string txn;
+
+static uint32_t byte_cycles()
+{
+    static const uint32_t ps[4] = {1, 4, 16, 64};
+    return 9 * (16 + 2 * TWBR.v * ps[TWSR.v & 3]);
+}
+static void complete(uint8_t status, uint32_t after)
+{
+    sim_at(sim_cycles + after, [status]() {
+        TWSR.v = (TWSR.v & 3) | status;
+        TWCR.v |= 1 << TWINT;
+        sim_fire_pending();
+    });
+}
+static void log_txn()
+{
+    if (!txn.empty()) sim_log("i2c", "%s", txn.c_str());
+    txn.clear();
+}
+static void twcr_wr(SimReg8 &r, uint8_t x)
+{
+    uint8_t keep_int = r.v & (1 << TWINT);
+    r.v = (x & ~(1 << TWINT)) | ((x & (1 << TWINT)) ? 0 : keep_int);
+    if (!(x & (1 << TWEN)) || !(x & (1 << TWINT))) return;
+    uint32_t scl = byte_cycles() / 9;
+    if (x & (1 << TWSTO)) {
+        if (dev) dev->stop();
+        dev = nullptr;
+        bus_active = false;
+        log_txn();
+        r.v &= ~(1 << TWSTO);
+        if (!(x & (1 << TWSTA))) return;
+    }
+    if (x & (1 << TWSTA)) {
+        uint8_t status = bus_active ? TW_REP_START : TW_START;
+        if (bus_active) txn += " |";
+        bus_active = true;
+        awaiting_sla = true;
+        complete(status, scl * 2);
+        return;
+    }
+    if (awaiting_sla) {
+        awaiting_sla = false;
+        uint8_t sla = TWDR.v;
+        reading = sla & 1;
+        dev = nullptr;
+        for (auto d : devices) if (d->addr == (sla >> 1)) dev = d;
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%s%02X %c", txn.empty() ? "" : " ", sla >> 1, reading ? 'R' : 'W');
+        txn += buf;
+        if (!dev) {
+            txn += " NACK";
+            complete(reading ? TW_MR_SLA_NACK : TW_MT_SLA_NACK, byte_cycles());
+            return;
+        }
+        dev->start(reading);
+        complete(reading ? TW_MR_SLA_ACK : TW_MT_SLA_ACK, byte_cycles());
+        return;
+    }
+    char buf[8];
+    if (reading) {
+        uint8_t b = dev->read();
+        snprintf(buf, sizeof(buf), " %02X", b);
+        txn += buf;
+        bool ack = x & (1 << TWEA);
+        sim_at(sim_cycles + byte_cycles(), [b]() { TWDR.v = b; });
+        complete(ack ? TW_MR_DATA_ACK : TW_MR_DATA_NACK, byte_cycles());
+    } else {
+        dev->write(TWDR.v);
+        snprintf(buf, sizeof(buf), " %02X", TWDR.v);
+        txn += buf;
+        complete(TW_MT_DATA_ACK, byte_cycles());
+    }
+}
+
+SimReg8 TWBR, TWSR{0xF8}, TWAR, TWDR, TWCR{0, nullptr, twcr_wr}, TWAMR;
+
+struct twi_addr_init {
+    twi_addr_init() { backpack.addr = 0x70; expander.addr = 0x3E; }
+} twi_addr_init_instance;
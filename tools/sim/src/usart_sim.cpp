@@ -0,0 +1,110 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// USART0 transmitter: a one byte data register in front of the shift register, 10 bit frames at the programmed baud rate
+#include <deque>
+#include <unistd.h>
+#include "sim.h"
+#include <avr/io.h>
+
+int sim_midi_pty = -1;
+static bool shifting;
+static bool buffered;
+static uint8_t buffer_byte;
+
+static uint64_t frame_cycles()
+{
+    return 160ULL * (UBRR0.v + 1); // 16 cycles per bit at U2X0 = 0, 10 bits per frame
+}
+
+static void shift_out(uint8_t b)
+{
+    shifting = true;
+    sim_log("midi", "%02X", b);
+    if (sim_midi_pty >= 0 && write(sim_midi_pty, &b, 1) != 1) perror("pty");
+    sim_at(sim_cycles + frame_cycles(), [] {
+        shifting = false;
+        if (buffered) {
+            buffered = false;
+            UCSR0A.v |= 1 << UDRE0;
+            shift_out(buffer_byte);
+        } else {
+            UCSR0A.v |= 1 << TXC0;
+        }
+    });
+}
+
+static void udr_wr(SimReg8 &r, uint8_t x)
+{
+    r.v = x;
+    if (!(UCSR0B.v & (1 << TXEN0))) return;
+    UCSR0A.v &= ~(1 << TXC0);
+    if (!shifting) {
+        shift_out(x);
+    } else {
+        buffered = true;
+        buffer_byte = x;
+        UCSR0A.v &= ~(1 << UDRE0);
+    }
+}
+// receiver: bytes handed in by the scenario or the pty arrive one frame time apart
+static std::deque<uint8_t> rx_pending;
+static bool rx_busy;
+static uint8_t rx_data;
+
+static void rx_next()
+{
+    if (rx_pending.empty()) {
+        rx_busy = false;
+        return;
+    }
+    rx_busy = true;
+    sim_at(sim_cycles + frame_cycles(), [] {
+        uint8_t b = rx_pending.front();
+        rx_pending.pop_front();
+        if (UCSR0B.v & (1 << RXEN0)) {
+            if (UCSR0A.v & (1 << RXC0)) {
+                UCSR0A.v |= 1 << DOR0;
+                sim_log("midi", "overrun, %02X lost", b);
+            } else {
+                rx_data = b;
+                UCSR0A.v |= 1 << RXC0;
+            }
+        }
+        rx_next();
+        sim_fire_pending();
+    });
+}
+
+void sim_usart_rx(uint8_t b)
+{
+    sim_log("midi", "in %02X", b);
+    rx_pending.push_back(b);
+    if (!rx_busy) rx_next();
+}
+
+static uint8_t udr_rd(SimReg8 &r)
+{
+    UCSR0A.v &= ~((1 << RXC0) | (1 << DOR0) | (1 << FE0));
+    return rx_data;
+}
+
+static void ucsr0b_wr(SimReg8 &r, uint8_t x)
+{
+    r.v = x;
+    sim_fire_pending();
+}
+static void ucsr0a_wr(SimReg8 &r, uint8_t x)
+{
+    r.v = (r.v & ~(1 << TXC0) & 0xFC) | (x & 0x03); // TXC0 is cleared by writing one, U2X0/MPCM are plain bits
+}
+
+SimReg8 UDR0{0, udr_rd, udr_wr}, UCSR0A{1 << UDRE0, nullptr, ucsr0a_wr}, UCSR0B{0, nullptr, ucsr0b_wr}, UCSR0C{0x06};
+SimReg16 UBRR0;
@@ -0,0 +1,256 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Per-key tracks for polyrhythms and polymeters. A key with a length or rate of its own plays its row of the pattern
+// on its own: it loops over the first length steps and takes a step every rate clock engine ticks, where CLOCK_PPQN
+// ticks is one step of the sequencer. All tracks run off the same engine tick count, so they never drift apart.
+// The next step of every such key sits in a binary min-heap ordered by the tick the step has to be handed to the note
+// scheduler (schedule.ino), which is a little ahead of the step itself so the note is already waiting when its time
+// comes. Each loop() pass only looks at the top of the heap and pops the keys that have got there, so a pass costs at
+// most one pop and push per key however fast the tracks run. Keys left on the pattern length and CLOCK_PPQN stay out
+// of the heap and simply play along with the sequencer's own step.
+
+track_queue_t tracks;
+
+bool track_has_own_timing(uint8_t key_num)
+{
+    return (key_array[key_num].length != 0) || (key_array[key_num].rate != TRACK_RATE_DEFAULT);
+}
+
+uint16_t track_length(uint8_t key_num)
+{
+    return (key_array[key_num].length != 0) ? key_array[key_num].length : global_seq.length;
+}
+
+/*
+ * Function: track_deadline
+ * Description: engine tick a key's next step is handed to the note scheduler on, half a step ahead plus however early the key's offset makes it
+ */
+
+uint32_t track_deadline(uint8_t key_num)
+{
+    return tracks.track[key_num].due - (key_array[key_num].rate / 2) - schedule_lead(key_num);
+}
+
+bool track_before(uint8_t a, uint8_t b)
+{
+    return (int32_t) (track_deadline(a) - track_deadline(b)) < 0;
+}
+
+void tracks_sift_up(uint8_t i)
+{
+    while (i > 0) {
+        uint8_t parent = (i - 1) / 2;
+        if (!track_before(tracks.heap[i], tracks.heap[parent])) {
+            break;
+        }
+        uint8_t key = tracks.heap[i];
+        tracks.heap[i] = tracks.heap[parent];
+        tracks.heap[parent] = key;
+        i = parent;
+    }
+}
+
+void tracks_sift_down(uint8_t i)
+{
+    for (;;) {
+        uint8_t first = i;
+        uint8_t child = 2 * i + 1;
+        if ((child < tracks.count) && track_before(tracks.heap[child], tracks.heap[first])) {
+            first = child;
+        }
+        if (((child + 1) < tracks.count) && track_before(tracks.heap[child + 1], tracks.heap[first])) {
+            first = child + 1;
+        }
+        if (first == i) {
+            break;
+        }
+        uint8_t key = tracks.heap[i];
+        tracks.heap[i] = tracks.heap[first];
+        tracks.heap[first] = key;
+        i = first;
+    }
+}
+
+void tracks_push(uint8_t key_num)
+{
+    tracks.heap[tracks.count] = key_num;
+    tracks.queued |= (1 << key_num);
+    tracks_sift_up(tracks.count++);
+}
+
+void tracks_remove(uint8_t key_num)
+{
+    for (uint8_t i = 0; i < tracks.count; i++) {
+        if (tracks.heap[i] == key_num) {
+            tracks.heap[i] = tracks.heap[--tracks.count];
+            tracks.queued &= ~(1 << key_num);
+            if (i < tracks.count) {
+                tracks_sift_down(i);
+                tracks_sift_up(i);
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * Function: track_rewind
+ * Description: puts a track just before its first step, so the next step it takes is the first one in the sequencer's direction
+ */
+
+void track_rewind(uint8_t key_num)
+{
+    tracks.track[key_num].pos = global_seq.direction ? (track_length(key_num) - 1) : 0;
+}
+
+/*
+ * Function: tracks_start
+ * Description: (re)builds the deadline queue when the clock engine starts, the engine tick count starts over from 0
+ * Input:
+ *    restart - true == every track goes back to its first step
+ *    downbeat - true == the first steps are due straight away, as with MIDI Start, false == one step of each track in, as with the play button
+ */
+
+void tracks_start(bool restart, bool downbeat)
+{
+    tracks.count = 0;
+    tracks.queued = 0;
+    tracks.resync = 0;
+    for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
+        if (!track_has_own_timing(i)) {
+            continue;
+        }
+        if (restart) {
+            track_rewind(i);
+        }
+        tracks.track[i].due = downbeat ? 0 : key_array[i].rate;
+        tracks.track[i].pass = 0;
+        tracks_push(i);
+    }
+    tracks.fresh = tracks.queued;
+}
+
+/*
+ * Function: tracks_update
+ * Description: brings a key's place in the queue in line with its settings after its length, rate or offset have been changed.
+ *    A key that gets timing of its own carries on from the sequencer's step and takes its first step of its own one rate after the last sequencer step.
+ */
+
+void tracks_update(uint8_t key_num)
+{
+    bool own = track_has_own_timing(key_num);
+    bool queued = tracks.queued & (1 << key_num);
+
+    if (own && !queued) {
+        tracks.track[key_num].pos = global_seq.step;
+        tracks.track[key_num].due = clock_engine_step_tick() + key_array[key_num].rate;
+        tracks.track[key_num].pass = sched.pass;
+        tracks_push(key_num);
+    } else if (!own && queued) {
+        tracks_remove(key_num);
+    } else if (own) {
+        tracks_remove(key_num); // its deadline has moved, put it back in order
+        tracks_push(key_num);
+    }
+}
+
+void tracks_update_all()
+{
+    for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
+        tracks_update(i);
+    }
+}
+
+/*
+ * Function: tracks_resync
+ * Description: sends tracks back to their first step on the next bar boundary, the tracks keep playing until then.
+ *    While the sequencer is stopped they are rewound straight away.
+ * Input:
+ *    mask - bit n set == resync key n
+ */
+
+void tracks_resync(uint16_t mask)
+{
+    if (!clock_engine_running()) {
+        for (uint8_t i = 0; i < MAX_POLYPHONY; i++) {
+            if (mask & (1 << i)) {
+                track_rewind(i);
+            }
+        }
+        tracks.resync = 0;
+        return;
+    }
+
+    uint32_t bar = (uint32_t) TRACK_BAR_BEATS * CLOCK_PPQN * global_seq.npb;
+    tracks.resync_tick = ((clock_engine_ticks() / bar) + 1) * bar;
+    tracks.resync = mask & tracks.queued;
+    for (uint8_t i = 0; i < tracks.count; i++) {
+        track_t *track = &tracks.track[tracks.heap[i]];
+        if ((tracks.resync & (1 << tracks.heap[i])) && ((int32_t) (track->due - tracks.resync_tick) > 0)) {
+            track->due = tracks.resync_tick;
+        }
+    }
+    for (int8_t i = (tracks.count / 2) - 1; i >= 0; i--) {
+        tracks_sift_down(i); // due ticks have moved, restore the heap order
+    }
+}
+
+/*
+ * Function: tracks_handler
+ * Description: hands the steps of the tracks that have come up over to the note scheduler, called from every loop() pass while the sequencer runs
+ */
+
+void tracks_handler()
+{
+    if (!clock_engine_running()) {
+        return;
+    }
+    uint32_t now = clock_engine_ticks();
+
+    // every key is popped at most once per pass, which bounds the time a pass can take
+    for (uint8_t popped = 0; (tracks.count > 0) && (popped < MAX_POLYPHONY); popped++) {
+        uint8_t key = tracks.heap[0];
+        track_t *track = &tracks.track[key];
+        int32_t late = now - track_deadline(key);
+        if (late < 0) {
+            break;
+        }
+
+        uint16_t key_bit = 1 << key;
+        if ((tracks.resync & key_bit) && (track->due == tracks.resync_tick)) {
+            tracks.resync &= ~key_bit;
+            track_rewind(key);
+        }
+        uint16_t length = track_length(key);
+        if (global_seq.direction) {
+            track->pos = ((track->pos + 1) >= length) ? 0 : (track->pos + 1);
+        } else {
+            track->pos = ((track->pos == 0) || (track->pos >= length)) ? (length - 1) : (track->pos - 1);
+        }
+        if ((track->pos == (global_seq.direction ? 0 : (length - 1))) && !(tracks.fresh & key_bit)) {
+            track->pass = trig_next_pass(track->pass);
+        }
+        tracks.fresh &= ~key_bit;
+        uint8_t rate = key_array[key].rate;
+        uint32_t step_tick = track->due + (late / rate) * rate; // steps that were missed entirely are skipped, not played late
+        uint8_t pat_num = pattern_at(step_tick);
+        uint16_t where = locks_where(pat_num, track->pos, 0);
+        uint8_t lock = locks_seek(&track->lock, where);
+        if (trig_keys(pattern_step(pat_num, track->pos) & key_bit, track->pass, lock, where)) {
+            schedule_note(key, schedule_time(step_tick, key), locks_key(lock, where | key));
+        }
+        track->due = step_tick + rate;
+        if ((tracks.resync & key_bit) && ((int32_t) (track->due - tracks.resync_tick) > 0)) {
+            track->due = tracks.resync_tick; // the bar comes before the next step, take the first step on the bar instead
+        }
+        tracks_sift_down(0);
+    }
+}
@@ -0,0 +1,203 @@
+/*
+ * This file is part of the ARDSEQUINO project.
+ *
+ * ARDSEQUINO is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ARDSEQUINO is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ARDSEQUINO. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Interrupt driven I2C master. Callers queue transactions and get on with their work, the TWI interrupt walks
+// each transaction through the bus states and starts the next one as soon as the previous one has finished.
+// There is one queue per priority level and input transactions are always started ahead of display ones,
+// so a key scan only ever waits for the display transaction that is already on the bus.
+// This replaces the Wire library, which owns the TWI interrupt itself and blocks until every transfer is done.
+
+twi_queue_t twi_queue[TWI_PRIO_CT];
+twi_transaction_t * volatile twi_current = NULL; // transaction that is on the bus, NULL when the bus is idle
+uint8_t twi_current_prio = 0;
+uint8_t twi_pos = 0; // bytes transferred in the current phase of the transaction
+bool twi_reading = false; // true once the transaction has moved on to its read phase
+volatile uint8_t twi_sync_status;
+
+/*
+ * Function: twi_init
+ * Description: enables the TWI peripheral and the internal pull-ups on SDA/SCL
+ */
+
+void twi_init()
+{
+    fast_pin<SDA>::write(HIGH);
+    fast_pin<SCL>::write(HIGH);
+    TWSR = 0; // bit rate prescaler of 1
+    TWBR = ((F_CPU / TWI_FREQ) - 16) / 2;
+    TWCR = (1 << TWEN);
+}
+
+/*
+ * Function: twi_start_next
+ * Description: picks the next queued transaction, highest priority first, interrupts must be disabled when calling this
+ * Output:
+ *    true if a transaction was found, it becomes twi_current and the caller is responsible for issuing the START
+ */
+
+bool twi_start_next()
+{
+    for (uint8_t prio = 0; prio < TWI_PRIO_CT; prio++) {
+        if (twi_queue[prio].count > 0) {
+            twi_current = &twi_queue[prio].slot[twi_queue[prio].head];
+            twi_current_prio = prio;
+            return true;
+        }
+    }
+    twi_current = NULL;
+    return false;
+}
+
+/*
+ * Function: twi_queue_transaction
+ * Description: queues a write and/or read transaction, the buffers have to stay valid until it has completed
+ * Input:
+ *    prio - TWI_PRIO_INPUT or TWI_PRIO_DISPLAY
+ *    addr - 7-bit device address
+ *    tx - bytes written to the device, usually a register address followed by data
+ *    tx_len - number of bytes in tx, 0 for a read-only transaction
+ *    rx - buffer for the bytes read back after a repeated start
+ *    rx_len - number of bytes to read, 0 for a write-only transaction
+ *    done - called from the TWI interrupt with TWI_OK or an error code once the transaction has finished, may be NULL
+ * Output:
+ *    false if the queue for this priority level is full
+ */
+
+bool twi_queue_transaction(uint8_t prio, uint8_t addr, const uint8_t *tx, uint8_t tx_len, uint8_t *rx, uint8_t rx_len, void (*done)(uint8_t status))
+{
+    bool queued = false;
+
+    noInterrupts();
+    twi_queue_t *q = &twi_queue[prio];
+    if (q->count < TWI_QUEUE_LEN) {
+        twi_transaction_t *t = &q->slot[(q->head + q->count) & (TWI_QUEUE_LEN - 1)];
+        t->addr = addr;
+        t->tx = tx;
+        t->tx_len = tx_len;
+        t->rx = rx;
+        t->rx_len = rx_len;
+        t->done = done;
+        q->count++;
+        queued = true;
+        if ((twi_current == NULL) && twi_start_next()) {
+            TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+        }
+    }
+    interrupts();
+    return queued;
+}
+
+/*
+ * Function: twi_queue_free
+ * Description: number of free transaction slots at a given priority level
+ * Input:
+ *    prio - TWI_PRIO_INPUT or TWI_PRIO_DISPLAY
+ */
+
+uint8_t twi_queue_free(uint8_t prio)
+{
+    noInterrupts();
+    uint8_t free_slots = TWI_QUEUE_LEN - twi_queue[prio].count;
+    interrupts();
+    return free_slots;
+}
+
+void twi_sync_done(uint8_t status)
+{
+    twi_sync_status = status;
+}
+
+/*
+ * Function: twi_transfer
+ * Description: queues a transaction and waits for it to complete, only meant for bootup where nothing else is going on
+ * Output:
+ *    TWI_OK or an error code
+ */
+
+uint8_t twi_transfer(uint8_t addr, const uint8_t *tx, uint8_t tx_len, uint8_t *rx, uint8_t rx_len)
+{
+    twi_sync_status = TWI_PENDING;
+    while (!twi_queue_transaction(TWI_PRIO_INPUT, addr, tx, tx_len, rx, rx_len, twi_sync_done));
+    while (twi_sync_status == TWI_PENDING) {
+        sleep_mode(); // idle until the next interrupt, the TWI interrupt is what completes the transaction
+    }
+    return twi_sync_status;
+}
+
+/*
+ * Function: twi_finish
+ * Description: retires the current transaction and chains straight into the next one, called from the TWI interrupt
+ * Input:
+ *    status - TWI_OK or an error code that is handed to the completion callback
+ */
+
+void twi_finish(uint8_t status)
+{
+    void (*done)(uint8_t) = twi_current->done;
+    twi_queue_t *q = &twi_queue[twi_current_prio];
+
+    q->head = (q->head + 1) & (TWI_QUEUE_LEN - 1);
+    q->count--;
+    if (twi_start_next()) {
+        TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE); // STOP immediately followed by a START
+    } else {
+        TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
+    }
+    if (done != NULL) {
+        done(status);
+    }
+}
+
+ISR (TWI_vect)
+{
+    twi_transaction_t *t = twi_current;
+
+    switch (TW_STATUS) {
+        case TW_START:
+        case TW_REP_START:
+            // a transaction without anything to write goes straight to its read phase
+            twi_reading = (TW_STATUS == TW_REP_START) || (t->tx_len == 0);
+            twi_pos = 0;
+            TWDR = (t->addr << 1) | (twi_reading ? TW_READ : TW_WRITE);
+            TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+            break;
+        case TW_MT_SLA_ACK:
+        case TW_MT_DATA_ACK:
+            if (twi_pos < t->tx_len) {
+                TWDR = t->tx[twi_pos++];
+                TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+            } else if (t->rx_len > 0) {
+                TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE); // repeated start for the read phase
+            } else {
+                twi_finish(TWI_OK);
+            }
+            break;
+        case TW_MR_SLA_ACK:
+            // ACK every byte except the last one so the device releases the bus
+            TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE) | ((t->rx_len > 1) ? (1 << TWEA) : 0);
+            break;
+        case TW_MR_DATA_ACK:
+            t->rx[twi_pos++] = TWDR;
+            TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE) | (((twi_pos + 1) < t->rx_len) ? (1 << TWEA) : 0);
+            break;
+        case TW_MR_DATA_NACK:
+            t->rx[twi_pos++] = TWDR;
+            twi_finish(TWI_OK);
+            break;
+        case TW_MT_SLA_NACK:
+        case TW_MT_DATA_NACK:
+        case TW_MR_SLA_NACK:
+            twi_finish(TWI_ERR_NACK);
+            break;
+        default: // bus error or lost arbitration, the STOP issued by twi_finish() releases the bus
+            twi_finish(TWI_ERR_BUS);
+            break;
+    }
+}